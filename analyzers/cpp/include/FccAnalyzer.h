@@ -0,0 +1,72 @@
+#ifndef FCC_ANALYZER_H
+#define FCC_ANALYZER_H
+
+#include "FccEventSource.h"
+#include "FccModule.h"
+#include "FccCalibration.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//runs the analysis modules on a pool of worker threads
+//the reading thread hands out batches of events, workers decode them and call every module
+//run transitions wait for all workers to be idle, so modules can merge their accumulators safely
+class FccAnalyzer {
+  public:
+    FccAnalyzer(int nthreads, int batchsize = 64);
+    ~FccAnalyzer();
+
+    void AddModule(std::unique_ptr<FccModule> module);
+
+    //process all events from source, returns the number of analyzed events
+    uint64_t Run(FccEventSource& source);
+
+    void PrintStatistics() const;
+
+  private:
+    typedef std::vector<std::unique_ptr<FccEvent>> Batch;
+
+    const int nthreads;
+    const size_t batchsize;
+    std::vector<std::unique_ptr<FccModule>> modules;
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable queueNotEmpty; //signals workers
+    std::condition_variable queueNotFull; //signals reader
+    std::deque<Batch> queue;
+    std::vector<std::unique_ptr<FccEvent>> freeEvents; //recycled event buffers
+    int busyWorkers = 0;
+    bool stopWorkers = false;
+
+    int currentRun = -1;
+
+    //from the calibration banks read so far, by the reading thread. The events share a snapshot
+    //that is replaced when one brings new banks.
+    FccCalibration calibration;
+    std::shared_ptr<const FccCalibration> calibrationSnapshot;
+
+    //statistics
+    struct alignas(64) WorkerStats {
+      uint64_t events = 0;
+      uint64_t bytes = 0;
+      uint64_t badEvents = 0;
+      double cputime = 0; //seconds spent processing
+    };
+    std::vector<WorkerStats> stats;
+    double walltime = 0;
+
+    void WorkerFunction(int thread);
+    std::unique_ptr<FccEvent> GetFreeEvent();
+    void Submit(Batch& batch);
+    void Drain(); //wait until all submitted events have been processed
+
+    void BeginRun(int run);
+    void EndRun(int run);
+};
+
+#endif
@@ -0,0 +1,112 @@
+#ifndef FCC_BANKS_H
+#define FCC_BANKS_H
+
+#include "FccEvent.h"
+#include <stdint.h>
+#include <vector>
+
+class FccCalibration;
+
+//W<x>EV: digitizer event header written by CaenDigitizerMidas::ReadData
+struct FccScopeHeader {
+  int frontend;
+  uint64_t timestamp;
+  uint32_t trigger_id;
+  uint16_t flags;
+};
+
+//W<x>SP: scan point of the event during an in-run scan, see Settings/Scan Enable of vx2730_fe.
+//The values are Settings/Scan Values in the ODB dump of the run.
+struct FccScanPoint {
+  int frontend;
+  uint32_t index;
+  uint32_t count;
+};
+
+//one waveform, W<x><yy> for the digitizers and TEK<n> (first scope) or TK<k><n> (scope k)
+//for the oscilloscopes
+struct FccWaveform {
+  int board; //frontend index for digitizers, scope index for Tektronix
+  int channel;
+  const uint16_t* samples;
+  uint32_t nsamples;
+  int frame = 0; //FastFrame segment of TEK<n>, 0 otherwise
+  uint32_t first = 0; //point of the record where the samples start, from TEKC
+};
+
+//TEKC / TK<k>C: the TEK<n> banks of the event are one window of a long record, the windows of
+//an acquisition come in consecutive events
+struct FccTekChunk {
+  int scope;
+  uint32_t acquisition;
+  uint32_t index;
+  uint32_t count; //windows of the acquisition
+  uint32_t first; //point of the record, from 0
+  uint32_t points;
+  uint32_t recordLength;
+
+  bool Last() const { return index + 1 == count; }
+};
+
+//W<x>PK: all channels of one digitizer event in one bank, see CaenDigitizerMidas::WritePackedBank
+//channel n starts at payload+offset[n] on a 32 byte boundary of the bank; with stride != 0 all
+//channels have size[0] samples and the payload can be processed as a nchannels x stride matrix
+struct FccPackedWaveforms {
+  int board;
+  uint16_t nchannels;
+  uint32_t stride;
+  uint64_t mask;
+  const uint32_t* offset;
+  const uint32_t* size;
+  const uint16_t* payload;
+
+  const uint16_t* Samples(int n) const { return payload + offset[n]; }
+};
+
+//RAW<x>: undecoded Dig2 raw endpoint data
+struct FccRawBlock {
+  int frontend;
+  const uint8_t* data;
+  uint32_t size;
+};
+
+//typed content of one event, all views point inside the FccEvent buffer
+class FccDecodedEvent {
+  public:
+    const FccEvent* event = nullptr;
+    //sample to volts and time of the boards, from the last calibration banks, may be nullptr
+    const FccCalibration* calibration = nullptr;
+    std::vector<FccScopeHeader> scope;
+    std::vector<FccScanPoint> scanPoints;
+    std::vector<FccWaveform> waveforms; //from W<x><yy> and W<x>PK
+    std::vector<FccPackedWaveforms> packed;
+    std::vector<FccWaveform> tek; //one entry per frame with FastFrame
+    //TEKT and TK<k>T by scope, ps since midnight of the scope clock, 0 if unknown
+    std::vector<std::vector<uint64_t>> tekFrameTimes;
+    int tekSampleBits = 16; //TEKW, 8 if the scopes sent 8 bit samples
+    std::vector<FccTekChunk> tekChunks;
+    std::vector<FccRawBlock> raw;
+
+    void Clear();
+
+    //decode all known banks, unknown banks are ignored
+    bool Decode(FccEvent& ev);
+
+    static bool DecodeScopeHeader(const FccBank& bank, FccScopeHeader& header);
+    static bool DecodeScanPoint(const FccBank& bank, FccScanPoint& point);
+    static bool DecodeWaveform(const FccBank& bank, FccWaveform& wf);
+    static bool DecodePacked(const FccBank& bank, FccPackedWaveforms& pk);
+    //TID_UINT8 banks are widened to the 16 bit scale (v << 8) into wide
+    static bool DecodeTek(const FccBank& bank, FccWaveform& wf, std::vector<uint16_t>* wide = nullptr);
+    static bool DecodeTekWidth(const FccBank& bank, int& bits);
+    static bool DecodeTekFrames(const FccBank& bank, std::vector<uint64_t>& times);
+    static bool DecodeTekChunk(const FccBank& bank, FccTekChunk& chunk);
+    static bool DecodeRaw(const FccBank& bank, FccRawBlock& raw);
+    //scope of TEK? and TK<k>? banks, -1 for other banks
+    static int TekScope(const FccBank& bank);
+
+  private:
+    std::vector<std::vector<uint16_t>> tekWide; //samples of TID_UINT8 TEK<n> banks
+};
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef FCC_CALIBRATION_H
+#define FCC_CALIBRATION_H
+
+#include "FccBanks.h"
+#include <stdint.h>
+#include <map>
+#include <vector>
+
+//sample to volts and sample to time of one board, from TEKV / TK<k>V for the scopes and W<x>CV for
+//the digitizers. The frontends write them at begin of run and into the next event after a change.
+//Bank layout, TID_DOUBLE: number of channels n, s per sample, s from the trigger to the first sample
+//of the record, V per code[n], V at code 0[n], then anything specific to the frontend.
+struct FccBoardCalibration {
+  double dt = 0;
+  double t0 = 0;
+  std::vector<float> gain; //by channel, on the 16 bit scale of the decoded samples, 0 if unknown
+  std::vector<float> offset;
+};
+
+//the calibration of all boards. FccAnalyzer keeps it up to date in the reading thread and attaches
+//the one in effect to each event, see FccDecodedEvent::calibration.
+class FccCalibration {
+  public:
+    //takes the calibration banks of ev, false if it has none. Reads only the bank headers of ev.
+    bool Update(const FccEvent& ev);
+    const FccBoardCalibration* Find(bool tek, int board) const;
+    float Gain(bool tek, int board, int channel) const;
+
+    //volts[i] = samples[i]*gain + offset, false without a calibration for the channel
+    bool ToVolts(bool tek, const FccWaveform& wf, float* volts) const;
+    //s from the trigger of each sample, FccWaveform::first is the first sample of a record window
+    bool ToTime(bool tek, const FccWaveform& wf, double* times) const;
+
+    //the loops, built with -O3 so that they vectorize
+    static void ToVolts(const uint16_t* samples, uint32_t n, float gain, float offset, float* volts);
+    static void ToTime(uint32_t first, uint32_t n, double dt, double t0, double* times);
+
+    static bool DecodeBank(const FccBank& bank, FccBoardCalibration& calibration);
+    //TEKV, TK<k>V or W<x>CV
+    static bool IsCalibrationBank(const FccBank& bank);
+
+  private:
+    static int Key(bool tek, int board) { return (tek?1<<16:0) | board; }
+    std::map<int, FccBoardCalibration> boards;
+};
+
+#endif
@@ -0,0 +1,126 @@
+#ifndef FCC_EVENT_H
+#define FCC_EVENT_H
+
+#include <stdint.h>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+class FccCalibration;
+
+//on-disk layout of a MIDAS event header, kept here so that offline tools do not need midas.h
+struct FccEventHeader {
+  int16_t event_id;
+  int16_t trigger_mask;
+  uint32_t serial_number;
+  uint32_t time_stamp;
+  uint32_t data_size;
+};
+
+//view of a single bank inside an event, it does not own the data
+struct FccBank {
+  char name[5];
+  uint32_t type; //MIDAS TID_xxx
+  uint32_t size; //payload size in bytes
+  const uint8_t* data;
+
+  template<typename T> const T* As() const { return reinterpret_cast<const T*>(data); }
+  template<typename T> uint32_t Count() const { return size/sizeof(T); }
+};
+
+//MIDAS bank type ids used by the FCC frontends
+enum FccTid : uint32_t {
+  kTidUint8 = 1,
+  kTidInt8 = 2,
+  kTidUint16 = 4,
+  kTidInt16 = 5,
+  kTidUint32 = 6,
+  kTidInt32 = 7,
+  kTidFloat = 9,
+  kTidDouble = 10,
+  kTidInt64 = 17,
+  kTidUint64 = 18
+};
+
+//a MIDAS event held in a reusable buffer (header followed by the bank structure)
+class FccEvent {
+  public:
+    static constexpr uint16_t kBeginOfRun = 0x8000;
+    static constexpr uint16_t kEndOfRun = 0x8001;
+    static constexpr uint16_t kMessage = 0x8002;
+
+    FccEvent() {};
+    virtual ~FccEvent() noexcept {};
+
+    std::vector<uint8_t> buffer;
+    //in effect for this event, set by FccAnalyzer
+    std::shared_ptr<const FccCalibration> calibration;
+
+    const FccEventHeader& GetHeader() const { return *reinterpret_cast<const FccEventHeader*>(buffer.data()); }
+    uint16_t GetEventId() const { return (uint16_t)GetHeader().event_id; }
+    uint32_t GetSerialNumber() const { return GetHeader().serial_number; }
+    const uint8_t* GetData() const { return buffer.data() + sizeof(FccEventHeader); }
+    uint32_t GetDataSize() const { return GetHeader().data_size; }
+
+    //BOR, EOR and message events carry no bank structure
+    bool IsInternal() const { return (GetEventId() & 0xFF00) == 0x8000; }
+
+    //(re)build the bank list, returns false on a malformed bank structure
+    bool ParseBanks();
+    //calls f(const FccBank&) for each bank without building the list, stops at a malformed bank
+    template<typename F> bool ForEachBank(F&& f) const;
+    const std::vector<FccBank>& GetBanks() const { return banks; }
+    const FccBank* FindBank(const char* name) const;
+
+    //fill a bare header, used by online sources to emit BOR/EOR markers
+    void MakeTransition(uint16_t id, uint32_t run);
+
+  private:
+    std::vector<FccBank> banks;
+
+    //bank header flags from midas.h
+    static constexpr uint32_t kBankFormat32Bit = (1<<4);
+    static constexpr uint32_t kBankFormat64BitAligned = (1<<5);
+};
+
+template<typename F> bool FccEvent::ForEachBank(F&& f) const {
+  if(buffer.size() < sizeof(FccEventHeader) + 8 || IsInternal())
+    return false;
+
+  const uint8_t* ptr = GetData();
+  uint32_t bankdatasize = *reinterpret_cast<const uint32_t*>(ptr);
+  uint32_t flags = *reinterpret_cast<const uint32_t*>(ptr+4);
+  if(bankdatasize + 8 > GetDataSize())
+    return false;
+
+  bool is32 = flags & kBankFormat32Bit;
+  bool is32a = flags & kBankFormat64BitAligned;
+  uint32_t headersize = is32a ? 16 : (is32 ? 12 : 8);
+
+  const uint8_t* pbk = ptr + 8;
+  const uint8_t* pend = pbk + bankdatasize;
+  FccBank bank;
+  while(pbk + headersize <= pend){
+    memcpy(bank.name, pbk, 4);
+    bank.name[4] = 0;
+    if(is32 || is32a){
+      bank.type = *reinterpret_cast<const uint32_t*>(pbk+4);
+      bank.size = *reinterpret_cast<const uint32_t*>(pbk+8);
+    } else {
+      bank.type = *reinterpret_cast<const uint16_t*>(pbk+4);
+      bank.size = *reinterpret_cast<const uint16_t*>(pbk+6);
+    }
+    bank.data = pbk + headersize;
+
+    if(bank.data + bank.size > pend)
+      return false;
+    f(bank);
+
+    //banks are padded to 8 bytes
+    pbk = bank.data + ((bank.size + 7) & ~7u);
+  }
+
+  return true;
+}
+
+#endif
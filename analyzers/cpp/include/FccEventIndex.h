@@ -0,0 +1,87 @@
+#ifndef FCC_EVENT_INDEX_H
+#define FCC_EVENT_INDEX_H
+
+#include "FccEvent.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+class FccLz4Reader;
+
+//sidecar index of a run file (<run file>.idx), mapping serial number, trigger_id and
+//digitizer timestamp to the position of the event in the file
+//for lz4 files the position is the offset of the block and the offset inside the decompressed block
+class FccEventIndex {
+  public:
+    struct Entry {
+      uint64_t offset; //file offset, or lz4 block offset
+      uint32_t blockpos; //offset inside the decompressed lz4 block
+      uint32_t serial;
+      uint64_t timestamp; //digitizer timestamp from W<x>EV, 0 if missing
+      uint32_t trigger_id; //from W<x>EV, serial number if missing, see HasTrigger()
+      uint32_t time; //MIDAS event time stamp (s)
+      uint16_t event_id;
+      uint16_t flags;
+      uint32_t blockmax; //maximum block size of the lz4 frame of the block, 0 if uncompressed
+    };
+    static constexpr uint16_t kHasScopeHeader = 0x1;
+    static constexpr uint16_t kHasCalibration = 0x2; //TEKV, TK<k>V or W<x>CV, see FccCalibration
+    //lz4 frame flags of the block, to decompress it without reading from the start of the frame
+    static constexpr uint16_t kLz4Independent = 0x4;
+    static constexpr uint16_t kLz4BlockChecksum = 0x8;
+    static constexpr uint16_t kLz4ContentChecksum = 0x10;
+    //only digitizer events have a trigger_id, BOR/EOR, messages and scope events are never
+    //matched by trigger_id or timestamp
+    static bool HasTrigger(const Entry& entry) { return (entry.flags & kHasScopeHeader) && !(entry.event_id & 0x8000); }
+
+    FccEventIndex() {};
+
+    static std::string IndexPath(const std::string& runfile) { return runfile + ".idx"; }
+
+    //scan the run file and write the index next to it
+    static bool Build(const std::string& runfile, int nthreads = 1);
+
+    bool Load(const std::string& runfile);
+    bool IsCompressed() const { return compressed; }
+    const std::vector<Entry>& GetEntries() const { return entries; }
+
+    const Entry* FindSerial(uint32_t serial) const;
+    const Entry* FindTrigger(uint32_t trigger_id);
+    std::vector<const Entry*> FindTimestampRange(uint64_t tmin, uint64_t tmax);
+
+  private:
+    bool compressed = false;
+    std::vector<Entry> entries; //file order
+    std::vector<uint32_t> byTrigger; //entry indices sorted by trigger_id, built on first use
+    std::vector<uint32_t> byTimestamp;
+
+    static void FillEntry(Entry& entry, FccEvent& event);
+};
+
+//random access to the events of an indexed run file
+class FccIndexedReader {
+  public:
+    FccIndexedReader(const std::string& p);
+    ~FccIndexedReader();
+
+    bool Open();
+    void Close();
+    FccEventIndex& GetIndex() { return index; }
+
+    //a single synchronous seek and read, lz4 blocks are decompressed in the calling thread
+    bool ReadEvent(const FccEventIndex::Entry& entry, FccEvent& event);
+    //a corrupted lz4 block, the file cannot be read further
+    bool IsError() const;
+
+  private:
+    const std::string path;
+    FccEventIndex index;
+    FILE* file = nullptr;
+#ifdef HAVE_LZ4
+    std::unique_ptr<FccLz4Reader> lz4;
+#endif
+};
+
+#endif
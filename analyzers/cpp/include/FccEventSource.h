@@ -0,0 +1,119 @@
+#ifndef FCC_EVENT_SOURCE_H
+#define FCC_EVENT_SOURCE_H
+
+#include "FccEvent.h"
+#include "FccEventIndex.h"
+#ifdef HAVE_LZ4
+#include "FccLz4Reader.h"
+#endif
+#include <atomic>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+class FccCalibration;
+
+//base class for event producers, Read is always called from the same thread
+class FccEventSource {
+  public:
+    FccEventSource() {};
+    virtual ~FccEventSource() noexcept {};
+
+    virtual bool Open() = 0;
+    virtual void Close() {};
+
+    //fill event with the next event, return false at end of data
+    virtual bool Read(FccEvent& event) = 0;
+
+    //calibration banks of events skipped before the last Read(), true if calibration changed.
+    //FccAnalyzer applies them before the calibration banks of the event itself.
+    virtual bool UpdateCalibration(FccCalibration& /*calibration*/) { return false; }
+
+    //can be called from a signal handler
+    static void RequestStop() noexcept { stopRequested = true; }
+    static bool IsStopRequested() noexcept { return stopRequested; }
+
+  protected:
+    static std::atomic<bool> stopRequested;
+};
+
+//uncompressed .mid files written by mlogger
+class FccFileSource : public FccEventSource {
+  public:
+    FccFileSource(const std::string& p): FccEventSource(), path(p) {};
+    virtual ~FccFileSource() noexcept;
+
+    bool Open();
+    void Close();
+    bool Read(FccEvent& event);
+
+  protected:
+    const std::string path;
+    FILE* file = nullptr;
+};
+
+//selected events of an indexed run file, in the given order between BOR and EOR markers
+class FccIndexedSource : public FccEventSource {
+  public:
+    FccIndexedSource(const std::string& p, const std::vector<std::pair<uint32_t, uint32_t>>& r): FccEventSource(), reader(p), triggerRanges(r) {};
+    virtual ~FccIndexedSource() noexcept {};
+
+    bool Open();
+    void Close() { reader.Close(); }
+    bool Read(FccEvent& event);
+    bool UpdateCalibration(FccCalibration& calibration);
+
+  protected:
+    FccIndexedReader reader;
+    const std::vector<std::pair<uint32_t, uint32_t>> triggerRanges; //inclusive trigger_id ranges
+    std::vector<const FccEventIndex::Entry*> selected;
+    size_t next = 0;
+    //the calibration banks come only with the first event and after a settings change, the
+    //calibration events before each selected event are replayed in file order
+    std::vector<const FccEventIndex::Entry*> calibrations;
+    size_t nextCalibration = 0;
+    std::vector<FccEvent> calibrationEvents; //read, not yet applied
+    uint32_t run = 0;
+    bool begin = true;
+    bool end = false;
+};
+
+#ifdef HAVE_LZ4
+//.mid.lz4 files, decompressed in parallel by FccLz4Reader
+class FccLz4Source : public FccEventSource {
+  public:
+    FccLz4Source(const std::string& p, int nthreads): FccEventSource(), reader(p, nthreads) {};
+    virtual ~FccLz4Source() noexcept {};
+
+    bool Open() { return reader.Open(); }
+    void Close() { reader.Close(); }
+    bool Read(FccEvent& event);
+
+  protected:
+    FccLz4Reader reader;
+};
+#endif
+
+#ifdef HAVE_MIDAS
+//events sampled from a MIDAS buffer, run transitions are delivered as BOR/EOR events
+class FccOnlineSource : public FccEventSource {
+  public:
+    FccOnlineSource(const std::string& h, const std::string& e, const std::string& b = "SYSTEM", bool s = true): FccEventSource(), host(h), experiment(e), buffer(b), sampling(s) {};
+    virtual ~FccOnlineSource() noexcept;
+
+    bool Open();
+    void Close();
+    bool Read(FccEvent& event);
+
+  protected:
+    const std::string host;
+    const std::string experiment;
+    const std::string buffer;
+    const bool sampling; //GET_NONBLOCKING if true, GET_ALL otherwise
+    int bufferHandle = -1;
+    int requestId = -1;
+    bool connected = false;
+};
+#endif
+
+#endif
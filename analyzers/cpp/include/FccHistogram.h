@@ -0,0 +1,44 @@
+#ifndef FCC_HISTOGRAM_H
+#define FCC_HISTOGRAM_H
+
+#include <stdint.h>
+#include <ostream>
+#include <vector>
+
+//fixed binning 1D histogram, cheap enough to be filled per sample
+class FccHistogram {
+  public:
+    FccHistogram() {};
+    FccHistogram(int n, double lo, double hi): nbins(n), min(lo), max(hi), scale(n/(hi-lo)), counts(n+2, 0) {};
+
+    void Fill(double x) {
+      sum += x;
+      entries++;
+      if(x < min)
+        counts[0]++;
+      else if(x >= max)
+        counts[nbins+1]++;
+      else
+        counts[1+(int)((x-min)*scale)]++;
+    }
+
+    //histograms with different binning cannot be merged, an empty one takes the binning of the other
+    void Merge(const FccHistogram& other);
+
+    uint64_t GetEntries() const { return entries; }
+    double GetMean() const { return entries ? sum/entries : 0; }
+    double GetQuantile(double q) const;
+
+    void Write(std::ostream& os) const;
+
+  private:
+    int nbins = 0;
+    double min = 0;
+    double max = 0;
+    double scale = 0;
+    double sum = 0;
+    uint64_t entries = 0;
+    std::vector<uint64_t> counts; //[0] underflow, [nbins+1] overflow
+};
+
+#endif
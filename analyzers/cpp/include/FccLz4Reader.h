@@ -0,0 +1,105 @@
+#ifndef FCC_LZ4_READER_H
+#define FCC_LZ4_READER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//reader for lz4 frame files (mlogger "lz4" compression)
+//sequential: a feeder thread walks the block table, blocks of frames with independent blocks are
+//decompressed by a pool of workers while Read() hands out the output in file order.
+//Linked-block frames are decompressed by the feeder alone, still overlapping with the caller.
+//random access: no threads, Seek() reads and decompresses a single block in the calling thread
+//and Read() continues block by block from there.
+class FccLz4Reader {
+  public:
+    //parameters of the frame a block belongs to, kept in the event index for Seek()
+    struct Frame {
+      bool independent = true;
+      bool blockChecksum = false;
+      bool contentChecksum = false;
+      size_t maxSize = 0;
+    };
+
+    FccLz4Reader(const std::string& p, int n = 1);
+    ~FccLz4Reader();
+
+    bool Open(bool sequential = true);
+    void Close();
+
+    //blocking, returns less than n bytes only at end of data or on error, the data stops
+    //before the first block that cannot be read or decompressed
+    size_t Read(void* dst, size_t n);
+    bool IsError() const { return error; }
+
+    //position of the next byte returned by Read() and the frame of its block, used by the event index
+    uint64_t GetBlockFileOffset() const { return current ? current->fileOffset : firstBlockOffset; }
+    uint64_t GetBlockPosition() const { return currentPos; }
+    const Frame& GetBlockFrame() const { return current ? current->frame : frame; }
+
+    //random access only: continue from the block at fileOffset of a frame with independent
+    //blocks, skipping pos bytes. A seek into the current block does not read the file.
+    bool Seek(uint64_t fileOffset, uint64_t pos, const Frame& blockFrame);
+
+    bool IsBlockIndependent() const { return frame.independent; }
+    uint64_t GetCompressedBytes() const { return compressedBytes; }
+    uint64_t GetDecompressedBytes() const { return decompressedBytes; }
+
+    static bool IsLz4File(const std::string& path);
+
+  private:
+    struct Block {
+      enum class State {Free, Loaded, Decompressing, Done, End};
+      State state = State::Free;
+      uint64_t fileOffset = 0; //offset of the block size word
+      bool stored = false; //block stored uncompressed
+      //the feeder may be in the next frame already
+      Frame frame;
+      std::vector<char> compressed;
+      std::vector<char> output;
+      int outsize = 0;
+    };
+
+    const std::string path;
+    const int nthreads;
+    FILE* file = nullptr;
+    bool sequential = true;
+
+    Frame frame; //of the block at the file position
+    uint64_t firstBlockOffset = 0;
+    std::vector<char> dictionary; //last 64 KB of output for linked blocks
+
+    std::vector<Block> slots; //ring buffer of blocks in file order
+    size_t feedIndex = 0; //next slot filled by the feeder
+    size_t readIndex = 0; //next slot consumed by Read()
+    Block* current = nullptr;
+    size_t currentPos = 0;
+    Block randomBlock; //the only block in random access
+
+    std::mutex mutex;
+    std::condition_variable slotChanged;
+    std::thread feeder;
+    std::vector<std::thread> workers;
+    bool stopThreads = false;
+    std::atomic<bool> error{false};
+
+    uint64_t compressedBytes = 0;
+    uint64_t decompressedBytes = 0;
+
+    bool ReadFrameHeader();
+    bool ReadBlock(Block& block); //false at end of data
+    bool Decompress(Block& block); //false on a corrupted block
+    void UpdateDictionary(const Block& block);
+    bool ReadNextBlock(); //random access, decompresses the next block into randomBlock
+    void FeederFunction();
+    void WorkerFunction();
+    void StartThreads();
+    void StopThreads();
+};
+
+#endif
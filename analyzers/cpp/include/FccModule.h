@@ -0,0 +1,49 @@
+#ifndef FCC_MODULE_H
+#define FCC_MODULE_H
+
+#include "FccBanks.h"
+#include <string>
+#include <vector>
+
+//base class for analysis modules
+//ProcessEvent is called concurrently from the worker threads, each one with its own thread index:
+//modules keep one accumulator per thread (see FccPerThread) and merge them in EndRun
+class FccModule {
+  public:
+    FccModule(const std::string& n): name(n) {};
+    virtual ~FccModule() noexcept {};
+
+    const std::string& GetName() const noexcept { return name; }
+
+    //called with all workers idle
+    virtual void BeginRun(int /*run*/, int /*nthreads*/) {};
+    virtual void EndRun(int /*run*/) {};
+
+    virtual void ProcessEvent(const FccDecodedEvent& event, int thread) = 0;
+
+  protected:
+    const std::string name;
+};
+
+//one accumulator per worker thread, padded to avoid false sharing
+//T has to provide Merge(const T&)
+template<typename T>
+class FccPerThread {
+  public:
+    void Reset(int nthreads) { slots.clear(); slots.resize(nthreads); }
+    T& operator[](int thread) { return slots[thread].value; }
+    int Size() const { return slots.size(); }
+
+    T Merge() const {
+      T total;
+      for(const auto& slot: slots)
+        total.Merge(slot.value);
+      return total;
+    }
+
+  private:
+    struct alignas(64) Slot { T value; };
+    std::vector<Slot> slots;
+};
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef FCC_WAVEFORM_STATS_MODULE_H
+#define FCC_WAVEFORM_STATS_MODULE_H
+
+#include "FccModule.h"
+#include "FccHistogram.h"
+#include <map>
+#include <string>
+
+//per channel baseline and amplitude distributions for digitizer and Tektronix waveforms
+class FccWaveformStatsModule : public FccModule {
+  public:
+    FccWaveformStatsModule(const std::string& outdir = ""): FccModule("WaveformStats"), outputDir(outdir) {};
+    virtual ~FccWaveformStatsModule() noexcept {};
+
+    void BeginRun(int run, int nthreads);
+    void EndRun(int run);
+    void ProcessEvent(const FccDecodedEvent& event, int thread);
+
+  private:
+    struct ChannelStats {
+      FccHistogram baseline{4096, 0, 65536};
+      FccHistogram amplitude{4096, 0, 65536}; //baseline - minimum, pulses are negative
+      float gain = 0; //V per code of the last calibration, 0 without
+      void Merge(const ChannelStats& other) {
+        baseline.Merge(other.baseline);
+        amplitude.Merge(other.amplitude);
+        gain = other.gain ? other.gain : gain;
+      }
+    };
+
+    struct Accumulator {
+      std::map<int, ChannelStats> channels; //key from ChannelKey
+      std::map<int, uint64_t> triggers;
+      void Merge(const Accumulator& other);
+    };
+
+    static int ChannelKey(bool tek, int board, int channel) { return (tek?1<<16:0) | (board<<8) | channel; }
+    void Fill(Accumulator& acc, int key, const FccWaveform& wf, float gain);
+
+    const std::string outputDir;
+    FccPerThread<Accumulator> accumulators;
+};
+
+#endif
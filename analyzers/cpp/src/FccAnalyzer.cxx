@@ -0,0 +1,190 @@
+#include "FccAnalyzer.h"
+#include <chrono>
+#include <iostream>
+#include <time.h>
+
+static double ThreadCpuTime() {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+FccAnalyzer::FccAnalyzer(int n, int b): nthreads(n>0?n:1), batchsize(b>0?b:1), stats(nthreads) {
+  for(int i=0; i<nthreads; i++)
+    workers.emplace_back(&FccAnalyzer::WorkerFunction, this, i);
+}
+
+FccAnalyzer::~FccAnalyzer() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopWorkers = true;
+  }
+  queueNotEmpty.notify_all();
+  for(auto& worker: workers)
+    worker.join();
+}
+
+void FccAnalyzer::AddModule(std::unique_ptr<FccModule> module) {
+  modules.push_back(std::move(module));
+}
+
+void FccAnalyzer::WorkerFunction(int thread) {
+  FccDecodedEvent decoded;
+  Batch batch;
+  WorkerStats& mystats = stats[thread];
+
+  while(true){
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      //give back the events of the previous batch
+      if(!batch.empty()){
+        for(auto& ev: batch)
+          freeEvents.push_back(std::move(ev));
+        batch.clear();
+        busyWorkers--;
+        queueNotFull.notify_all();
+      }
+
+      queueNotEmpty.wait(lock, [this]{ return stopWorkers || !queue.empty(); });
+      if(queue.empty())
+        return;
+
+      batch = std::move(queue.front());
+      queue.pop_front();
+      busyWorkers++;
+    }
+
+    double tstart = ThreadCpuTime();
+    for(auto& ev: batch){
+      if(!decoded.Decode(*ev)){
+        mystats.badEvents++;
+        continue;
+      }
+      for(auto& module: modules)
+        module->ProcessEvent(decoded, thread);
+      mystats.events++;
+      mystats.bytes += ev->buffer.size();
+    }
+    mystats.cputime += ThreadCpuTime() - tstart;
+  }
+}
+
+std::unique_ptr<FccEvent> FccAnalyzer::GetFreeEvent() {
+  std::lock_guard<std::mutex> lock(mutex);
+  if(freeEvents.empty())
+    return std::make_unique<FccEvent>();
+
+  auto ev = std::move(freeEvents.back());
+  freeEvents.pop_back();
+  return ev;
+}
+
+void FccAnalyzer::Submit(Batch& batch) {
+  if(batch.empty())
+    return;
+
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    //bound the number of queued events, the source is usually faster than the workers
+    queueNotFull.wait(lock, [this]{ return queue.size() < 2*(size_t)nthreads; });
+    queue.push_back(std::move(batch));
+  }
+  batch.clear();
+  queueNotEmpty.notify_one();
+}
+
+void FccAnalyzer::Drain() {
+  std::unique_lock<std::mutex> lock(mutex);
+  queueNotFull.wait(lock, [this]{ return queue.empty() && busyWorkers == 0; });
+}
+
+void FccAnalyzer::BeginRun(int run) {
+  std::cout << "Begin of run " << run << std::endl;
+  currentRun = run;
+  for(auto& module: modules)
+    module->BeginRun(run, nthreads);
+}
+
+void FccAnalyzer::EndRun(int run) {
+  std::cout << "End of run " << run << std::endl;
+  for(auto& module: modules)
+    module->EndRun(run);
+  currentRun = -1;
+}
+
+uint64_t FccAnalyzer::Run(FccEventSource& source) {
+  if(!source.Open())
+    return 0;
+
+  auto tstart = std::chrono::steady_clock::now();
+  Batch batch;
+  batch.reserve(batchsize);
+
+  while(true){
+    auto ev = GetFreeEvent();
+    if(!source.Read(*ev))
+      break;
+
+    if(ev->IsInternal()){
+      if(ev->GetEventId() == FccEvent::kBeginOfRun){
+        Submit(batch);
+        Drain();
+        if(currentRun >= 0)
+          EndRun(currentRun);
+        BeginRun(ev->GetSerialNumber());
+      } else if(ev->GetEventId() == FccEvent::kEndOfRun){
+        Submit(batch);
+        Drain();
+        if(currentRun >= 0)
+          EndRun(currentRun);
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      freeEvents.push_back(std::move(ev));
+      continue;
+    }
+
+    //data without a begin of run marker (e.g. online start in the middle of a run)
+    if(currentRun < 0)
+      BeginRun(0);
+
+    //an indexed source replays the calibration of the events it skipped
+    bool updated = source.UpdateCalibration(calibration);
+    if(calibration.Update(*ev) || updated)
+      calibrationSnapshot = std::make_shared<const FccCalibration>(calibration);
+    ev->calibration = calibrationSnapshot;
+
+    batch.push_back(std::move(ev));
+    if(batch.size() >= batchsize)
+      Submit(batch);
+  }
+
+  Submit(batch);
+  Drain();
+  if(currentRun >= 0)
+    EndRun(currentRun);
+
+  source.Close();
+  walltime += std::chrono::duration<double>(std::chrono::steady_clock::now() - tstart).count();
+
+  uint64_t total = 0;
+  for(const auto& s: stats)
+    total += s.events;
+  return total;
+}
+
+void FccAnalyzer::PrintStatistics() const {
+  uint64_t events = 0, bytes = 0, bad = 0;
+  double cputime = 0;
+  for(const auto& s: stats){
+    events += s.events;
+    bytes += s.bytes;
+    bad += s.badEvents;
+    cputime += s.cputime;
+  }
+
+  std::cout << "Analyzed " << events << " events (" << bad << " malformed, " << bytes/1e6 << " MB) in " << walltime << " s with " << nthreads << " threads" << std::endl;
+  if(cputime > 0)
+    std::cout << "Events/s/core: " << events/cputime << std::endl;
+  if(walltime > 0)
+    std::cout << "Events/s: " << events/walltime << " (" << bytes/1e6/walltime << " MB/s)" << std::endl;
+}
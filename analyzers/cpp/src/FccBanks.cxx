@@ -0,0 +1,254 @@
+#include "FccBanks.h"
+#include <string.h>
+
+static inline bool IsDigit(char c) { return c >= '0' && c <= '9'; }
+
+void FccDecodedEvent::Clear() {
+  event = nullptr;
+  calibration = nullptr;
+  scope.clear();
+  scanPoints.clear();
+  waveforms.clear();
+  packed.clear();
+  tek.clear();
+  tekFrameTimes.clear();
+  tekSampleBits = 16;
+  tekChunks.clear();
+  tekWide.clear();
+  raw.clear();
+}
+
+bool FccDecodedEvent::Decode(FccEvent& ev) {
+  Clear();
+  event = &ev;
+  calibration = ev.calibration.get();
+  if(!ev.ParseBanks())
+    return false;
+
+  for(const auto& bank: ev.GetBanks()){
+    switch(bank.name[0]){
+    case 'W':
+      if(bank.name[2] == 'E' && bank.name[3] == 'V'){
+        if(!DecodeScopeHeader(bank, scope.emplace_back()))
+          scope.pop_back();
+      } else if(bank.name[2] == 'S' && bank.name[3] == 'P'){
+        if(!DecodeScanPoint(bank, scanPoints.emplace_back()))
+          scanPoints.pop_back();
+      } else if(bank.name[2] == 'P' && bank.name[3] == 'K'){
+        auto& pk = packed.emplace_back();
+        if(!DecodePacked(bank, pk)){
+          packed.pop_back();
+          break;
+        }
+        //per channel views so modules do not depend on the bank layout
+        for(int i=0, n=0; n<pk.nchannels; i++){
+          if(!(pk.mask & (1ull << i)))
+            continue;
+          waveforms.push_back({pk.board, i, pk.Samples(n), pk.size[n]});
+          n++;
+        }
+      } else {
+        if(!DecodeWaveform(bank, waveforms.emplace_back()))
+          waveforms.pop_back();
+      }
+      break;
+    case 'T': {
+      int s = TekScope(bank);
+      if(s < 0)
+        break;
+      if(bank.name[3] == 'T'){
+        if(tekFrameTimes.size() <= (size_t)s)
+          tekFrameTimes.resize(s + 1);
+        DecodeTekFrames(bank, tekFrameTimes[s]);
+      } else if(bank.name[3] == 'W')
+        DecodeTekWidth(bank, tekSampleBits);
+      else if(bank.name[3] == 'C'){
+        if(!DecodeTekChunk(bank, tekChunks.emplace_back()))
+          tekChunks.pop_back();
+      }
+      else if(bank.type == kTidUint8){
+        //moving the inner vectors keeps the views of earlier banks valid
+        if(!DecodeTek(bank, tek.emplace_back(), &tekWide.emplace_back()))
+          tek.pop_back();
+      } else if(!DecodeTek(bank, tek.emplace_back()))
+        tek.pop_back();
+      break;
+    }
+    case 'R':
+      if(!DecodeRaw(bank, raw.emplace_back()))
+        raw.pop_back();
+      break;
+    default:
+      break;
+    }
+  }
+
+  //FastFrame: TEK<n> and TK<k><n> hold all frames back to back, split into one waveform per frame
+  if(!tekFrameTimes.empty()){
+    std::vector<FccWaveform> blocks;
+    blocks.swap(tek);
+    for(const auto& wf: blocks){
+      size_t frames = (size_t)wf.board < tekFrameTimes.size() ? tekFrameTimes[wf.board].size() : 0;
+      if(frames <= 1){
+        tek.push_back(wf);
+        continue;
+      }
+      uint32_t n = wf.nsamples / frames;
+      for(size_t f=0; f<frames; f++)
+        tek.push_back({wf.board, wf.channel, wf.samples + f*n, n, (int)f});
+    }
+  }
+
+  //windows of long records, the samples start at chunk.first of the record
+  for(const auto& chunk: tekChunks){
+    for(auto& wf: tek){
+      if(wf.board == chunk.scope)
+        wf.first = chunk.first;
+    }
+  }
+
+  return true;
+}
+
+bool FccDecodedEvent::DecodeScanPoint(const FccBank& bank, FccScanPoint& point) {
+  if(!IsDigit(bank.name[1]) || bank.type != kTidUint32 || bank.Count<uint32_t>() < 2)
+    return false;
+
+  const uint32_t* p = bank.As<uint32_t>();
+  point.frontend = bank.name[1]-'0';
+  point.index = p[0];
+  point.count = p[1];
+  return point.index < point.count;
+}
+
+bool FccDecodedEvent::DecodeScopeHeader(const FccBank& bank, FccScopeHeader& header) {
+  if(bank.type != kTidUint64 || bank.Count<uint64_t>() < 4)
+    return false;
+
+  const uint64_t* pev = bank.As<uint64_t>();
+  if((pev[0] & 0xF000000000000000) != 0xA000000000000000)
+    return false;
+
+  header.frontend = pev[0] & 0xFFFF;
+  header.timestamp = pev[1];
+  header.trigger_id = pev[2];
+  header.flags = pev[3];
+  return true;
+}
+
+bool FccDecodedEvent::DecodeWaveform(const FccBank& bank, FccWaveform& wf) {
+  if(bank.type != kTidUint16 || !IsDigit(bank.name[1]) || !IsDigit(bank.name[2]) || !IsDigit(bank.name[3]))
+    return false;
+
+  wf.board = bank.name[1]-'0';
+  wf.channel = (bank.name[2]-'0')*10 + (bank.name[3]-'0');
+  wf.samples = bank.As<uint16_t>();
+  wf.nsamples = bank.Count<uint16_t>();
+  return true;
+}
+
+bool FccDecodedEvent::DecodePacked(const FccBank& bank, FccPackedWaveforms& pk) {
+  if(bank.type != kTidUint16 || !IsDigit(bank.name[1]) || bank.size < 16)
+    return false;
+
+  uint16_t version;
+  memcpy(&version, bank.data, 2);
+  memcpy(&pk.nchannels, bank.data+2, 2);
+  memcpy(&pk.stride, bank.data+4, 4);
+  memcpy(&pk.mask, bank.data+8, 8);
+  uint32_t header = (16 + 8*pk.nchannels + 63) & ~63u;
+  if(version != 1 || pk.nchannels > 64 || __builtin_popcountll(pk.mask) != pk.nchannels || bank.size < header)
+    return false;
+
+  pk.board = bank.name[1]-'0';
+  pk.offset = reinterpret_cast<const uint32_t*>(bank.data+16);
+  pk.size = pk.offset + pk.nchannels;
+  pk.payload = reinterpret_cast<const uint16_t*>(bank.data+header);
+
+  //reject channels pointing outside the bank
+  uint32_t nsamples = (bank.size - header)/sizeof(uint16_t);
+  for(int n=0; n<pk.nchannels; n++){
+    if(pk.offset[n] > nsamples || pk.size[n] > nsamples - pk.offset[n])
+      return false;
+  }
+  return true;
+}
+
+int FccDecodedEvent::TekScope(const FccBank& bank) {
+  if(bank.name[0] != 'T')
+    return -1;
+  if(bank.name[1] == 'E' && bank.name[2] == 'K')
+    return 0;
+  if(bank.name[1] == 'K' && IsDigit(bank.name[2]))
+    return bank.name[2]-'0';
+  return -1;
+}
+
+bool FccDecodedEvent::DecodeTek(const FccBank& bank, FccWaveform& wf, std::vector<uint16_t>* wide) {
+  int scope = TekScope(bank);
+  if(scope < 0 || !IsDigit(bank.name[3]))
+    return false;
+
+  wf.board = scope;
+  wf.channel = bank.name[3]-'0';
+  if(bank.type == kTidUint16){
+    wf.samples = bank.As<uint16_t>();
+    wf.nsamples = bank.Count<uint16_t>();
+  } else if(bank.type == kTidUint8 && wide){
+    //same scale as the frontend's WidenSamples, the loop vectorizes
+    const uint8_t* in = bank.data;
+    wide->resize(bank.size);
+    uint16_t* out = wide->data();
+    for(uint32_t i=0; i<bank.size; i++)
+      out[i] = (uint16_t)in[i] << 8;
+    wf.samples = wide->data();
+    wf.nsamples = bank.size;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool FccDecodedEvent::DecodeTekWidth(const FccBank& bank, int& bits) {
+  if(TekScope(bank) < 0 || bank.type != kTidUint32 || bank.Count<uint32_t>() < 1)
+    return false;
+  bits = bank.As<uint32_t>()[0];
+  return true;
+}
+
+bool FccDecodedEvent::DecodeTekFrames(const FccBank& bank, std::vector<uint64_t>& times) {
+  if(TekScope(bank) < 0 || bank.type != kTidUint64 || bank.Count<uint64_t>() < 1)
+    return false;
+
+  const uint64_t* p = bank.As<uint64_t>();
+  uint64_t frames = p[0];
+  if(frames > bank.Count<uint64_t>() - 1)
+    return false;
+  times.assign(p + 1, p + 1 + frames);
+  return true;
+}
+
+bool FccDecodedEvent::DecodeTekChunk(const FccBank& bank, FccTekChunk& chunk) {
+  chunk.scope = TekScope(bank);
+  if(chunk.scope < 0 || bank.type != kTidUint32 || bank.Count<uint32_t>() < 6)
+    return false;
+
+  const uint32_t* p = bank.As<uint32_t>();
+  chunk.acquisition = p[0];
+  chunk.index = p[1];
+  chunk.count = p[2];
+  chunk.first = p[3];
+  chunk.points = p[4];
+  chunk.recordLength = p[5];
+  return chunk.index < chunk.count && chunk.first + chunk.points <= chunk.recordLength;
+}
+
+bool FccDecodedEvent::DecodeRaw(const FccBank& bank, FccRawBlock& raw) {
+  if(bank.name[1] != 'A' || bank.name[2] != 'W' || !IsDigit(bank.name[3]))
+    return false;
+
+  raw.frontend = bank.name[3]-'0';
+  raw.data = bank.data;
+  raw.size = bank.size;
+  return true;
+}
@@ -0,0 +1,78 @@
+#include "FccCalibration.h"
+
+static inline bool IsDigit(char c) { return c >= '0' && c <= '9'; }
+
+bool FccCalibration::Update(const FccEvent& ev) {
+  //runs on the reader thread for every event, only the bank headers are read here and the
+  //bank list is built once by the worker that decodes the event
+  bool updated = false;
+  ev.ForEachBank([this, &updated](const FccBank& bank) {
+    if(!IsCalibrationBank(bank))
+      return;
+    int scope = FccDecodedEvent::TekScope(bank);
+    bool tek = scope >= 0;
+    int board = tek ? scope : bank.name[1]-'0';
+    updated |= DecodeBank(bank, boards[Key(tek, board)]);
+  });
+  return updated;
+}
+
+bool FccCalibration::IsCalibrationBank(const FccBank& bank) {
+  if(FccDecodedEvent::TekScope(bank) >= 0)
+    return bank.name[3] == 'V';
+  return bank.name[0] == 'W' && IsDigit(bank.name[1]) && bank.name[2] == 'C' && bank.name[3] == 'V';
+}
+
+bool FccCalibration::DecodeBank(const FccBank& bank, FccBoardCalibration& calibration) {
+  if(bank.type != kTidDouble || bank.Count<double>() < 3)
+    return false;
+
+  const double* p = bank.As<double>();
+  uint32_t n = p[0];
+  if(n > 64 || bank.Count<double>() < 3 + 2*n)
+    return false;
+  calibration.dt = p[1];
+  calibration.t0 = p[2];
+  calibration.gain.assign(p + 3, p + 3 + n);
+  calibration.offset.assign(p + 3 + n, p + 3 + 2*n);
+  return true;
+}
+
+const FccBoardCalibration* FccCalibration::Find(bool tek, int board) const {
+  auto it = boards.find(Key(tek, board));
+  return it == boards.end() ? nullptr : &it->second;
+}
+
+float FccCalibration::Gain(bool tek, int board, int channel) const {
+  const FccBoardCalibration* calibration = Find(tek, board);
+  if(!calibration || channel < 0 || (size_t)channel >= calibration->gain.size())
+    return 0;
+  return calibration->gain[channel];
+}
+
+bool FccCalibration::ToVolts(bool tek, const FccWaveform& wf, float* volts) const {
+  const FccBoardCalibration* calibration = Find(tek, wf.board);
+  if(!calibration || wf.channel < 0 || (size_t)wf.channel >= calibration->gain.size() || calibration->gain[wf.channel] == 0)
+    return false;
+  ToVolts(wf.samples, wf.nsamples, calibration->gain[wf.channel], calibration->offset[wf.channel], volts);
+  return true;
+}
+
+bool FccCalibration::ToTime(bool tek, const FccWaveform& wf, double* times) const {
+  const FccBoardCalibration* calibration = Find(tek, wf.board);
+  if(!calibration || calibration->dt <= 0)
+    return false;
+  ToTime(wf.first, wf.nsamples, calibration->dt, calibration->t0, times);
+  return true;
+}
+
+void FccCalibration::ToVolts(const uint16_t* __restrict samples, uint32_t n, float gain, float offset, float* __restrict volts) {
+  for(uint32_t i=0; i<n; i++)
+    volts[i] = samples[i]*gain + offset;
+}
+
+void FccCalibration::ToTime(uint32_t first, uint32_t n, double dt, double t0, double* __restrict times) {
+  double start = t0 + first*dt;
+  for(uint32_t i=0; i<n; i++)
+    times[i] = start + i*dt;
+}
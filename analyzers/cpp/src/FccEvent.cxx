@@ -0,0 +1,23 @@
+#include "FccEvent.h"
+#include <cstring>
+
+bool FccEvent::ParseBanks() {
+  banks.clear();
+  return ForEachBank([this](const FccBank& bank) { banks.push_back(bank); });
+}
+
+const FccBank* FccEvent::FindBank(const char* name) const {
+  for(const auto& bank: banks){
+    if(strncmp(bank.name, name, 4) == 0)
+      return &bank;
+  }
+  return nullptr;
+}
+
+void FccEvent::MakeTransition(uint16_t id, uint32_t run) {
+  buffer.assign(sizeof(FccEventHeader), 0);
+  FccEventHeader* header = reinterpret_cast<FccEventHeader*>(buffer.data());
+  header->event_id = (int16_t)id;
+  header->serial_number = run;
+  banks.clear();
+}
@@ -0,0 +1,271 @@
+#include "FccEventIndex.h"
+#include "FccBanks.h"
+#include "FccCalibration.h"
+#ifdef HAVE_LZ4
+#include "FccLz4Reader.h"
+#endif
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+//version 2 flags the calibration events, version 3 stores the lz4 frame of each block
+static const char kIndexMagic[8] = {'F', 'C', 'C', 'I', 'D', 'X', '3', 0};
+
+struct IndexFileHeader {
+  char magic[8];
+  uint32_t compressed;
+  uint32_t entrysize;
+  uint64_t nentries;
+};
+
+void FccEventIndex::FillEntry(Entry& entry, FccEvent& event) {
+  entry.serial = event.GetSerialNumber();
+  entry.time = event.GetHeader().time_stamp;
+  entry.event_id = event.GetEventId();
+  entry.flags = 0;
+  entry.blockmax = 0;
+  entry.timestamp = 0;
+  entry.trigger_id = entry.serial;
+
+  //only the header bank is decoded, this is what makes the index build fast
+  if(event.ParseBanks()){
+    for(const auto& bank: event.GetBanks()){
+      FccScopeHeader header;
+      if(FccCalibration::IsCalibrationBank(bank))
+        entry.flags |= kHasCalibration;
+      else if(!(entry.flags & kHasScopeHeader) && bank.name[0] == 'W' && bank.name[2] == 'E' && bank.name[3] == 'V' && FccDecodedEvent::DecodeScopeHeader(bank, header)){
+        entry.timestamp = header.timestamp;
+        entry.trigger_id = header.trigger_id;
+        entry.flags |= kHasScopeHeader;
+      }
+    }
+  }
+}
+
+bool FccEventIndex::Build(const std::string& runfile, int nthreads) {
+  auto tstart = std::chrono::steady_clock::now();
+  std::vector<Entry> entries;
+  FccEvent event;
+  FccEventHeader header;
+  bool compressed = false;
+
+#ifdef HAVE_LZ4
+  if(FccLz4Reader::IsLz4File(runfile)){
+    compressed = true;
+    FccLz4Reader reader(runfile, nthreads);
+    if(!reader.Open())
+      return false;
+    if(!reader.IsBlockIndependent())
+      std::cout << "Warning: linked lz4 blocks, random access will need to decompress from the beginning of the file" << std::endl;
+
+    while(true){
+      Entry entry;
+      entry.offset = reader.GetBlockFileOffset();
+      entry.blockpos = reader.GetBlockPosition();
+      FccLz4Reader::Frame frame = reader.GetBlockFrame();
+      if(reader.Read(&header, sizeof(header)) != sizeof(header))
+        break;
+      event.buffer.resize(sizeof(header) + header.data_size);
+      memcpy(event.buffer.data(), &header, sizeof(header));
+      if(reader.Read(event.buffer.data()+sizeof(header), header.data_size) != header.data_size)
+        break;
+      FillEntry(entry, event);
+      entry.blockmax = frame.maxSize;
+      entry.flags |= (frame.independent ? kLz4Independent : 0) | (frame.blockChecksum ? kLz4BlockChecksum : 0) |
+                     (frame.contentChecksum ? kLz4ContentChecksum : 0);
+      entries.push_back(entry);
+    }
+    //an index that ends at a corrupted block would look complete
+    if(reader.IsError()){
+      std::cout << "lz4 read error after " << entries.size() << " events, no index written" << std::endl;
+      return false;
+    }
+  } else
+#endif
+  {
+    FILE* file = fopen(runfile.c_str(), "rb");
+    if(!file){
+      std::cout << "Cannot open " << runfile << std::endl;
+      return false;
+    }
+    setvbuf(file, nullptr, _IOFBF, 4*1024*1024);
+
+    while(true){
+      Entry entry;
+      entry.offset = ftello(file);
+      entry.blockpos = 0;
+      if(fread(&header, sizeof(header), 1, file) != 1)
+        break;
+      event.buffer.resize(sizeof(header) + header.data_size);
+      memcpy(event.buffer.data(), &header, sizeof(header));
+      if(header.data_size && fread(event.buffer.data()+sizeof(header), header.data_size, 1, file) != 1)
+        break;
+      FillEntry(entry, event);
+      entries.push_back(entry);
+    }
+    fclose(file);
+  }
+
+  std::string indexfile = IndexPath(runfile);
+  FILE* out = fopen(indexfile.c_str(), "wb");
+  if(!out){
+    std::cout << "Cannot write " << indexfile << std::endl;
+    return false;
+  }
+
+  IndexFileHeader fileheader;
+  memcpy(fileheader.magic, kIndexMagic, sizeof(kIndexMagic));
+  fileheader.compressed = compressed;
+  fileheader.entrysize = sizeof(Entry);
+  fileheader.nentries = entries.size();
+  bool ok = fwrite(&fileheader, sizeof(fileheader), 1, out) == 1;
+  ok = ok && (entries.empty() || fwrite(entries.data(), sizeof(Entry), entries.size(), out) == entries.size());
+  fclose(out);
+
+  double dt = std::chrono::duration<double>(std::chrono::steady_clock::now() - tstart).count();
+  std::cout << "Indexed " << entries.size() << " events in " << dt << " s, written to " << indexfile << std::endl;
+  return ok;
+}
+
+bool FccEventIndex::Load(const std::string& runfile) {
+  std::string indexfile = IndexPath(runfile);
+  FILE* in = fopen(indexfile.c_str(), "rb");
+  if(!in)
+    return false;
+
+  IndexFileHeader fileheader;
+  bool ok = fread(&fileheader, sizeof(fileheader), 1, in) == 1 &&
+            memcmp(fileheader.magic, kIndexMagic, sizeof(kIndexMagic)) == 0 &&
+            fileheader.entrysize == sizeof(Entry);
+  if(ok){
+    compressed = fileheader.compressed;
+    entries.resize(fileheader.nentries);
+    ok = entries.empty() || fread(entries.data(), sizeof(Entry), entries.size(), in) == entries.size();
+  }
+  fclose(in);
+
+  if(!ok){
+    std::cout << "Invalid index " << indexfile << std::endl;
+    entries.clear();
+  }
+  byTrigger.clear();
+  byTimestamp.clear();
+  return ok;
+}
+
+const FccEventIndex::Entry* FccEventIndex::FindSerial(uint32_t serial) const {
+  //serial numbers are increasing in file order, but internal events can be interleaved
+  auto it = std::lower_bound(entries.begin(), entries.end(), serial, [](const Entry& e, uint32_t s){ return e.serial < s; });
+  if(it != entries.end() && it->serial == serial)
+    return &*it;
+
+  for(const auto& entry: entries)
+    if(entry.serial == serial)
+      return &entry;
+  return nullptr;
+}
+
+const FccEventIndex::Entry* FccEventIndex::FindTrigger(uint32_t trigger_id) {
+  if(byTrigger.empty()){
+    for(uint32_t i=0; i<entries.size(); i++)
+      if(HasTrigger(entries[i]))
+        byTrigger.push_back(i);
+    std::stable_sort(byTrigger.begin(), byTrigger.end(), [this](uint32_t a, uint32_t b){ return entries[a].trigger_id < entries[b].trigger_id; });
+  }
+
+  auto it = std::lower_bound(byTrigger.begin(), byTrigger.end(), trigger_id, [this](uint32_t i, uint32_t id){ return entries[i].trigger_id < id; });
+  if(it != byTrigger.end() && entries[*it].trigger_id == trigger_id)
+    return &entries[*it];
+  return nullptr;
+}
+
+std::vector<const FccEventIndex::Entry*> FccEventIndex::FindTimestampRange(uint64_t tmin, uint64_t tmax) {
+  if(byTimestamp.empty()){
+    for(uint32_t i=0; i<entries.size(); i++)
+      if(HasTrigger(entries[i]))
+        byTimestamp.push_back(i);
+    std::stable_sort(byTimestamp.begin(), byTimestamp.end(), [this](uint32_t a, uint32_t b){ return entries[a].timestamp < entries[b].timestamp; });
+  }
+
+  std::vector<const Entry*> result;
+  auto it = std::lower_bound(byTimestamp.begin(), byTimestamp.end(), tmin, [this](uint32_t i, uint64_t t){ return entries[i].timestamp < t; });
+  for(; it != byTimestamp.end() && entries[*it].timestamp <= tmax; it++)
+    result.push_back(&entries[*it]);
+  return result;
+}
+
+FccIndexedReader::FccIndexedReader(const std::string& p): path(p) {
+}
+
+FccIndexedReader::~FccIndexedReader() {
+  Close();
+}
+
+bool FccIndexedReader::Open() {
+  if(!index.Load(path)){
+    std::cout << "No valid index for " << path << ", build it with fcc_index" << std::endl;
+    return false;
+  }
+
+  if(index.IsCompressed()){
+#ifdef HAVE_LZ4
+    //no threads, each event is read from its block on demand
+    lz4 = std::make_unique<FccLz4Reader>(path, 1);
+    return lz4->Open(false);
+#else
+    std::cout << "Compiled without lz4 support" << std::endl;
+    return false;
+#endif
+  }
+
+  file = fopen(path.c_str(), "rb");
+  return file != nullptr;
+}
+
+void FccIndexedReader::Close() {
+#ifdef HAVE_LZ4
+  lz4.reset();
+#endif
+  if(file){
+    fclose(file);
+    file = nullptr;
+  }
+}
+
+bool FccIndexedReader::IsError() const {
+#ifdef HAVE_LZ4
+  return lz4 && lz4->IsError();
+#else
+  return false;
+#endif
+}
+
+bool FccIndexedReader::ReadEvent(const FccEventIndex::Entry& entry, FccEvent& event) {
+  FccEventHeader header;
+
+#ifdef HAVE_LZ4
+  if(lz4){
+    FccLz4Reader::Frame frame;
+    frame.independent = entry.flags & FccEventIndex::kLz4Independent;
+    frame.blockChecksum = entry.flags & FccEventIndex::kLz4BlockChecksum;
+    frame.contentChecksum = entry.flags & FccEventIndex::kLz4ContentChecksum;
+    frame.maxSize = entry.blockmax;
+    if(!lz4->Seek(entry.offset, entry.blockpos, frame))
+      return false;
+    if(lz4->Read(&header, sizeof(header)) != sizeof(header))
+      return false;
+    event.buffer.resize(sizeof(header) + header.data_size);
+    memcpy(event.buffer.data(), &header, sizeof(header));
+    return lz4->Read(event.buffer.data()+sizeof(header), header.data_size) == header.data_size;
+  }
+#endif
+
+  if(!file || fseeko(file, entry.offset, SEEK_SET))
+    return false;
+  if(fread(&header, sizeof(header), 1, file) != 1)
+    return false;
+  event.buffer.resize(sizeof(header) + header.data_size);
+  memcpy(event.buffer.data(), &header, sizeof(header));
+  return !header.data_size || fread(event.buffer.data()+sizeof(header), header.data_size, 1, file) == 1;
+}
@@ -0,0 +1,118 @@
+#include "FccEventSource.h"
+#include "FccCalibration.h"
+#include <chrono>
+#include <iostream>
+#include <cstring>
+
+std::atomic<bool> FccEventSource::stopRequested{false};
+
+FccFileSource::~FccFileSource() noexcept {
+  Close();
+}
+
+bool FccFileSource::Open() {
+  file = fopen(path.c_str(), "rb");
+  if(!file){
+    std::cout << "Cannot open " << path << std::endl;
+    return false;
+  }
+
+  //large stdio buffer, events are read with two fread each
+  setvbuf(file, nullptr, _IOFBF, 4*1024*1024);
+  return true;
+}
+
+void FccFileSource::Close() {
+  if(file){
+    fclose(file);
+    file = nullptr;
+  }
+}
+
+bool FccFileSource::Read(FccEvent& event) {
+  if(!file || stopRequested)
+    return false;
+
+  FccEventHeader header;
+  if(fread(&header, sizeof(header), 1, file) != 1)
+    return false;
+
+  event.buffer.resize(sizeof(header) + header.data_size);
+  memcpy(event.buffer.data(), &header, sizeof(header));
+  if(header.data_size && fread(event.buffer.data()+sizeof(header), header.data_size, 1, file) != 1){
+    std::cout << "Truncated event " << header.serial_number << " in " << path << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+bool FccIndexedSource::Open() {
+  auto tstart = std::chrono::steady_clock::now();
+  if(!reader.Open())
+    return false;
+
+  FccEventIndex& index = reader.GetIndex();
+  for(const auto& entry: index.GetEntries()){
+    if(entry.event_id == FccEvent::kBeginOfRun)
+      run = entry.serial;
+    if(entry.flags & FccEventIndex::kHasCalibration)
+      calibrations.push_back(&entry);
+    if(!FccEventIndex::HasTrigger(entry))
+      continue;
+    for(const auto& range: triggerRanges){
+      if(entry.trigger_id >= range.first && entry.trigger_id <= range.second){
+        selected.push_back(&entry);
+        break;
+      }
+    }
+  }
+
+  double dt = std::chrono::duration<double>(std::chrono::steady_clock::now() - tstart).count();
+  std::cout << "Selected " << selected.size() << " of " << index.GetEntries().size() << " events in " << dt*1e3 << " ms" << std::endl;
+  return true;
+}
+
+bool FccIndexedSource::Read(FccEvent& event) {
+  if(stopRequested || end)
+    return false;
+
+  if(begin){
+    begin = false;
+    event.MakeTransition(FccEvent::kBeginOfRun, run);
+    return true;
+  }
+
+  while(next < selected.size()){
+    const FccEventIndex::Entry* entry = selected[next++];
+    //entries are in file order, the selected event applies its own calibration banks
+    for(; nextCalibration < calibrations.size() && calibrations[nextCalibration] <= entry; nextCalibration++){
+      if(calibrations[nextCalibration] == entry)
+        continue;
+      calibrationEvents.emplace_back();
+      if(!reader.ReadEvent(*calibrations[nextCalibration], calibrationEvents.back())){
+        std::cout << "Cannot read calibration event " << calibrations[nextCalibration]->serial << std::endl;
+        calibrationEvents.pop_back();
+      }
+    }
+    if(reader.ReadEvent(*entry, event))
+      return true;
+    std::cout << "Cannot read event " << selected[next-1]->serial << std::endl;
+    if(reader.IsError()){
+      std::cout << "lz4 read error, stopping" << std::endl;
+      return false;
+    }
+  }
+
+  end = true;
+  event.MakeTransition(FccEvent::kEndOfRun, run);
+  return true;
+}
+
+bool FccIndexedSource::UpdateCalibration(FccCalibration& calibration) {
+  bool updated = false;
+  for(auto& ev: calibrationEvents)
+    updated |= calibration.Update(ev);
+  calibrationEvents.clear();
+  return updated;
+}
@@ -0,0 +1,43 @@
+#include "FccHistogram.h"
+#include <stdexcept>
+
+void FccHistogram::Merge(const FccHistogram& other) {
+  if(other.counts.empty())
+    return;
+
+  if(counts.empty()){
+    *this = other;
+    return;
+  }
+
+  if(other.nbins != nbins || other.min != min || other.max != max)
+    throw std::runtime_error("cannot merge histograms with different binning");
+
+  for(size_t i=0; i<counts.size(); i++)
+    counts[i] += other.counts[i];
+  sum += other.sum;
+  entries += other.entries;
+}
+
+double FccHistogram::GetQuantile(double q) const {
+  if(!entries)
+    return 0;
+
+  uint64_t target = q*entries;
+  uint64_t total = 0;
+  for(int i=0; i<nbins+2; i++){
+    total += counts[i];
+    if(total > target){
+      if(i == 0) return min;
+      if(i == nbins+1) return max;
+      return min + (i-0.5)/scale;
+    }
+  }
+  return max;
+}
+
+void FccHistogram::Write(std::ostream& os) const {
+  os << "# entries=" << entries << " mean=" << GetMean() << " underflow=" << (counts.empty()?0:counts[0]) << " overflow=" << (counts.empty()?0:counts[nbins+1]) << std::endl;
+  for(int i=1; i<=nbins; i++)
+    os << min + (i-0.5)/scale << " " << counts[i] << std::endl;
+}
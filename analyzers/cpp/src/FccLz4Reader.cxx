@@ -0,0 +1,352 @@
+#include "FccLz4Reader.h"
+#include "lz4.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+static constexpr uint32_t kLz4Magic = 0x184D2204;
+static constexpr uint32_t kSkippableMagic = 0x184D2A50; //0x184D2A50 to 0x184D2A5F
+static constexpr size_t kDictionarySize = 64*1024;
+
+static bool ReadLE32(FILE* f, uint32_t& value) {
+  uint8_t b[4];
+  if(fread(b, 4, 1, f) != 1)
+    return false;
+  value = b[0] | (b[1]<<8) | (b[2]<<16) | ((uint32_t)b[3]<<24);
+  return true;
+}
+
+FccLz4Reader::FccLz4Reader(const std::string& p, int n): path(p), nthreads(n>0?n:1) {
+}
+
+FccLz4Reader::~FccLz4Reader() {
+  Close();
+}
+
+bool FccLz4Reader::IsLz4File(const std::string& path) {
+  FILE* f = fopen(path.c_str(), "rb");
+  if(!f)
+    return false;
+  uint32_t magic = 0;
+  bool ret = ReadLE32(f, magic) && (magic == kLz4Magic || (magic & 0xFFFFFFF0) == kSkippableMagic);
+  fclose(f);
+  return ret;
+}
+
+bool FccLz4Reader::Open(bool seq) {
+  sequential = seq;
+  file = fopen(path.c_str(), "rb");
+  if(!file){
+    std::cout << "Cannot open " << path << std::endl;
+    return false;
+  }
+  setvbuf(file, nullptr, _IOFBF, 4*1024*1024);
+
+  if(!ReadFrameHeader()){
+    std::cout << path << " is not a lz4 frame file" << std::endl;
+    return false;
+  }
+  firstBlockOffset = ftello(file);
+
+  std::cout << "lz4 frame with " << (frame.independent ? "independent" : "linked") << " blocks of max " << frame.maxSize/1024 << " KB";
+  if(sequential && frame.independent)
+    std::cout << ", decompressing with " << nthreads << " threads";
+  std::cout << std::endl;
+
+  if(sequential)
+    StartThreads();
+  return true;
+}
+
+void FccLz4Reader::Close() {
+  StopThreads();
+  if(file){
+    fclose(file);
+    file = nullptr;
+  }
+}
+
+bool FccLz4Reader::ReadFrameHeader() {
+  uint32_t magic;
+  while(ReadLE32(file, magic)){
+    if((magic & 0xFFFFFFF0) == kSkippableMagic){
+      uint32_t size;
+      if(!ReadLE32(file, size) || fseeko(file, size, SEEK_CUR))
+        return false;
+      continue;
+    }
+    if(magic != kLz4Magic)
+      return false;
+
+    uint8_t flg, bd;
+    if(fread(&flg, 1, 1, file) != 1 || fread(&bd, 1, 1, file) != 1)
+      return false;
+    if((flg >> 6) != 1)
+      return false;
+
+    frame.independent = flg & 0x20;
+    frame.blockChecksum = flg & 0x10;
+    frame.contentChecksum = flg & 0x04;
+    static const size_t blockSizes[] = {64*1024, 256*1024, 1024*1024, 4*1024*1024};
+    int bsid = (bd >> 4) & 0x7;
+    if(bsid < 4)
+      return false;
+    frame.maxSize = blockSizes[bsid-4];
+
+    //content size, dictionary id and header checksum are not used
+    size_t skip = ((flg & 0x08) ? 8 : 0) + ((flg & 0x01) ? 4 : 0) + 1;
+    if(fseeko(file, skip, SEEK_CUR))
+      return false;
+
+    dictionary.clear();
+    return true;
+  }
+
+  return false;
+}
+
+bool FccLz4Reader::ReadBlock(Block& block) {
+  while(true){
+    uint64_t offset = ftello(file);
+    uint32_t size;
+    if(!ReadLE32(file, size))
+      return false;
+
+    if(size == 0){
+      //end mark, a concatenated frame may follow
+      if(frame.contentChecksum && fseeko(file, 4, SEEK_CUR))
+        return false;
+      if(!ReadFrameHeader())
+        return false;
+      continue;
+    }
+
+    block.fileOffset = offset;
+    block.frame = frame;
+    block.stored = size & 0x80000000;
+    size &= 0x7FFFFFFF;
+    if(size > frame.maxSize){
+      std::cout << "Corrupted lz4 block at " << offset << std::endl;
+      error = true;
+      return false;
+    }
+
+    block.compressed.resize(size);
+    if(fread(block.compressed.data(), size, 1, file) != 1){
+      std::cout << "Truncated lz4 block at " << offset << std::endl;
+      error = true;
+      return false;
+    }
+    if(frame.blockChecksum && fseeko(file, 4, SEEK_CUR))
+      return false;
+
+    compressedBytes += size;
+    return true;
+  }
+}
+
+bool FccLz4Reader::Decompress(Block& block) {
+  if(block.stored){
+    block.output.swap(block.compressed);
+    block.outsize = block.output.size();
+    return true;
+  }
+
+  size_t maxSize = block.frame.maxSize;
+  if(block.output.size() < maxSize)
+    block.output.resize(maxSize);
+
+  if(block.frame.independent){
+    block.outsize = LZ4_decompress_safe(block.compressed.data(), block.output.data(), block.compressed.size(), maxSize);
+  } else {
+    block.outsize = LZ4_decompress_safe_usingDict(block.compressed.data(), block.output.data(), block.compressed.size(), maxSize,
+                                                  dictionary.data(), dictionary.size());
+  }
+
+  if(block.outsize < 0){
+    std::cout << "lz4 decompression error in block at " << block.fileOffset << std::endl;
+    block.outsize = 0;
+    error = true;
+    return false;
+  }
+  return true;
+}
+
+void FccLz4Reader::UpdateDictionary(const Block& block) {
+  if(block.frame.independent)
+    return;
+  dictionary.insert(dictionary.end(), block.output.data(), block.output.data() + block.outsize);
+  if(dictionary.size() > kDictionarySize)
+    dictionary.erase(dictionary.begin(), dictionary.end() - kDictionarySize);
+}
+
+void FccLz4Reader::FeederFunction() {
+  while(true){
+    Block* block;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      block = &slots[feedIndex % slots.size()];
+      slotChanged.wait(lock, [&]{ return stopThreads || block->state == Block::State::Free; });
+      if(stopThreads)
+        return;
+    }
+
+    //after an error in a worker the data ends at that block
+    bool ok = !error && ReadBlock(*block);
+    bool parallel = ok && block->frame.independent && !block->stored && !workers.empty();
+    if(ok && !parallel){
+      //linked blocks need the previous output as dictionary, decompress here in order
+      ok = Decompress(*block);
+      if(ok)
+        UpdateDictionary(*block);
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if(!ok)
+        block->state = Block::State::End;
+      else if(parallel)
+        block->state = Block::State::Loaded;
+      else
+        block->state = Block::State::Done;
+      feedIndex++;
+    }
+    slotChanged.notify_all();
+
+    if(!ok)
+      return;
+  }
+}
+
+void FccLz4Reader::WorkerFunction() {
+  while(true){
+    Block* block = nullptr;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      slotChanged.wait(lock, [&]{
+        if(stopThreads)
+          return true;
+        for(auto& slot: slots){
+          if(slot.state == Block::State::Loaded){
+            block = &slot;
+            return true;
+          }
+        }
+        return false;
+      });
+      if(stopThreads)
+        return;
+      block->state = Block::State::Decompressing;
+    }
+
+    bool ok = Decompress(*block);
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      //Read() stops at a block that failed
+      block->state = ok ? Block::State::Done : Block::State::End;
+    }
+    slotChanged.notify_all();
+  }
+}
+
+void FccLz4Reader::StartThreads() {
+  //enough blocks in flight to keep all workers busy while the reader consumes in order
+  slots.clear();
+  slots.resize(2*nthreads + 2);
+  feedIndex = 0;
+  readIndex = 0;
+  current = nullptr;
+  currentPos = 0;
+  stopThreads = false;
+
+  feeder = std::thread(&FccLz4Reader::FeederFunction, this);
+  if(nthreads > 1){
+    for(int i=0; i<nthreads; i++)
+      workers.emplace_back(&FccLz4Reader::WorkerFunction, this);
+  }
+}
+
+void FccLz4Reader::StopThreads() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopThreads = true;
+  }
+  slotChanged.notify_all();
+  if(feeder.joinable())
+    feeder.join();
+  for(auto& worker: workers)
+    worker.join();
+  workers.clear();
+}
+
+size_t FccLz4Reader::Read(void* dst, size_t n) {
+  char* out = (char*)dst;
+  size_t done = 0;
+
+  while(done < n){
+    if(current && currentPos < (size_t)current->outsize){
+      size_t chunk = std::min(n - done, (size_t)current->outsize - currentPos);
+      memcpy(out + done, current->output.data() + currentPos, chunk);
+      currentPos += chunk;
+      done += chunk;
+      continue;
+    }
+
+    if(!sequential){
+      if(!ReadNextBlock())
+        return done;
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    if(current){
+      //give back the consumed block
+      if(current->state == Block::State::End)
+        return done;
+      current->state = Block::State::Free;
+      readIndex++;
+      slotChanged.notify_all();
+    }
+
+    current = &slots[readIndex % slots.size()];
+    currentPos = 0;
+    slotChanged.wait(lock, [&]{ return current->state == Block::State::Done || current->state == Block::State::End; });
+    if(current->state == Block::State::End)
+      return done;
+    decompressedBytes += current->outsize;
+  }
+
+  return done;
+}
+
+bool FccLz4Reader::ReadNextBlock() {
+  current = nullptr;
+  currentPos = 0;
+  if(error || !ReadBlock(randomBlock) || !Decompress(randomBlock))
+    return false;
+  UpdateDictionary(randomBlock);
+  decompressedBytes += randomBlock.outsize;
+  current = &randomBlock;
+  return true;
+}
+
+bool FccLz4Reader::Seek(uint64_t fileOffset, uint64_t pos, const Frame& blockFrame) {
+  if(!file || sequential || !blockFrame.independent || error)
+    return false;
+
+  //the whole block is decompressed, any position in it is available
+  if(!current || current->fileOffset != fileOffset){
+    if(fseeko(file, fileOffset, SEEK_SET))
+      return false;
+    frame = blockFrame;
+    dictionary.clear();
+    if(!ReadNextBlock())
+      return false;
+  }
+
+  if(pos > (uint64_t)current->outsize)
+    return false;
+  currentPos = pos;
+  return true;
+}
@@ -0,0 +1,25 @@
+#include "FccEventSource.h"
+#include <cstring>
+#include <iostream>
+
+bool FccLz4Source::Read(FccEvent& event) {
+  if(stopRequested)
+    return false;
+
+  FccEventHeader header;
+  if(reader.Read(&header, sizeof(header)) != sizeof(header)){
+    //a corrupted block ends the data, the events after it are not trusted
+    if(reader.IsError())
+      std::cout << "lz4 read error, stopping" << std::endl;
+    return false;
+  }
+
+  event.buffer.resize(sizeof(header) + header.data_size);
+  memcpy(event.buffer.data(), &header, sizeof(header));
+  if(reader.Read(event.buffer.data()+sizeof(header), header.data_size) != header.data_size){
+    std::cout << (reader.IsError() ? "lz4 read error in event " : "Truncated event ") << header.serial_number << std::endl;
+    return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,101 @@
+#include "FccEventSource.h"
+#include "midas.h"
+#include <cstring>
+#include <iostream>
+
+//transitions arrive inside cm_yield, they are turned into BOR/EOR events by Read
+static std::atomic<int> pendingStart{-1};
+static std::atomic<int> pendingStop{-1};
+
+static INT tr_start(INT run_number, char* /*error*/) {
+  pendingStart = run_number;
+  return SUCCESS;
+}
+
+static INT tr_stop(INT run_number, char* /*error*/) {
+  pendingStop = run_number;
+  return SUCCESS;
+}
+
+FccOnlineSource::~FccOnlineSource() noexcept {
+  Close();
+}
+
+bool FccOnlineSource::Open() {
+  int status = cm_connect_experiment(host.c_str(), experiment.c_str(), "fcc_analyzer", NULL);
+  if(status != CM_SUCCESS){
+    std::cout << "Cannot connect to experiment '" << experiment << "' on '" << host << "'" << std::endl;
+    return false;
+  }
+  connected = true;
+
+  status = bm_open_buffer(buffer.c_str(), DEFAULT_BUFFER_SIZE, &bufferHandle);
+  if(status != BM_SUCCESS && status != BM_CREATED){
+    std::cout << "Cannot open buffer " << buffer << std::endl;
+    return false;
+  }
+
+  //sampling does not slow down the DAQ when the analyzer is behind
+  status = bm_request_event(bufferHandle, EVENTID_ALL, TRIGGER_ALL, sampling ? GET_NONBLOCKING : GET_ALL, &requestId, NULL);
+  if(status != BM_SUCCESS){
+    std::cout << "Cannot request events from " << buffer << std::endl;
+    return false;
+  }
+
+  //before the frontends on start and after them on stop, to bracket their events
+  cm_register_transition(TR_START, tr_start, 200);
+  cm_register_transition(TR_STOP, tr_stop, 800);
+
+  //already running: behave as if the run just started
+  HNDLE hDB;
+  cm_get_experiment_database(&hDB, NULL);
+  INT state = 0, run = 0;
+  INT size = sizeof(state);
+  db_get_value(hDB, 0, "/Runinfo/State", &state, &size, TID_INT32, FALSE);
+  size = sizeof(run);
+  db_get_value(hDB, 0, "/Runinfo/Run number", &run, &size, TID_INT32, FALSE);
+  if(state == STATE_RUNNING)
+    pendingStart = run;
+
+  std::cout << "Reading " << (sampling ? "sampled" : "all") << " events from " << buffer << std::endl;
+  return true;
+}
+
+void FccOnlineSource::Close() {
+  if(connected){
+    cm_disconnect_experiment();
+    connected = false;
+  }
+}
+
+bool FccOnlineSource::Read(FccEvent& event) {
+  while(!stopRequested){
+    int run = pendingStart.exchange(-1);
+    if(run >= 0){
+      event.MakeTransition(FccEvent::kBeginOfRun, run);
+      return true;
+    }
+
+    EVENT_HEADER* pevent = nullptr;
+    int status = bm_receive_event_alloc(bufferHandle, &pevent, pendingStop >= 0 ? 10 : 100);
+    if(status == BM_SUCCESS && pevent){
+      event.buffer.resize(sizeof(EVENT_HEADER) + pevent->data_size);
+      memcpy(event.buffer.data(), pevent, event.buffer.size());
+      free(pevent);
+      return true;
+    }
+
+    //the end of run is delivered once the buffer has been drained
+    run = pendingStop.exchange(-1);
+    if(run >= 0){
+      event.MakeTransition(FccEvent::kEndOfRun, run);
+      return true;
+    }
+
+    status = cm_yield(0);
+    if(status == RPC_SHUTDOWN || status == SS_ABORT)
+      return false;
+  }
+
+  return false;
+}
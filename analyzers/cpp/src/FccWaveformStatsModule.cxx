@@ -0,0 +1,94 @@
+#include "FccWaveformStatsModule.h"
+#include "FccCalibration.h"
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+//number of samples averaged to estimate the baseline
+static constexpr uint32_t kBaselineSamples = 16;
+
+void FccWaveformStatsModule::Accumulator::Merge(const Accumulator& other) {
+  for(const auto& ch: other.channels)
+    channels[ch.first].Merge(ch.second);
+  for(const auto& tr: other.triggers)
+    triggers[tr.first] += tr.second;
+}
+
+void FccWaveformStatsModule::BeginRun(int /*run*/, int nthreads) {
+  accumulators.Reset(nthreads);
+}
+
+void FccWaveformStatsModule::Fill(Accumulator& acc, int key, const FccWaveform& wf, float gain) {
+  if(wf.nsamples == 0)
+    return;
+
+  uint32_t nbase = wf.nsamples < kBaselineSamples ? wf.nsamples : kBaselineSamples;
+  uint32_t sum = 0;
+  for(uint32_t i=0; i<nbase; i++)
+    sum += wf.samples[i];
+
+  uint16_t min = 0xFFFF;
+  for(uint32_t i=0; i<wf.nsamples; i++)
+    min = wf.samples[i] < min ? wf.samples[i] : min;
+
+  double baseline = (double)sum/nbase;
+  ChannelStats& stats = acc.channels[key];
+  stats.baseline.Fill(baseline);
+  stats.amplitude.Fill(baseline - min);
+  if(gain)
+    stats.gain = gain;
+}
+
+void FccWaveformStatsModule::ProcessEvent(const FccDecodedEvent& event, int thread) {
+  Accumulator& acc = accumulators[thread];
+
+  for(const auto& header: event.scope)
+    acc.triggers[header.frontend]++;
+
+  const FccCalibration* calibration = event.calibration;
+  for(const auto& wf: event.waveforms)
+    Fill(acc, ChannelKey(false, wf.board, wf.channel), wf, calibration ? calibration->Gain(false, wf.board, wf.channel) : 0);
+
+  for(const auto& wf: event.tek)
+    Fill(acc, ChannelKey(true, wf.board, wf.channel), wf, calibration ? calibration->Gain(true, wf.board, wf.channel) : 0);
+}
+
+void FccWaveformStatsModule::EndRun(int run) {
+  Accumulator total = accumulators.Merge();
+
+  for(const auto& tr: total.triggers)
+    std::cout << "Digitizer " << tr.first << ": " << tr.second << " triggers" << std::endl;
+
+  std::cout << std::setw(12) << "channel" << std::setw(10) << "entries" << std::setw(12) << "baseline" << std::setw(12) << "amp. mean" << std::setw(12) << "amp. 99%" << std::setw(12) << "amp. (mV)" << std::endl;
+  for(const auto& ch: total.channels){
+    int board = (ch.first>>8)&0xFF;
+    std::string name;
+    if(ch.first & (1<<16))
+      name = board ? "TK" + std::to_string(board) + "/" : "TEK";
+    else
+      name = "W" + std::to_string(board) + "/";
+    name += std::to_string(ch.first & 0xFF);
+    std::cout << std::setw(12) << name << std::setw(10) << ch.second.amplitude.GetEntries()
+              << std::setw(12) << ch.second.baseline.GetMean()
+              << std::setw(12) << ch.second.amplitude.GetMean()
+              << std::setw(12) << ch.second.amplitude.GetQuantile(0.99);
+    //from the calibration banks, the amplitude is a difference so only the gain matters
+    if(ch.second.gain)
+      std::cout << std::setw(12) << 1e3*ch.second.amplitude.GetMean()*std::abs(ch.second.gain);
+    std::cout << std::endl;
+  }
+
+  if(outputDir.empty())
+    return;
+
+  std::string filename = outputDir + "/wfstats_run" + std::to_string(run) + ".txt";
+  std::ofstream ofs(filename, std::ofstream::out);
+  for(const auto& ch: total.channels){
+    ofs << "# channel key " << ch.first << " baseline" << std::endl;
+    ch.second.baseline.Write(ofs);
+    ofs << "# channel key " << ch.first << " amplitude" << std::endl;
+    ch.second.amplitude.Write(ofs);
+  }
+  std::cout << "Histograms written to " << filename << std::endl;
+}
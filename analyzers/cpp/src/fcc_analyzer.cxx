@@ -0,0 +1,102 @@
+/********************************************************************\
+
+  Name:         fcc_analyzer.cxx
+
+  Contents:     Multithreaded analyzer for the FCC Naples frontend banks
+                (W0EV, W0yy, W0CV, RAW0, TEKn, TEKT, TEKW, TEKC, TEKV and TKkn,
+                TKkT, TKkW, TKkC, TKkV of scope k), offline on .mid files or
+                online on a MIDAS buffer
+
+\********************************************************************/
+
+#include "FccAnalyzer.h"
+#include "FccEventSource.h"
+#include "FccWaveformStatsModule.h"
+#include <iostream>
+#include <signal.h>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
+
+static void usage(const char* name) {
+  std::cout << "Usage: " << name << " [-i file.mid[.lz4]] [-t triggers] [-j threads] [-z threads] [-o outdir] [-H host] [-e experiment] [-b buffer] [-a]" << std::endl;
+  std::cout << "  -i  read events from a run file, otherwise connect to the experiment" << std::endl;
+  std::cout << "  -t  only analyze the given trigger_ids using the run index, e.g. 10,20-30" << std::endl;
+  std::cout << "  -j  number of worker threads (default: number of cores)" << std::endl;
+  std::cout << "  -z  number of lz4 decompression threads (default: same as -j)" << std::endl;
+  std::cout << "  -o  directory for the module outputs" << std::endl;
+  std::cout << "  -a  online: get all events instead of sampling (may slow down the DAQ)" << std::endl;
+}
+
+//parse "a,b-c" into inclusive ranges
+static std::vector<std::pair<uint32_t, uint32_t>> parse_ranges(const std::string& str) {
+  std::vector<std::pair<uint32_t, uint32_t>> ranges;
+  std::istringstream stream(str);
+  std::string item;
+  while(std::getline(stream, item, ',')){
+    size_t dash = item.find('-');
+    if(dash == std::string::npos)
+      ranges.emplace_back(std::stoul(item), std::stoul(item));
+    else
+      ranges.emplace_back(std::stoul(item.substr(0, dash)), std::stoul(item.substr(dash+1)));
+  }
+  return ranges;
+}
+
+static void stop_handler(int /*sig*/) {
+  FccEventSource::RequestStop();
+}
+
+int main(int argc, char** argv) {
+  std::string input, triggers, outdir, host, experiment, buffer = "SYSTEM";
+  int nthreads = std::thread::hardware_concurrency();
+  [[maybe_unused]] int nlz4threads = 0;
+  [[maybe_unused]] bool sampling = true;
+
+  int opt;
+  while((opt = getopt(argc, argv, "i:t:j:z:o:H:e:b:ah")) != -1){
+    switch(opt){
+    case 'i': input = optarg; break;
+    case 't': triggers = optarg; break;
+    case 'j': nthreads = atoi(optarg); break;
+    case 'z': nlz4threads = atoi(optarg); break;
+    case 'o': outdir = optarg; break;
+    case 'H': host = optarg; break;
+    case 'e': experiment = optarg; break;
+    case 'b': buffer = optarg; break;
+    case 'a': sampling = false; break;
+    default:
+      usage(argv[0]);
+      return -1;
+    }
+  }
+
+  signal(SIGINT, stop_handler);
+  signal(SIGTERM, stop_handler);
+
+  std::unique_ptr<FccEventSource> source;
+  if(!input.empty() && !triggers.empty()){
+    source = std::make_unique<FccIndexedSource>(input, parse_ranges(triggers));
+  } else if(!input.empty()){
+#ifdef HAVE_LZ4
+    if(FccLz4Reader::IsLz4File(input))
+      source = std::make_unique<FccLz4Source>(input, nlz4threads ? nlz4threads : nthreads);
+    else
+#endif
+      source = std::make_unique<FccFileSource>(input);
+  } else {
+#ifdef HAVE_MIDAS
+    source = std::make_unique<FccOnlineSource>(host, experiment, buffer, sampling);
+#else
+    std::cout << "Compiled without MIDAS, only offline analysis (-i) is available" << std::endl;
+    return -1;
+#endif
+  }
+
+  FccAnalyzer analyzer(nthreads);
+  analyzer.AddModule(std::make_unique<FccWaveformStatsModule>(outdir));
+
+  analyzer.Run(*source);
+  analyzer.PrintStatistics();
+  return 0;
+}
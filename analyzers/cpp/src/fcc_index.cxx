@@ -0,0 +1,88 @@
+/********************************************************************\
+
+  Name:         fcc_index.cxx
+
+  Contents:     Build the sidecar index of a run file (post-pass) and
+                look up events by serial number, trigger_id or
+                digitizer timestamp
+
+\********************************************************************/
+
+#include "FccEventIndex.h"
+#include "FccBanks.h"
+#include <chrono>
+#include <iostream>
+#include <unistd.h>
+
+static void usage(const char* name) {
+  std::cout << "Usage: " << name << " [-j threads] [-s serial | -t trigger_id | -T tmin:tmax] run.mid[.lz4]" << std::endl;
+  std::cout << "  without a query the index is (re)built and written to run.mid[.lz4].idx" << std::endl;
+}
+
+static void print_event(FccIndexedReader& reader, const FccEventIndex::Entry& entry) {
+  FccEvent event;
+  FccDecodedEvent decoded;
+  auto tstart = std::chrono::steady_clock::now();
+  bool ok = reader.ReadEvent(entry, event) && decoded.Decode(event);
+  double dt = std::chrono::duration<double>(std::chrono::steady_clock::now() - tstart).count();
+
+  std::cout << "serial " << entry.serial << " trigger_id " << (FccEventIndex::HasTrigger(entry) ? std::to_string(entry.trigger_id) : "-") << " timestamp " << entry.timestamp
+            << " at " << entry.offset << "+" << entry.blockpos;
+  if(ok)
+    std::cout << ": " << event.GetBanks().size() << " banks, read in " << dt*1e3 << " ms" << std::endl;
+  else
+    std::cout << ": read error" << std::endl;
+}
+
+int main(int argc, char** argv) {
+  int nthreads = 4;
+  char query = 0;
+  std::string value;
+
+  int opt;
+  while((opt = getopt(argc, argv, "j:s:t:T:h")) != -1){
+    switch(opt){
+    case 'j': nthreads = atoi(optarg); break;
+    case 's':
+    case 't':
+    case 'T': query = opt; value = optarg; break;
+    default:
+      usage(argv[0]);
+      return -1;
+    }
+  }
+  if(optind >= argc){
+    usage(argv[0]);
+    return -1;
+  }
+  std::string runfile = argv[optind];
+
+  if(!query)
+    return FccEventIndex::Build(runfile, nthreads) ? 0 : -1;
+
+  auto tstart = std::chrono::steady_clock::now();
+  FccIndexedReader reader(runfile);
+  if(!reader.Open())
+    return -1;
+  double dt = std::chrono::duration<double>(std::chrono::steady_clock::now() - tstart).count();
+  std::cout << "Index loaded in " << dt*1e3 << " ms" << std::endl;
+
+  FccEventIndex& index = reader.GetIndex();
+  if(query == 'T'){
+    size_t colon = value.find(':');
+    uint64_t tmin = std::stoull(value.substr(0, colon));
+    uint64_t tmax = (colon == std::string::npos) ? tmin : std::stoull(value.substr(colon+1));
+    for(auto entry: index.FindTimestampRange(tmin, tmax))
+      print_event(reader, *entry);
+    return 0;
+  }
+
+  uint32_t id = std::stoul(value);
+  const FccEventIndex::Entry* entry = (query == 's') ? index.FindSerial(id) : index.FindTrigger(id);
+  if(!entry){
+    std::cout << "Event not found" << std::endl;
+    return -1;
+  }
+  print_event(reader, *entry);
+  return 0;
+}
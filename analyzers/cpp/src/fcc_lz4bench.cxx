@@ -0,0 +1,41 @@
+/********************************************************************\
+
+  Name:         fcc_lz4bench.cxx
+
+  Contents:     Decompression throughput of FccLz4Reader versus the
+                number of threads, reading a whole .lz4 run file
+
+\********************************************************************/
+
+#include "FccLz4Reader.h"
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+int main(int argc, char** argv) {
+  if(argc < 2){
+    std::cout << "Usage: " << argv[0] << " file.mid.lz4 [max threads]" << std::endl;
+    return -1;
+  }
+
+  int maxthreads = (argc > 2) ? atoi(argv[2]) : 8;
+  std::vector<char> buffer(1024*1024);
+
+  for(int nthreads=1; nthreads<=maxthreads; nthreads*=2){
+    FccLz4Reader reader(argv[1], nthreads);
+    if(!reader.Open())
+      return -1;
+
+    auto tstart = std::chrono::steady_clock::now();
+    while(reader.Read(buffer.data(), buffer.size()) == buffer.size());
+    double dt = std::chrono::duration<double>(std::chrono::steady_clock::now() - tstart).count();
+    reader.Close();
+
+    std::cout << nthreads << " threads: " << reader.GetDecompressedBytes()/1e6 << " MB in " << dt << " s, "
+              << reader.GetDecompressedBytes()/1e6/dt << " MB/s (" << reader.GetCompressedBytes()/1e6/dt << " MB/s compressed)" << std::endl;
+    if(reader.IsError())
+      return -1;
+  }
+
+  return 0;
+}
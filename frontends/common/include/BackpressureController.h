@@ -0,0 +1,72 @@
+#ifndef BACKPRESSURE_CONTROLLER_H
+#define BACKPRESSURE_CONTROLLER_H
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+
+//decides per event how much of it is written, from the ring buffer occupancy
+//
+//above the high watermark the readout degrades according to the policy until the occupancy
+//falls below the low watermark again:
+//  prescale  1 in N events is written in full, the others are dropped
+//  features  every event is written with a feature bank instead of the waveforms
+//  sample    at most Sample Rate events per second are written in full, the others are dropped
+//dropped events are still read from the hardware, so no trigger is lost without being counted
+class BackpressureController {
+  public:
+    enum class Policy {None, Prescale, Features, Sample};
+    enum Decision {kFull, kFeatures, kDrop};
+
+    struct Counters {
+      uint64_t events;
+      uint64_t full;
+      uint64_t features;
+      uint64_t dropped;
+      uint64_t transitions; //number of times the high watermark was crossed
+      double degradedTime; //s
+      double occupancy; //last value, 0..1
+      bool active;
+    };
+
+    //unknown names give Policy::None
+    static Policy ParsePolicy(const std::string& name);
+
+    //watermarks as fractions of the buffer, rate in Hz
+    void Configure(Policy policy, double high, double low, uint32_t prescale, double rate);
+    void Reset();
+
+    //readout thread, once per event before it is read
+    Decision Decide(double occupancy);
+    //readout thread, once the event is in the ring buffer or dropped, with what was done with it
+    void Count(Decision done);
+
+    //any thread
+    Counters GetCounters() const;
+
+  private:
+    Policy policy = Policy::None;
+    double high = 0.8;
+    double low = 0.5;
+    uint32_t prescale = 10;
+    std::chrono::steady_clock::duration period;
+
+    uint32_t prescaleCount = 0;
+    std::chrono::steady_clock::time_point lastSample;
+    std::chrono::steady_clock::time_point activeSince;
+
+    //written by the readout thread only
+    std::atomic<uint64_t> events{0};
+    std::atomic<uint64_t> full{0};
+    std::atomic<uint64_t> features{0};
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<uint64_t> transitions{0};
+    std::atomic<int64_t> degradedNs{0}; //closed degraded periods
+    std::atomic<int64_t> activeSinceNs{0}; //0 when not degraded
+    std::atomic<double> occupancy{0};
+
+    static void Increment(std::atomic<uint64_t>& c) { c.store(c.load(std::memory_order_relaxed)+1, std::memory_order_relaxed); }
+};
+
+#endif
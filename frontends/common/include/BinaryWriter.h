@@ -0,0 +1,78 @@
+#ifndef BINARY_WRITER_H
+#define BINARY_WRITER_H
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//waveform records written to a file by a background thread, for the bench tools
+//
+//records go into one of two buffers while the thread writes the other one; the caller only
+//waits if it fills its buffer before the previous one is on disk (GetWaits()).
+//
+//file format (little endian), scripts/fccw_to_csv.py converts it to text:
+//  uint32 magic 'FCCW', uint32 version
+//  per record: uint32 nbytes, uint32 event, uint16 channel, uint16 sample width (bytes),
+//              uint32 frames, nbytes of samples, frames x nbytes/frames back to back
+class BinaryWriter {
+  public:
+    static const uint32_t kMagic = 0x57434346;
+    static const uint32_t kVersion = 1;
+
+    struct RecordHeader {
+      uint32_t nbytes;
+      uint32_t event;
+      uint16_t channel;
+      uint16_t width;
+      uint32_t frames;
+    };
+
+    //bufferSize per buffer, records larger than that get a buffer of their own size
+    BinaryWriter(const std::string& path, size_t bufferSize = 16*1024*1024);
+    ~BinaryWriter();
+    BinaryWriter(const BinaryWriter&) = delete;
+    BinaryWriter& operator=(const BinaryWriter&) = delete;
+
+    bool IsOpen() const { return fd >= 0; }
+
+    //space for the samples of one record, valid until the next Reserve(), Write() or Close()
+    //so the data can be read straight into the file buffer
+    void* Reserve(uint32_t event, uint16_t channel, uint16_t width, uint32_t frames, uint32_t nbytes);
+    //drops the last reserved record, e.g. if filling it failed
+    void Discard();
+    void Write(uint32_t event, uint16_t channel, uint16_t width, uint32_t frames, const void* data, uint32_t nbytes);
+
+    //writes what is buffered and stops the thread, called by the destructor
+    void Close();
+
+    uint64_t GetBytes() const { return bytes; }
+    uint64_t GetWaits() const { return waits; }
+
+  private:
+    int fd = -1;
+    //storage is allocated once, used grows with the records
+    struct Buffer {
+      std::vector<char> storage;
+      size_t used = 0;
+    };
+    Buffer buffers[2];
+    int active = 0; //buffer filled by the caller
+    size_t lastRecord = 0;
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool pending = false; //the other buffer is being written
+    bool stop = false;
+    std::atomic<uint64_t> bytes{0};
+    uint64_t waits = 0;
+
+    void Swap();
+    void WriterThread();
+};
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef HUGE_PAGES_H
+#define HUGE_PAGES_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <mutex>
+#include <string>
+#include <vector>
+
+//anonymous memory backed by 2 MB huge pages where the system allows it
+//
+//the constructor only maps the memory, Prefault() touches every page from the calling thread.
+//Under the kernel's first-touch policy that places the pages on the NUMA node of that thread, so
+//the thread that uses the buffer prefaults it after ThreadPlacement::Register().
+//
+//tries in order: hugetlbfs pages (MAP_HUGETLB, needs vm.nr_hugepages), transparent huge pages
+//(madvise MADV_HUGEPAGE, needs THP "madvise" or "always") and normal pages. The buffer works the
+//same in every mode, GetMode() tells which one was obtained.
+class HugePageBuffer {
+  public:
+    enum class Mode {None, HugeTLB, Transparent, Normal};
+    static const size_t kHugePageSize = 2 * 1024 * 1024;
+
+    HugePageBuffer() {};
+    //size is rounded up to kHugePageSize, huge=false gives normal pages
+    HugePageBuffer(size_t size, bool huge=true);
+    ~HugePageBuffer();
+    HugePageBuffer(const HugePageBuffer&) = delete;
+    HugePageBuffer& operator=(const HugePageBuffer&) = delete;
+    HugePageBuffer(HugePageBuffer&& other) noexcept;
+    HugePageBuffer& operator=(HugePageBuffer&& other) noexcept;
+
+    void* Data() const { return data; }
+    size_t Size() const { return size; }
+    Mode GetMode() const { return mode; }
+    //calling thread, once before the buffer is used
+    void Prefault();
+    //page faults taken by Prefault(), one per page
+    long GetPrefaults() const { return prefaults; }
+    //"2 MB huge pages (hugetlbfs), 16 MB" or the reason for the fallback
+    std::string Describe() const;
+
+    static const char* ModeName(Mode mode);
+
+  private:
+    void* data = nullptr;
+    size_t size = 0;
+    Mode mode = Mode::None;
+    long prefaults = 0;
+    std::string fallback; //why the preferred mode was not used
+};
+
+//fixed size blocks carved from one HugePageBuffer
+//
+//Get() falls back to the heap when all blocks are in use, Put() takes either kind back.
+class BlockPool {
+  public:
+    BlockPool(size_t blockSize, size_t count, bool huge=true);
+
+    void* Get();
+    void Put(void* block);
+
+    size_t GetBlockSize() const { return blockSize; }
+    const HugePageBuffer& GetBuffer() const { return buffer; }
+    //calling thread, see HugePageBuffer::Prefault()
+    void Prefault() { buffer.Prefault(); }
+
+  private:
+    size_t blockSize;
+    HugePageBuffer buffer;
+    std::mutex mutex;
+    std::vector<void*> free;
+};
+
+//page faults and data TLB misses of one thread, readable from any thread
+//
+//faults come from /proc/self/task/<tid>/stat, the TLB misses from a perf counter
+//(dTLB load misses, user space only). Without perf access, e.g. kernel.perf_event_paranoid > 2,
+//tlbMisses stays -1.
+class PageFaultMonitor {
+  public:
+    struct Counters {
+      int64_t minorFaults = 0;
+      int64_t majorFaults = 0;
+      int64_t tlbMisses = -1;
+    };
+
+    ~PageFaultMonitor();
+
+    //calling thread
+    void Attach();
+    Counters Read() const;
+
+  private:
+    int tid = 0;
+    int perfFd = -1;
+};
+
+#endif
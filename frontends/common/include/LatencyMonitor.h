@@ -0,0 +1,105 @@
+#ifndef LATENCY_MONITOR_H
+#define LATENCY_MONITOR_H
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+//log-linear histogram of latencies in ns: exact below 16 ns, then 8 bins per power of two
+//only the owning thread fills it, readers may see a count one behind
+class LatencyHistogram {
+  public:
+    static const int kBins = 16 + 60*8;
+
+    LatencyHistogram() {
+      for(auto& c: counts)
+        c.store(0, std::memory_order_relaxed);
+    }
+
+    static int Bin(uint64_t ns) {
+      if(ns < 16)
+        return ns;
+      int e = 63 - __builtin_clzll(ns);
+      return 16 + (e-4)*8 + ((ns >> (e-3)) & 7);
+    }
+
+    //center of the bin in ns
+    static double BinCenter(int bin) {
+      if(bin < 16)
+        return bin;
+      int e = (bin-16)/8 + 4;
+      int sub = (bin-16)%8;
+      return (double)((uint64_t)(8+sub) << (e-3)) + (double)(1ull << (e-3))/2;
+    }
+
+    //weight > 1 when only one in weight measurements is taken
+    void Add(uint64_t ns, uint64_t weight = 1) {
+      auto& c = counts[Bin(ns)];
+      c.store(c.load(std::memory_order_relaxed)+weight, std::memory_order_relaxed);
+    }
+
+    uint64_t Get(int bin) const { return counts[bin].load(std::memory_order_relaxed); }
+
+  private:
+    std::atomic<uint64_t> counts[kBins];
+};
+
+//histograms of one readout thread, one per stage of the LatencyMonitor that created it
+class LatencyRecorder {
+  public:
+    explicit LatencyRecorder(size_t nstages): nstages(nstages), hist(new LatencyHistogram[nstages]) {}
+
+    static uint64_t Now() {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void Add(int stage, uint64_t ns, uint64_t weight = 1) { hist[stage].Add(ns, weight); }
+
+    //records the time since start and returns the current time, to chain consecutive stages
+    uint64_t Record(int stage, uint64_t start) {
+      uint64_t now = Now();
+      hist[stage].Add(now - start);
+      return now;
+    }
+
+    const LatencyHistogram& Get(int stage) const { return hist[stage]; }
+    size_t GetNStages() const { return nstages; }
+
+  private:
+    size_t nstages;
+    std::unique_ptr<LatencyHistogram[]> hist;
+};
+
+//collects the recorders of all readout threads and summarizes them periodically
+class LatencyMonitor {
+  public:
+    struct Summary {
+      std::string stage;
+      uint64_t count; //since the previous Update()
+      double rate; //Hz
+      double p50, p90, p99, max; //us
+    };
+
+    explicit LatencyMonitor(const std::vector<std::string>& stages);
+
+    //called once by each readout thread, the recorder lives as long as the monitor
+    LatencyRecorder& AddThread();
+
+    //percentiles and rates since the previous call, all threads together
+    std::vector<Summary> Update();
+
+    const std::vector<std::string>& GetStages() const { return stages; }
+
+  private:
+    std::vector<std::string> stages;
+    std::mutex mutex;
+    std::vector<std::unique_ptr<LatencyRecorder>> recorders;
+    std::vector<std::vector<uint64_t>> previous; //cumulative counts at the last Update(), per stage
+    std::chrono::steady_clock::time_point lastUpdate;
+};
+
+#endif
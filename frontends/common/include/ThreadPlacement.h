@@ -0,0 +1,58 @@
+#ifndef THREAD_PLACEMENT_H
+#define THREAD_PLACEMENT_H
+
+#include <pthread.h>
+#include <sched.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+//CPU affinity and real-time priority of the frontend threads, by role ("Main", "Readout", "Sync")
+//
+//threads register themselves, Configure() re-applies a role's settings to its registered threads;
+//the frontends call it from the ODB hotlinks on the "* CPUs"/"* Priority" keys and at begin of run.
+//Memory stays NUMA local through the kernel's first-touch policy: pages first written by a pinned
+//thread end up on the node of its CPUs, so each thread prefaults its own buffers after Register()
+//(HugePageBuffer::Prefault), even when they were mapped by the main thread.
+class ThreadPlacement {
+  public:
+    static ThreadPlacement& Get();
+
+    //calling thread, applies the current settings of the role
+    void Register(const std::string& role);
+    //calling thread, before it exits
+    void Unregister();
+
+    //cpus as a list like "2-3,6", empty for all; priority > 0 selects SCHED_FIFO
+    void Configure(const std::string& role, const std::string& cpus, int priority);
+
+    //one line per registered thread with the placement read back from the kernel
+    std::vector<std::string> Report();
+
+    static bool ParseCpuList(const std::string& list, cpu_set_t& set);
+    //-1 if unknown
+    static int CpuNode(int cpu);
+
+  private:
+    struct Config {
+      std::string cpus;
+      int priority = 0;
+    };
+    struct Entry {
+      std::string role;
+      pthread_t thread;
+      int tid;
+      std::string error; //of the last Apply, empty if fine
+    };
+
+    ThreadPlacement();
+    void Apply(Entry& entry, const Config& config);
+
+    std::mutex mutex;
+    std::map<std::string, Config> configs;
+    std::vector<Entry> threads;
+    cpu_set_t processCpus; //affinity at startup, used for an empty CPU list
+};
+
+#endif
@@ -0,0 +1,114 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//opt-in span tracing for stall diagnosis, dumped as Chrome/Perfetto trace JSON
+//
+//every thread writes completed spans into its own ring buffer without locks, the newest
+//kCapacity spans per thread are kept. Span names must be string literals.
+//A dump is written on demand (Dump) or by a background thread shortly after a watched
+//span took longer than the threshold, so the file also shows what happened around it.
+class Tracer {
+  public:
+    static const uint32_t kCapacity = 1 << 16; //spans per thread
+
+    struct Span {
+      uint64_t start; //ns, steady_clock
+      uint64_t duration; //ns, 0 for instant events
+      const char* name;
+      uint64_t arg;
+    };
+
+    static Tracer& Get();
+
+    static uint64_t Now() {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    bool IsEnabled() const { return enabled.load(std::memory_order_relaxed); }
+    void Enable(bool on);
+    void SetThreshold(double ms) { threshold.store(ms*1e6, std::memory_order_relaxed); }
+    void SetDirectory(const std::string& dir);
+
+    //name shown for the calling thread in the trace viewer
+    void SetThreadName(const std::string& name);
+
+    void Record(const char* name, uint64_t start, uint64_t duration, uint64_t arg = 0);
+    void Instant(const char* name, uint64_t arg = 0) {
+      if(IsEnabled())
+        Record(name, Now(), 0, arg);
+    }
+
+    //called at the end of a watched span, never blocks
+    void Check(const char* name, uint64_t duration) {
+      uint64_t limit = threshold.load(std::memory_order_relaxed);
+      if(limit && duration > limit && !pending.exchange(name, std::memory_order_relaxed))
+        pendingDuration.store(duration, std::memory_order_relaxed);
+    }
+
+    //writes all buffers to <directory>/trace_<date>_<time>.json, returns the file name or "" on error
+    std::string Dump(const std::string& reason = "request");
+
+    ~Tracer();
+
+  private:
+    struct ThreadBuffer {
+      std::atomic<uint64_t> head{0};
+      std::unique_ptr<Span[]> spans{new Span[kCapacity]};
+      int tid;
+      std::string name;
+    };
+
+    Tracer() = default;
+    ThreadBuffer& Local();
+    void DumpThreadFunction();
+
+    std::atomic<bool> enabled{false};
+    std::atomic<uint64_t> threshold{0};
+    std::atomic<const char*> pending{nullptr};
+    std::atomic<uint64_t> pendingDuration{0};
+
+    std::mutex mutex; //threads list, directory and dumping
+    std::vector<std::unique_ptr<ThreadBuffer>> threads;
+    std::string directory = ".";
+
+    std::atomic<bool> runDumpThread{false};
+    std::thread dumpThread;
+};
+
+//records the enclosing scope as one span when tracing is enabled
+class TraceScope {
+  public:
+    explicit TraceScope(const char* name, bool watch = false): name(name), watch(watch) {
+      start = Tracer::Get().IsEnabled() ? Tracer::Now() : 0;
+    }
+
+    ~TraceScope() {
+      if(!start)
+        return;
+      uint64_t duration = Tracer::Now() - start;
+      Tracer::Get().Record(name, start, duration, arg);
+      if(watch)
+        Tracer::Get().Check(name, duration);
+    }
+
+    void SetArg(uint64_t value) { arg = value; }
+    //drop the span, e.g. for a poll that timed out
+    void Discard() { start = 0; }
+
+  private:
+    const char* name;
+    bool watch;
+    uint64_t start;
+    uint64_t arg = 0;
+};
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef WAVEFORM_FEATURES_H
+#define WAVEFORM_FEATURES_H
+
+#include <stdint.h>
+
+//per-channel summary written instead of the waveform when the readout is degraded:
+//channel, nsamples, baseline (mean of the first 16 samples), min, position of min, max,
+//position of max, integral of baseline - sample
+const int kFeatureWords = 8;
+void ExtractFeatures(uint16_t channel, const uint16_t* samples, uint32_t n, int32_t out[kFeatureWords]);
+
+//8 bit samples to the 16 bit scale (v << 8), so 8 and 16 bit readouts give the same values
+//in may be the upper half of out, in == (const uint8_t*)out + n, to widen a buffer in place
+void WidenSamples(const uint8_t* in, uint16_t* out, uint32_t n);
+
+#endif
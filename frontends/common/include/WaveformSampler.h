@@ -0,0 +1,64 @@
+#ifndef WAVEFORM_SAMPLER_H
+#define WAVEFORM_SAMPLER_H
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+//min/max decimation of n samples into npoints pairs (min, max) written to out[2*npoints]
+void MinMaxDecimate(const uint16_t* in, uint32_t n, uint16_t* out, uint32_t npoints);
+
+//takes at most Rate events per second from the readout thread for the live display
+//the readout thread never waits: a sample is dropped if the display is copying the previous one
+//
+//binary snapshot format (little endian):
+//  uint32 magic 'FWSN', uint32 serial, uint32 time (s), uint32 nwaveforms
+//  per waveform: uint16 board, uint16 channel, uint32 nsamples, uint32 npoints, npoints x (uint16 min, uint16 max)
+class WaveformSampler {
+  public:
+    static const uint32_t kMagic = 0x4E535746;
+
+    WaveformSampler(double rate = 10, uint32_t points = 1000);
+
+    void SetRate(double rate);
+    void SetPoints(uint32_t points) { npoints = points; }
+
+    //called by the readout thread for each event, true if the event has to be sampled
+    bool Sample() {
+      if(period.count() <= 0)
+        return false;
+      auto now = std::chrono::steady_clock::now();
+      if(now - last < period)
+        return false;
+      last = now;
+      Begin();
+      return true;
+    }
+
+    //only between Sample() returning true and Publish()
+    void AddWaveform(uint16_t board, uint16_t channel, const uint16_t* samples, uint32_t nsamples);
+    void Publish(uint32_t serial);
+
+    //called by the display endpoint, returns the number of bytes written or 0 if nothing to show
+    int CopySnapshot(char* dst, int maxsize);
+
+    uint64_t GetSampledEvents() const { return sampled; }
+    uint64_t GetDroppedSamples() const { return dropped; }
+
+  private:
+    std::chrono::steady_clock::duration period;
+    std::chrono::steady_clock::time_point last;
+    uint32_t npoints;
+
+    std::vector<char> back; //filled by the readout thread
+    std::vector<char> front; //last published snapshot
+    std::mutex frontMutex;
+    std::atomic<uint64_t> sampled{0};
+    std::atomic<uint64_t> dropped{0};
+
+    void Begin();
+};
+
+#endif
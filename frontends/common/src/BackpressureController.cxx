@@ -0,0 +1,116 @@
+#include "BackpressureController.h"
+#include <algorithm>
+
+static int64_t ToNs(std::chrono::steady_clock::time_point t) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+}
+
+BackpressureController::Policy BackpressureController::ParsePolicy(const std::string& name) {
+  std::string lower = name;
+  std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+  if(lower == "prescale")
+    return Policy::Prescale;
+  if(lower == "features")
+    return Policy::Features;
+  if(lower == "sample")
+    return Policy::Sample;
+  return Policy::None;
+}
+
+void BackpressureController::Configure(Policy policy, double high, double low, uint32_t prescale, double rate) {
+  this->policy = policy;
+  this->high = high;
+  this->low = std::min(low, high);
+  this->prescale = prescale ? prescale : 1;
+  if(rate > 0)
+    period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1./rate));
+  else
+    period = std::chrono::steady_clock::duration::max();
+}
+
+void BackpressureController::Reset() {
+  prescaleCount = 0;
+  lastSample = std::chrono::steady_clock::time_point();
+  events = full = features = dropped = transitions = 0;
+  degradedNs = activeSinceNs = 0;
+  occupancy = 0;
+}
+
+BackpressureController::Decision BackpressureController::Decide(double level) {
+  occupancy.store(level, std::memory_order_relaxed);
+
+  int64_t since = activeSinceNs.load(std::memory_order_relaxed);
+  if(policy != Policy::None){
+    if(!since && level >= high){
+      activeSince = std::chrono::steady_clock::now();
+      activeSinceNs.store(ToNs(activeSince), std::memory_order_relaxed);
+      Increment(transitions);
+      since = 1;
+    } else if(since && level <= low){
+      int64_t now = ToNs(std::chrono::steady_clock::now());
+      degradedNs.store(degradedNs.load(std::memory_order_relaxed) + now - since, std::memory_order_relaxed);
+      activeSinceNs.store(0, std::memory_order_relaxed);
+      since = 0;
+    }
+  }
+
+  if(!since)
+    return kFull;
+
+  switch(policy){
+  case Policy::Prescale:
+    if(++prescaleCount >= prescale){
+      prescaleCount = 0;
+      return kFull;
+    }
+    break;
+  case Policy::Features:
+    return kFeatures;
+  case Policy::Sample:
+    {
+      auto now = std::chrono::steady_clock::now();
+      if(now - lastSample >= period){
+        lastSample = now;
+        return kFull;
+      }
+    }
+    break;
+  default:
+    break;
+  }
+
+  return kDrop;
+}
+
+void BackpressureController::Count(Decision done) {
+  Increment(events);
+  switch(done){
+  case kFull:
+    Increment(full);
+    break;
+  case kFeatures:
+    Increment(features);
+    break;
+  case kDrop:
+    Increment(dropped);
+    break;
+  }
+}
+
+BackpressureController::Counters BackpressureController::GetCounters() const {
+  Counters c;
+  c.events = events.load(std::memory_order_relaxed);
+  c.full = full.load(std::memory_order_relaxed);
+  c.features = features.load(std::memory_order_relaxed);
+  c.dropped = dropped.load(std::memory_order_relaxed);
+  c.transitions = transitions.load(std::memory_order_relaxed);
+  c.occupancy = occupancy.load(std::memory_order_relaxed);
+
+  int64_t ns = degradedNs.load(std::memory_order_relaxed);
+  int64_t since = activeSinceNs.load(std::memory_order_relaxed);
+  c.active = since != 0;
+  if(since)
+    ns += ToNs(std::chrono::steady_clock::now()) - since;
+  c.degradedTime = ns/1e9;
+  return c;
+}
@@ -0,0 +1,108 @@
+#include "BinaryWriter.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+BinaryWriter::BinaryWriter(const std::string& path, size_t bufferSize) {
+  fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if(fd < 0){
+    fprintf(stderr, "BinaryWriter: cannot open %s: %s\n", path.c_str(), strerror(errno));
+    return;
+  }
+  for(auto& b: buffers)
+    b.storage.resize(bufferSize);
+  uint32_t header[2] = {kMagic, kVersion};
+  memcpy(buffers[active].storage.data(), header, sizeof(header));
+  buffers[active].used = sizeof(header);
+  thread = std::thread(&BinaryWriter::WriterThread, this);
+}
+
+BinaryWriter::~BinaryWriter() {
+  Close();
+}
+
+void* BinaryWriter::Reserve(uint32_t event, uint16_t channel, uint16_t width, uint32_t frames, uint32_t nbytes) {
+  size_t size = sizeof(RecordHeader) + nbytes;
+  if(buffers[active].used && buffers[active].used + size > buffers[active].storage.size())
+    Swap();
+
+  Buffer& buffer = buffers[active];
+  if(size > buffer.storage.size())
+    buffer.storage.resize(size);
+  lastRecord = buffer.used;
+  buffer.used += size;
+  RecordHeader* header = (RecordHeader*)&buffer.storage[lastRecord];
+  header->nbytes = nbytes;
+  header->event = event;
+  header->channel = channel;
+  header->width = width;
+  header->frames = frames;
+  return header + 1;
+}
+
+void BinaryWriter::Discard() {
+  buffers[active].used = lastRecord;
+}
+
+void BinaryWriter::Write(uint32_t event, uint16_t channel, uint16_t width, uint32_t frames, const void* data, uint32_t nbytes) {
+  memcpy(Reserve(event, channel, width, frames, nbytes), data, nbytes);
+}
+
+//hands the active buffer to the thread, waiting for it to finish the other one
+void BinaryWriter::Swap() {
+  std::unique_lock<std::mutex> lock(mutex);
+  if(pending){
+    waits++;
+    cv.wait(lock, [this]{ return !pending; });
+  }
+  active ^= 1;
+  buffers[active].used = 0;
+  pending = true;
+  cv.notify_all();
+}
+
+void BinaryWriter::Close() {
+  if(fd < 0)
+    return;
+  if(buffers[active].used)
+    Swap();
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [this]{ return !pending; });
+    stop = true;
+    cv.notify_all();
+  }
+  thread.join();
+  close(fd);
+  fd = -1;
+}
+
+void BinaryWriter::WriterThread() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while(true){
+    cv.wait(lock, [this]{ return pending || stop; });
+    if(!pending)
+      return;
+
+    //the buffer the caller is not filling
+    Buffer& buffer = buffers[active ^ 1];
+    lock.unlock();
+    size_t done = 0;
+    while(done < buffer.used){
+      ssize_t n = write(fd, buffer.storage.data() + done, buffer.used - done);
+      if(n < 0){
+        if(errno == EINTR)
+          continue;
+        fprintf(stderr, "BinaryWriter: write failed: %s, dropping %zu bytes\n", strerror(errno), buffer.used - done);
+        break;
+      }
+      done += n;
+    }
+    bytes += done;
+    lock.lock();
+    pending = false;
+    cv.notify_all();
+  }
+}
@@ -0,0 +1,189 @@
+#include "HugePages.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <new>
+
+static long ThreadMinorFaults() {
+  struct rusage usage;
+  if(getrusage(RUSAGE_THREAD, &usage))
+    return 0;
+  return usage.ru_minflt;
+}
+
+HugePageBuffer::HugePageBuffer(size_t size, bool huge) {
+  this->size = (size + kHugePageSize - 1) / kHugePageSize * kHugePageSize;
+  if(!this->size)
+    return;
+
+  if(huge){
+    data = mmap(nullptr, this->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if(data != MAP_FAILED){
+      mode = Mode::HugeTLB;
+    } else {
+      fallback = std::string("hugetlbfs: ") + strerror(errno);
+      data = nullptr;
+    }
+  }
+
+  if(!data){
+    //one extra huge page to align the start, THP only maps aligned 2 MB ranges
+    size_t mapped = this->size + (huge ? kHugePageSize : 0);
+    char* p = (char*)mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(p == MAP_FAILED)
+      throw std::bad_alloc();
+    char* aligned = p;
+    if(huge){
+      aligned = (char*)(((uintptr_t)p + kHugePageSize - 1) & ~(uintptr_t)(kHugePageSize - 1));
+      if(aligned > p)
+        munmap(p, aligned - p);
+      if(aligned + this->size < p + mapped)
+        munmap(aligned + this->size, p + mapped - aligned - this->size);
+    }
+    data = aligned;
+    mode = Mode::Normal;
+    if(huge){
+      if(madvise(data, this->size, MADV_HUGEPAGE) == 0)
+        mode = Mode::Transparent;
+      else
+        fallback += std::string(", THP: ") + strerror(errno);
+    }
+  }
+
+}
+
+void HugePageBuffer::Prefault() {
+  //so the readout never takes the faults. A THP range may still be split into 4 kB pages if
+  //the kernel has no free huge page at hand; the fault count shows that.
+  long before = ThreadMinorFaults();
+  for(size_t offset=0; offset<size; offset+=4096)
+    ((volatile char*)data)[offset] = 0;
+  prefaults = ThreadMinorFaults() - before;
+}
+
+HugePageBuffer::~HugePageBuffer() {
+  if(data)
+    munmap(data, size);
+}
+
+HugePageBuffer::HugePageBuffer(HugePageBuffer&& other) noexcept {
+  *this = std::move(other);
+}
+
+HugePageBuffer& HugePageBuffer::operator=(HugePageBuffer&& other) noexcept {
+  if(this != &other){
+    if(data)
+      munmap(data, size);
+    data = other.data;
+    size = other.size;
+    mode = other.mode;
+    prefaults = other.prefaults;
+    fallback = std::move(other.fallback);
+    other.data = nullptr;
+    other.size = 0;
+    other.mode = Mode::None;
+  }
+  return *this;
+}
+
+const char* HugePageBuffer::ModeName(Mode mode) {
+  switch(mode){
+  case Mode::HugeTLB: return "2 MB huge pages (hugetlbfs)";
+  case Mode::Transparent: return "transparent huge pages";
+  case Mode::Normal: return "4 kB pages";
+  default: return "none";
+  }
+}
+
+std::string HugePageBuffer::Describe() const {
+  std::string text = std::to_string(size >> 20) + " MB in " + ModeName(mode) + ", "
+                     + std::to_string(prefaults) + " faults to prefault";
+  if(mode != Mode::HugeTLB && !fallback.empty())
+    text += " (" + fallback + ")";
+  return text;
+}
+
+BlockPool::BlockPool(size_t blockSize, size_t count, bool huge) {
+  //cache line aligned blocks
+  this->blockSize = (blockSize + 63) & ~(size_t)63;
+  buffer = HugePageBuffer(this->blockSize * count, huge);
+  free.reserve(count);
+  for(size_t i=count; i>0; i--)
+    free.push_back((char*)buffer.Data() + (i-1) * this->blockSize);
+}
+
+void* BlockPool::Get() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if(!free.empty()){
+      void* block = free.back();
+      free.pop_back();
+      return block;
+    }
+  }
+  return ::operator new(blockSize);
+}
+
+void BlockPool::Put(void* block) {
+  char* begin = (char*)buffer.Data();
+  if(block >= begin && block < begin + buffer.Size()){
+    std::lock_guard<std::mutex> lock(mutex);
+    free.push_back(block);
+  } else {
+    ::operator delete(block);
+  }
+}
+
+PageFaultMonitor::~PageFaultMonitor() {
+  if(perfFd >= 0)
+    close(perfFd);
+}
+
+void PageFaultMonitor::Attach() {
+  tid = syscall(SYS_gettid);
+  if(perfFd >= 0)
+    close(perfFd);
+
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HW_CACHE;
+  attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_TOTAL_TIME_RUNNING;
+  perfFd = syscall(SYS_perf_event_open, &attr, tid, -1, -1, 0);
+}
+
+PageFaultMonitor::Counters PageFaultMonitor::Read() const {
+  Counters c;
+  if(!tid)
+    return c;
+
+  //fields 10 and 12 of stat, after the command name in parentheses
+  char path[64], buff[1024];
+  snprintf(path, sizeof(path), "/proc/self/task/%d/stat", tid);
+  FILE* f = fopen(path, "r");
+  if(f){
+    size_t n = fread(buff, 1, sizeof(buff)-1, f);
+    fclose(f);
+    buff[n] = 0;
+    char* p = strrchr(buff, ')');
+    long long minflt, majflt;
+    if(p && sscanf(p+1, " %*c %*d %*d %*d %*d %*d %*u %lld %*u %lld", &minflt, &majflt) == 2){
+      c.minorFaults = minflt;
+      c.majorFaults = majflt;
+    }
+  }
+
+  //a counter that never ran has no hardware behind it, e.g. in a VM without a virtual PMU
+  uint64_t values[2];
+  if(perfFd >= 0 && read(perfFd, values, sizeof(values)) == sizeof(values) && values[1])
+    c.tlbMisses = values[0];
+  return c;
+}
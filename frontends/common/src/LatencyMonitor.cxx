@@ -0,0 +1,55 @@
+#include "LatencyMonitor.h"
+
+LatencyMonitor::LatencyMonitor(const std::vector<std::string>& stages): stages(stages),
+  previous(stages.size(), std::vector<uint64_t>(LatencyHistogram::kBins, 0)), lastUpdate(std::chrono::steady_clock::now()) {
+}
+
+LatencyRecorder& LatencyMonitor::AddThread() {
+  std::lock_guard<std::mutex> lock(mutex);
+  recorders.emplace_back(new LatencyRecorder(stages.size()));
+  return *recorders.back();
+}
+
+std::vector<LatencyMonitor::Summary> LatencyMonitor::Update() {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto now = std::chrono::steady_clock::now();
+  double elapsed = std::chrono::duration<double>(now - lastUpdate).count();
+  lastUpdate = now;
+
+  std::vector<Summary> summary(stages.size());
+  std::vector<uint64_t> delta(LatencyHistogram::kBins);
+  for(size_t s=0; s<stages.size(); s++){
+    Summary& sum = summary[s];
+    sum.stage = stages[s];
+    sum.count = 0;
+    sum.rate = sum.p50 = sum.p90 = sum.p99 = sum.max = 0;
+
+    //interval histogram = current cumulative counts - counts at the last update
+    for(int b=0; b<LatencyHistogram::kBins; b++){
+      uint64_t total = 0;
+      for(auto& rec: recorders)
+        total += rec->Get(s).Get(b);
+      delta[b] = total - previous[s][b];
+      previous[s][b] = total;
+      sum.count += delta[b];
+    }
+    if(!sum.count)
+      continue;
+
+    sum.rate = elapsed > 0 ? sum.count/elapsed : 0;
+    double* quantile[3] = {&sum.p50, &sum.p90, &sum.p99};
+    uint64_t threshold[3] = {(sum.count+1)/2, (sum.count*9+9)/10, (sum.count*99+99)/100};
+    uint64_t seen = 0;
+    int q = 0;
+    for(int b=0; b<LatencyHistogram::kBins; b++){
+      if(!delta[b])
+        continue;
+      seen += delta[b];
+      while(q < 3 && seen >= threshold[q])
+        *quantile[q++] = LatencyHistogram::BinCenter(b)/1000.;
+      sum.max = LatencyHistogram::BinCenter(b)/1000.;
+    }
+  }
+
+  return summary;
+}
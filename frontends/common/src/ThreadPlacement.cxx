@@ -0,0 +1,165 @@
+#include "ThreadPlacement.h"
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <set>
+#include <sstream>
+
+ThreadPlacement& ThreadPlacement::Get() {
+  static ThreadPlacement placement;
+  return placement;
+}
+
+ThreadPlacement::ThreadPlacement() {
+  if(sched_getaffinity(0, sizeof(processCpus), &processCpus))
+    CPU_ZERO(&processCpus);
+}
+
+bool ThreadPlacement::ParseCpuList(const std::string& list, cpu_set_t& set) {
+  CPU_ZERO(&set);
+  std::stringstream ss(list);
+  std::string item;
+  bool any = false;
+  while(std::getline(ss, item, ',')){
+    if(item.find_first_not_of(" \t") == std::string::npos)
+      continue;
+    char* end;
+    long first = strtol(item.c_str(), &end, 10);
+    long last = first;
+    if(*end == '-')
+      last = strtol(end+1, &end, 10);
+    while(*end == ' ')
+      end++;
+    if(*end || first < 0 || last < first || last >= CPU_SETSIZE)
+      return false;
+    for(long cpu=first; cpu<=last; cpu++)
+      CPU_SET(cpu, &set);
+    any = true;
+  }
+  return any;
+}
+
+int ThreadPlacement::CpuNode(int cpu) {
+  std::string path = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+  DIR* dir = opendir(path.c_str());
+  if(!dir)
+    return -1;
+  int node = -1;
+  while(struct dirent* entry = readdir(dir)){
+    if(strncmp(entry->d_name, "node", 4) == 0 && entry->d_name[4] >= '0' && entry->d_name[4] <= '9'){
+      node = atoi(entry->d_name + 4);
+      break;
+    }
+  }
+  closedir(dir);
+  return node;
+}
+
+void ThreadPlacement::Apply(Entry& entry, const Config& config) {
+  entry.error.clear();
+
+  cpu_set_t set = processCpus;
+  if(!config.cpus.empty() && !ParseCpuList(config.cpus, set)){
+    entry.error += "bad CPU list \"" + config.cpus + "\"; ";
+    set = processCpus;
+  }
+  int ret = pthread_setaffinity_np(entry.thread, sizeof(set), &set);
+  if(ret)
+    entry.error += std::string("affinity: ") + strerror(ret) + "; ";
+
+  struct sched_param param;
+  memset(&param, 0, sizeof(param));
+  int policy = SCHED_OTHER;
+  if(config.priority > 0){
+    policy = SCHED_FIFO;
+    param.sched_priority = config.priority;
+  }
+  ret = pthread_setschedparam(entry.thread, policy, &param);
+  if(ret)
+    entry.error += std::string("SCHED_FIFO: ") + strerror(ret) + " (needs CAP_SYS_NICE or rtprio limit); ";
+}
+
+void ThreadPlacement::Register(const std::string& role) {
+  std::lock_guard<std::mutex> lock(mutex);
+  Entry entry;
+  entry.role = role;
+  entry.thread = pthread_self();
+  entry.tid = syscall(SYS_gettid);
+  threads.push_back(entry);
+  Apply(threads.back(), configs[role]);
+}
+
+void ThreadPlacement::Unregister() {
+  std::lock_guard<std::mutex> lock(mutex);
+  pthread_t self = pthread_self();
+  for(auto it=threads.begin(); it!=threads.end(); ++it){
+    if(pthread_equal(it->thread, self)){
+      threads.erase(it);
+      break;
+    }
+  }
+}
+
+void ThreadPlacement::Configure(const std::string& role, const std::string& cpus, int priority) {
+  std::lock_guard<std::mutex> lock(mutex);
+  Config& config = configs[role];
+  config.cpus = cpus;
+  config.priority = priority;
+  for(auto& entry: threads){
+    if(entry.role == role)
+      Apply(entry, config);
+  }
+}
+
+std::vector<std::string> ThreadPlacement::Report() {
+  std::lock_guard<std::mutex> lock(mutex);
+  std::vector<std::string> lines;
+  for(auto& entry: threads){
+    std::string line = entry.role + " thread " + std::to_string(entry.tid) + ": CPUs ";
+
+    cpu_set_t set;
+    if(pthread_getaffinity_np(entry.thread, sizeof(set), &set) == 0){
+      //compact list and NUMA nodes
+      std::set<int> nodes;
+      int first = -1;
+      bool comma = false;
+      for(int cpu=0; cpu<=CPU_SETSIZE; cpu++){
+        bool in = cpu < CPU_SETSIZE && CPU_ISSET(cpu, &set);
+        if(in){
+          nodes.insert(CpuNode(cpu));
+          if(first < 0)
+            first = cpu;
+        } else if(first >= 0){
+          line += (comma ? "," : "") + std::to_string(first);
+          if(cpu-1 > first)
+            line += "-" + std::to_string(cpu-1);
+          comma = true;
+          first = -1;
+        }
+      }
+      line += " (NUMA node";
+      for(int node: nodes)
+        line += " " + (node >= 0 ? std::to_string(node) : std::string("?"));
+      line += ")";
+    } else {
+      line += "unknown";
+    }
+
+    int policy;
+    struct sched_param param;
+    if(pthread_getschedparam(entry.thread, &policy, &param) == 0){
+      if(policy == SCHED_FIFO)
+        line += ", SCHED_FIFO " + std::to_string(param.sched_priority);
+      else
+        line += ", SCHED_OTHER";
+    }
+
+    if(!entry.error.empty())
+      line += ", errors: " + entry.error.substr(0, entry.error.size()-2);
+    lines.push_back(line);
+  }
+  return lines;
+}
@@ -0,0 +1,128 @@
+#include "Tracer.h"
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+
+Tracer& Tracer::Get() {
+  static Tracer tracer;
+  return tracer;
+}
+
+Tracer::~Tracer() {
+  runDumpThread = false;
+  if(dumpThread.joinable())
+    dumpThread.join();
+}
+
+void Tracer::Enable(bool on) {
+  enabled = on;
+  if(on && !runDumpThread.exchange(true))
+    dumpThread = std::thread(&Tracer::DumpThreadFunction, this);
+}
+
+void Tracer::SetDirectory(const std::string& dir) {
+  std::lock_guard<std::mutex> lock(mutex);
+  directory = dir.empty() ? "." : dir;
+}
+
+Tracer::ThreadBuffer& Tracer::Local() {
+  static thread_local ThreadBuffer* local = nullptr;
+  if(!local){
+    std::lock_guard<std::mutex> lock(mutex);
+    threads.emplace_back(new ThreadBuffer);
+    local = threads.back().get();
+    local->tid = syscall(SYS_gettid);
+    local->name = "thread " + std::to_string(local->tid);
+  }
+  return *local;
+}
+
+void Tracer::SetThreadName(const std::string& name) {
+  ThreadBuffer& buffer = Local();
+  std::lock_guard<std::mutex> lock(mutex);
+  buffer.name = name;
+}
+
+void Tracer::Record(const char* name, uint64_t start, uint64_t duration, uint64_t arg) {
+  ThreadBuffer& buffer = Local();
+  uint64_t head = buffer.head.load(std::memory_order_relaxed);
+  Span& span = buffer.spans[head & (kCapacity-1)];
+  span.start = start;
+  span.duration = duration;
+  span.name = name;
+  span.arg = arg;
+  buffer.head.store(head+1, std::memory_order_release);
+}
+
+void Tracer::DumpThreadFunction() {
+  while(runDumpThread){
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    const char* name = pending.load();
+    if(!name)
+      continue;
+
+    //the dump happens up to 100 ms after the slow span, so it also shows what followed
+    Dump(std::string("slow ") + name + " (" + std::to_string(pendingDuration.load()/1000000.) + " ms)");
+
+    //at most one automatic dump every 10 s
+    for(int i=0; i<100 && runDumpThread; i++)
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    pending = nullptr;
+  }
+}
+
+std::string Tracer::Dump(const std::string& reason) {
+  std::lock_guard<std::mutex> lock(mutex);
+
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  char date[32];
+  strftime(date, sizeof(date), "%Y%m%d_%H%M%S", localtime(&tv.tv_sec));
+  char msec[8];
+  snprintf(msec, sizeof(msec), "%03d", (int)(tv.tv_usec/1000));
+  std::string filename = directory + "/trace_" + date + "_" + msec + ".json";
+
+  FILE* f = fopen(filename.c_str(), "w");
+  if(!f){
+    printf("Tracer: cannot write %s\n", filename.c_str());
+    return "";
+  }
+
+  int pid = getpid();
+  fprintf(f, "{\"otherData\":{\"reason\":\"%s\"},\n\"traceEvents\":[\n", reason.c_str());
+  fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"frontend %d\"}}", pid, pid);
+
+  std::vector<Span> copy;
+  size_t nspans = 0;
+  for(auto& buffer: threads){
+    fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}", pid, buffer->tid, buffer->name.c_str());
+
+    //the owner keeps writing: copy, then drop what it may have overwritten meanwhile
+    uint64_t head = buffer->head.load(std::memory_order_acquire);
+    uint64_t first = head > kCapacity ? head - kCapacity : 0;
+    copy.clear();
+    for(uint64_t i=first; i<head; i++)
+      copy.push_back(buffer->spans[i & (kCapacity-1)]);
+    uint64_t after = buffer->head.load(std::memory_order_acquire);
+    uint64_t valid = after > kCapacity ? after - kCapacity : 0;
+
+    for(uint64_t i=(valid > first ? valid - first : 0); i<copy.size(); i++){
+      const Span& span = copy[i];
+      if(span.duration)
+        fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d", span.name, span.start/1000., span.duration/1000., pid, buffer->tid);
+      else
+        fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d", span.name, span.start/1000., pid, buffer->tid);
+      if(span.arg)
+        fprintf(f, ",\"args\":{\"value\":%lu}", (unsigned long)span.arg);
+      fprintf(f, "}");
+      nspans++;
+    }
+  }
+  fprintf(f, "\n]}\n");
+  fclose(f);
+
+  printf("Tracer: %zu spans written to %s (%s)\n", nspans, filename.c_str(), reason.c_str());
+  return filename;
+}
@@ -0,0 +1,54 @@
+#include "WaveformFeatures.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+
+//16 samples per step, interleaving zeros below each byte. The step is loaded before it is stored,
+//which is what makes the in place case safe: the stores never reach the bytes not yet loaded.
+static uint32_t WidenSamplesSSE2(const uint8_t* in, uint16_t* out, uint32_t n) {
+  const __m128i zero = _mm_setzero_si128();
+  uint32_t i = 0;
+  for(; i + 16 <= n; i += 16){
+    __m128i v = _mm_loadu_si128((const __m128i*)(in + i));
+    _mm_storeu_si128((__m128i*)(out + i), _mm_unpacklo_epi8(zero, v));
+    _mm_storeu_si128((__m128i*)(out + i + 8), _mm_unpackhi_epi8(zero, v));
+  }
+  return i;
+}
+#endif
+
+void ExtractFeatures(uint16_t channel, const uint16_t* samples, uint32_t n, int32_t out[kFeatureWords]) {
+  uint32_t nbase = n < 16 ? n : 16;
+  int64_t base = 0;
+  for(uint32_t i=0; i<nbase; i++)
+    base += samples[i];
+  base = nbase ? base/nbase : 0;
+
+  uint32_t imin = 0, imax = 0;
+  int64_t sum = 0;
+  for(uint32_t i=0; i<n; i++){
+    if(samples[i] < samples[imin]) imin = i;
+    if(samples[i] > samples[imax]) imax = i;
+    sum += samples[i];
+  }
+
+  out[0] = channel;
+  out[1] = n;
+  out[2] = base;
+  out[3] = n ? samples[imin] : 0;
+  out[4] = imin;
+  out[5] = n ? samples[imax] : 0;
+  out[6] = imax;
+  int64_t integral = base*n - sum;
+  out[7] = integral > INT32_MAX ? INT32_MAX : (integral < INT32_MIN ? INT32_MIN : integral);
+}
+
+void WidenSamples(const uint8_t* in, uint16_t* out, uint32_t n) {
+  uint32_t i = 0;
+#if defined(__x86_64__)
+  //SSE2 is part of x86-64, no dispatch needed
+  i = WidenSamplesSSE2(in, out, n);
+#endif
+  for(; i<n; i++)
+    out[i] = (uint16_t)in[i] << 8;
+}
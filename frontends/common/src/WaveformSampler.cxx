@@ -0,0 +1,123 @@
+#include "WaveformSampler.h"
+#include <cstring>
+#include <ctime>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+
+//8 samples per step, min and max of each bin with a horizontal reduction at the end
+__attribute__((target("sse4.1")))
+static void MinMaxDecimateSSE41(const uint16_t* in, uint32_t n, uint16_t* out, uint32_t npoints) {
+  const __m128i ones = _mm_set1_epi16(-1);
+  for(uint32_t p=0; p<npoints; p++){
+    //bins differ by at most one sample, with npoints > n samples are repeated
+    uint32_t first = (uint64_t)p*n/npoints;
+    uint32_t last = (uint64_t)(p+1)*n/npoints;
+    if(last <= first)
+      last = first+1;
+
+    uint32_t i = first;
+    __m128i vmin = _mm_set1_epi16(-1);
+    __m128i vmax = _mm_setzero_si128();
+    for(; i + 8 <= last; i += 8){
+      __m128i v = _mm_loadu_si128((const __m128i*)(in + i));
+      vmin = _mm_min_epu16(vmin, v);
+      vmax = _mm_max_epu16(vmax, v);
+    }
+    //minpos gives the horizontal minimum, the maximum is the minimum of the complement
+    uint16_t min = _mm_extract_epi16(_mm_minpos_epu16(vmin), 0);
+    uint16_t max = ~_mm_extract_epi16(_mm_minpos_epu16(_mm_xor_si128(vmax, ones)), 0);
+    for(; i < last; i++){
+      min = in[i] < min ? in[i] : min;
+      max = in[i] > max ? in[i] : max;
+    }
+    out[2*p] = min;
+    out[2*p+1] = max;
+  }
+}
+#endif
+
+static void MinMaxDecimateScalar(const uint16_t* in, uint32_t n, uint16_t* out, uint32_t npoints) {
+  for(uint32_t p=0; p<npoints; p++){
+    uint32_t first = (uint64_t)p*n/npoints;
+    uint32_t last = (uint64_t)(p+1)*n/npoints;
+    if(last <= first)
+      last = first+1;
+    uint16_t min = 0xFFFF, max = 0;
+    for(uint32_t i=first; i<last; i++){
+      min = in[i] < min ? in[i] : min;
+      max = in[i] > max ? in[i] : max;
+    }
+    out[2*p] = min;
+    out[2*p+1] = max;
+  }
+}
+
+void MinMaxDecimate(const uint16_t* in, uint32_t n, uint16_t* out, uint32_t npoints) {
+  if(n == 0 || npoints == 0)
+    return;
+#if defined(__x86_64__)
+  static const bool hasSSE41 = __builtin_cpu_supports("sse4.1");
+  if(hasSSE41){
+    MinMaxDecimateSSE41(in, n, out, npoints);
+    return;
+  }
+#endif
+  MinMaxDecimateScalar(in, n, out, npoints);
+}
+
+WaveformSampler::WaveformSampler(double rate, uint32_t points): npoints(points) {
+  SetRate(rate);
+}
+
+void WaveformSampler::SetRate(double rate) {
+  if(rate > 0)
+    period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1./rate));
+  else
+    period = std::chrono::steady_clock::duration::zero();
+}
+
+void WaveformSampler::Begin() {
+  back.resize(16);
+  uint32_t* header = (uint32_t*)back.data();
+  header[0] = kMagic;
+  header[1] = 0;
+  header[2] = time(nullptr);
+  header[3] = 0;
+}
+
+void WaveformSampler::AddWaveform(uint16_t board, uint16_t channel, const uint16_t* samples, uint32_t nsamples) {
+  uint32_t points = nsamples < npoints ? nsamples : npoints;
+  size_t offset = back.size();
+  back.resize(offset + 12 + 4*points);
+
+  char* ptr = back.data() + offset;
+  memcpy(ptr, &board, 2);
+  memcpy(ptr+2, &channel, 2);
+  memcpy(ptr+4, &nsamples, 4);
+  memcpy(ptr+8, &points, 4);
+  MinMaxDecimate(samples, nsamples, (uint16_t*)(ptr+12), points);
+
+  ((uint32_t*)back.data())[3]++;
+}
+
+void WaveformSampler::Publish(uint32_t serial) {
+  ((uint32_t*)back.data())[1] = serial;
+
+  //never wait for the display
+  std::unique_lock<std::mutex> lock(frontMutex, std::try_to_lock);
+  if(!lock.owns_lock()){
+    dropped++;
+    return;
+  }
+  front.swap(back);
+  sampled++;
+}
+
+int WaveformSampler::CopySnapshot(char* dst, int maxsize) {
+  std::lock_guard<std::mutex> lock(frontMutex);
+  if(front.empty() || (int)front.size() > maxsize)
+    return 0;
+  memcpy(dst, front.data(), front.size());
+  return front.size();
+}
@@ -1,4 +1,9 @@
 #include <string>
+#include <vector>
+#include <chrono>
+#include <mutex>
+#include <atomic>
+#include "LatencyMonitor.h"
 
 #ifndef TEK_H
 #define TEK_H
@@ -7,7 +12,7 @@
 
 class tek {
 protected:
-   int sockfd;
+   int sockfd = -1;
    volatile int state;
    volatile bool receivingData;
    bool fChannelEnabled[TEK_NCHANNEL];
@@ -19,16 +24,108 @@ protected:
    float fHorizontalPosition;
    float fHorizontalSampleRate;
    std::string fAcquisitionMode;
+   int fRecordLength = 0;
+   //FastFrame: frames per acquisition, all sent in one CURVE block per channel. 1 is off.
+   int fFastFrames = 1;
+   //bytes per sample of the CURVE data, DAT:WID. 1 sends the 8 most significant bits.
+   int fSampleWidth = 2;
+   //per frame of the last ReadData, ps since midnight of the scope clock, 0 if unknown (push mode)
+   std::vector<uint64_t> fFrameTimes;
+   std::string FrameTimesQuery();
+   void ParseFrameTimes(const std::string &reply);
+   double fQueryTime = 0; //ms, last QueryState round trip
+   //pull mode: *OPC? after each single sequence arm, the scope replies when the acquisition is
+   //complete and HasEvent waits for that reply instead of polling BUSY?
+   bool fOpcCompletion = true;
+   //set by the readout thread, read by Stop once that thread is idle
+   std::atomic<bool> fOpcPending{false};
+   //with *OPC?, CURV? goes out with the arm behind a *WAI and the curve follows the reply
+   std::atomic<bool> fCurvePending{false};
+   void Arm();
+
+   //pull mode: a record longer than fChunkPoints is read in DAT:STAR/DAT:STOP windows, one per
+   //ReadData. The CURV? of the next window goes out before the current one is read.
+   int fChunkPoints = 0; //0 reads the whole record
+   int fChunks = 1; //windows per acquisition, set by Start
+   int fChunk = 0; //the window the next ReadData reads
+   void QueueWindow(int chunk);
+
+   //pull mode cycle: live from arm to acquisition complete, dead from complete to the next arm
+   std::chrono::steady_clock::time_point fStartTime, fArmTime, fCompleteTime;
+   bool fArmed = false;
+   bool fCompleted = false; //since Start, for the dead time of the next arm
+   std::atomic<uint64_t> fAcquisitions{0};
+   std::atomic<uint64_t> fLiveNs{0};
+   std::atomic<uint64_t> fDeadNs{0};
+   std::atomic<uint64_t> fCurveBytes{0}; //of the curve blocks
+   void Completed();
+   std::chrono::steady_clock::time_point fEventTime; //HasEvent found the last event
    int fEventNumber = 0;
    const bool fPushMode;
 
+   //optional latency of the socket reads in ReadData, only one in kSocketSampling calls is timed
+   static const int kSocketSampling = 16;
+   LatencyRecorder* fSocketLatency = nullptr;
+   int fSocketStage = 0;
+   unsigned fSocketCalls = 0;
+
+   //non-blocking socket, one epoll instance per direction so that the readout thread waiting
+   //for data and the main thread sending a command do not wake each other up
+   typedef std::chrono::steady_clock::time_point Deadline;
+   static const int kSocketBufferSize = 4 * 1024 * 1024; //SO_RCVBUF, capped by net.core.rmem_max
+   int fEpollIn = -1;
+   int fEpollOut = -1;
+   int fTimeout = 1000; //ms, a read or write without progress for this long fails
+   Deadline After(int ms) { return std::chrono::steady_clock::now() + std::chrono::milliseconds(ms); };
+   bool WaitSocket(int epfd, Deadline deadline);
+
+   //receive buffer, block headers, footers and query replies are parsed from here.
+   //Data is only buffered when it is needed byte by byte, large reads go straight to the caller.
+   static const int kRxBufferSize = 65536;
+   std::vector<char> fRxBuffer;
+   int fRxHead = 0;
+   int fRxTail = 0;
+   int RecvSocket(void* buffer, int n, Deadline deadline); //-1 on timeout, error or closed connection
+   int FillRxBuffer(); //only when the buffer is empty
+   int GetByte(){ //-1 on timeout
+      if(fRxHead == fRxTail && FillRxBuffer() <= 0)
+         return -1;
+      return (unsigned char)fRxBuffer[fRxHead++];
+   };
+   bool WaitReadable(int timeout_ms);
+   std::string ReadLine();
+
+   //commands are queued and go out in one write with the next Flush, WriteCmd or ReadCmd
+   std::mutex fTxMutex;
+   std::string fTxBuffer;
+   void QueueCmd(const std::string &cmd);
+   bool Flush();
+
+   //optional second connection to the socket server. The settings are queried and the run is
+   //stopped over it while the data connection streams, see Connect.
+   int fControlFd = -1;
+   std::mutex fControlMutex;
+   std::string fControlRx;
+   std::string ControlCmd(const std::string &cmd); //waits for the reply of a query, "" on timeout
+   std::string Query(const std::string &cmd); //over the control connection if there is one
+   std::string fIdentity; //*IDN? reply, marks the end of the stale data in Resync
+   //last Stop: from the call until the scope is idle, bytes of data thrown away on the way
+   double fStopTime = 0; //ms
+   int fStopDiscarded = 0;
+   bool fAcquisitionStopped = false;
+   std::chrono::steady_clock::time_point fStopStart;
+   void StopStream();
+   int Resync();
+
    std::string ReadCmd(const std::string &cmd);
-   int CharArrayToInt(char* array, int n);
+   //all queries in one message and one reply, one value per query without the newline.
+   //Falls back to one round trip per query if the reply does not split into as many values.
+   std::vector<std::string> ReadCmds(const std::vector<std::string> &queries);
    void WriteCmd(const std::string &cmd);
    void SendClear();
    void WaitOperationComplete();
-   void QueryState();
-   void EmptySocket();
+   void QueryState(bool identify = false); //identify prints *IDN? as well
+   int EmptySocket(); //bytes consumed
    int ReadFromSocket(void* buffer, int n);
    virtual bool ConsumeChannel(int npt, int id);
    virtual void BeginOfRun(){};
@@ -37,16 +134,58 @@ protected:
 public:
 
    tek(bool pushMode = false);
-   void Connect(const std::string &ip, int port);
+   void Connect(const std::string &ip, int port, bool control = false);
+   bool HasControl() { return fControlFd >= 0; };
+   void SetTimeout(int ms) { fTimeout = ms; };
+   void SetFastFrames(int n) { fFastFrames = n > 1 ? n : 1; };
+   int GetFastFrames() { return fFastFrames; };
+   void SetSampleWidth(int bytes) { fSampleWidth = bytes == 1 ? 1 : 2; };
+   int GetSampleWidth() { return fSampleWidth; };
+   void SetOpcCompletion(bool opc) { fOpcCompletion = opc; };
+   void SetChunkPoints(int n) { fChunkPoints = n > 0 ? n : 0; };
+   int GetChunkPoints() { return fChunkPoints; };
+   int GetRecordLength() { return fRecordLength; };
+
+   //the window of the record read by the last ReadData
+   struct Chunk {
+      int acquisition = 0;
+      int index = 0;
+      int count = 1; //windows of the acquisition, 1 if the record was read whole
+      int first = 0; //point of the record, from 0
+      int points = 0;
+   };
+   const Chunk& GetChunk() { return fLastChunk; };
+
+   struct AcquisitionStats {
+      uint64_t acquisitions = 0; //pull mode, one per arm
+      uint64_t triggers = 0; //acquisitions x FastFrame count
+      double seconds = 0; //since Start
+      double live = 0; //s, armed and waiting for triggers
+      double dead = 0; //s, from acquisition complete to the next arm
+      uint64_t bytes = 0; //curve data read
+      double TriggerRate() const { return seconds > 0 ? triggers/seconds : 0; };
+      double Throughput() const { return seconds > 0 ? bytes/seconds : 0; }; //bytes/s
+      double DeadFraction() const { return live + dead > 0 ? dead/(live + dead) : 0; };
+   };
+   AcquisitionStats GetAcquisitionStats();
+   double GetStopTime() { return fStopTime; };
+   int GetStopDiscarded() { return fStopDiscarded; };
    bool IsStreaming();
    bool IsReceivingData();
    bool IsBusy();
    void Start();
+   void StopAcquisition();
    void Stop();
    virtual void Configure();
    bool HasEvent();
+   //ns of the steady clock, when HasEvent found the event that ReadData reads
+   uint64_t GetEventTime() { return std::chrono::duration_cast<std::chrono::nanoseconds>(fEventTime.time_since_epoch()).count(); };
    bool ReadData(); 
    bool IsPushMode() { return fPushMode; };
+   void SetSocketLatency(LatencyRecorder* recorder, int stage) { fSocketLatency = recorder; fSocketStage = stage; };
+
+protected:
+   Chunk fLastChunk;
 };
 
 #endif
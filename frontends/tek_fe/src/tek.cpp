@@ -1,37 +1,80 @@
 #include "tek.h"
+#include "Tracer.h"
 #include <stdexcept>
 #include <arpa/inet.h> // inet_addr()
 #include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h> // TCP_NODELAY
 #include <sys/socket.h>
-#include <sys/select.h>
+#include <sys/epoll.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <strings.h> // bzero()
+#include <string.h> // memcpy()
 #include <unistd.h> // read(), write(), close()
 #include <iostream>
 #include <sstream>
 #include <thread> //std::this_thread::yield()
 
-tek::tek(bool pushMode): fPushMode(pushMode){
+tek::tek(bool pushMode): fPushMode(pushMode), fRxBuffer(kRxBufferSize){
    state = 0;
    receivingData = false;
 }
 
 void tek::WriteCmd(const std::string &cmd){
+   TraceScope trace("WriteCmd");
    //std::cout << cmd << std::endl;
-   int n = write(sockfd, cmd.c_str(), cmd.length());
-   //std::cout << n << std::endl;
-   if(cmd.back() != '\n'){
-      write(sockfd, "\n", 1);
+   QueueCmd(cmd);
+   Flush();
+}
+
+void tek::QueueCmd(const std::string &cmd){
+   std::lock_guard<std::mutex> lock(fTxMutex);
+   fTxBuffer += cmd;
+   if(cmd.empty() || cmd.back() != '\n')
+      fTxBuffer += '\n';
+}
+
+bool tek::Flush(){
+   std::lock_guard<std::mutex> lock(fTxMutex);
+   size_t done = 0;
+   Deadline deadline = After(fTimeout);
+   while(done < fTxBuffer.size()){
+      int n = write(sockfd, fTxBuffer.data() + done, fTxBuffer.size() - done);
+      if(n > 0){
+         done += n;
+         deadline = After(fTimeout);
+      } else if(n < 0 && errno == EINTR){
+         continue;
+      } else if(n < 0 && errno == EAGAIN && WaitSocket(fEpollOut, deadline)){
+         continue;
+      } else {
+         std::cout << "write failed, dropping " << fTxBuffer.size() - done << " bytes of commands" << std::endl;
+         break;
+      }
+   }
+   bool ok = done == fTxBuffer.size();
+   fTxBuffer.clear();
+   return ok;
+}
+
+bool tek::WaitSocket(int epfd, Deadline deadline){
+   struct epoll_event event;
+   while(true){
+      auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+      if(left < 0)
+         return false;
+      //rounded up, a wait of 0 ms would only poll
+      int ret = epoll_wait(epfd, &event, 1, left + 1);
+      if(ret > 0)
+         return true;
+      if(ret == 0 || errno != EINTR)
+         return false;
    }
 }
 
 std::string tek::ReadCmd(const std::string &cmd){
-   char buff[1000];
-   
-   //wait max 1 s
-   fd_set fds;
-   struct timeval tv;
-   tv.tv_sec=1;
-   tv.tv_usec=0;
+   TraceScope trace("ReadCmd");
 
    WriteCmd(cmd);
 
@@ -39,22 +82,112 @@ std::string tek::ReadCmd(const std::string &cmd){
    if (cmd.find('?') == std::string::npos)
       return "";
 
-   FD_ZERO(&fds);
-   FD_SET(sockfd, &fds);
-   int ret = select(sockfd+1, &fds, 0, 0, &tv);
-   if(ret < 0){
+   if(!WaitReadable(fTimeout))
       return "";
-   } else if (ret > 0){
-      int n = ReadFromSocket(buff, sizeof(buff));
-      while(buff[n-1]!='\n') n += ReadFromSocket(buff+n, sizeof(buff)-n);
 
-      if (n>0) 
-         return std::string(buff, n);
-      else
+   return ReadLine();
+}
+
+bool tek::WaitReadable(int timeout_ms){
+   if(fRxHead != fRxTail)
+      return true;
+   return WaitSocket(fEpollIn, After(timeout_ms));
+}
+
+//up to and including the newline, the line so far on timeout
+std::string tek::ReadLine(){
+   std::string line;
+   int c;
+   do{
+      c = GetByte();
+      if(c >= 0)
+         line += (char)c;
+   } while(c >= 0 && c != '\n');
+   return line;
+}
+
+std::vector<std::string> tek::ReadCmds(const std::vector<std::string> &queries){
+   TraceScope trace("ReadCmds");
+   trace.SetArg(queries.size());
+
+   //queries joined with ";:", the leading colon resets the header path. Common commands have none.
+   std::string cmd;
+   for(auto query: queries){
+      if(!query.empty() && query.back() == '\n')
+         query.pop_back();
+      if(!cmd.empty())
+         cmd += ";";
+      if(query.front() != '*' && query.front() != ':')
+         cmd += ":";
+      cmd += query;
+   }
+
+   std::vector<std::string> values;
+   std::string reply = Query(cmd);
+   if(!reply.empty() && reply.back() == '\n')
+      reply.pop_back();
+   std::istringstream stream(reply);
+   std::string value;
+   while(getline(stream, value, ';'))
+      values.push_back(value);
+
+   if(values.size() != queries.size()){
+      std::cout << "batched query returned " << values.size() << " of " << queries.size() << " values, querying one by one" << std::endl;
+      values.clear();
+      for(const auto& query: queries){
+         value = Query(query);
+         if(!value.empty() && value.back() == '\n')
+            value.pop_back();
+         values.push_back(value);
+      }
+   }
+   return values;
+}
+
+std::string tek::Query(const std::string &cmd){
+   if(fControlFd >= 0)
+      return ControlCmd(cmd);
+   return ReadCmd(cmd);
+}
+
+//blocking, the socket timeouts are set in Connect. The data connection is not touched.
+std::string tek::ControlCmd(const std::string &cmd){
+   TraceScope trace("ControlCmd");
+   std::lock_guard<std::mutex> lock(fControlMutex);
+   std::string msg = cmd;
+   if(msg.empty() || msg.back() != '\n')
+      msg += '\n';
+   size_t done = 0;
+   while(done < msg.size()){
+      int n = write(fControlFd, msg.data() + done, msg.size() - done);
+      if(n < 0 && errno == EINTR)
+         continue;
+      if(n <= 0){
+         std::cout << "write failed on the control connection" << std::endl;
          return "";
-    } else {
+      }
+      done += n;
+   }
+
+   //command is not a query
+   if(cmd.find('?') == std::string::npos)
       return "";
-   } 
+
+   size_t end;
+   while((end = fControlRx.find('\n')) == std::string::npos){
+      char buff[4096];
+      int n = read(fControlFd, buff, sizeof(buff));
+      if(n < 0 && errno == EINTR)
+         continue;
+      if(n <= 0){
+         std::cout << "no reply on the control connection to " << msg;
+         return "";
+      }
+      fControlRx.append(buff, n);
+   }
+   std::string line = fControlRx.substr(0, end + 1);
+   fControlRx.erase(0, end + 1);
+   return line;
 }
 
 void tek::SendClear(){
@@ -71,7 +204,7 @@ void tek::WaitOperationComplete(){
    std::cout << "operation completed " << ret << std::endl;
 }
 
-void tek::QueryState(){
+void tek::QueryState(bool identify){
    //check enabled channels
    /*std::string enabledChannels = ReadCmd("DAT:SOU?\n");
    for(int i=0; i< TEK_NCHANNEL; i++) fChannelEnabled[i] = false;
@@ -84,30 +217,61 @@ void tek::QueryState(){
       }
    }*/
 
+   //all in one round trip
+   auto start = std::chrono::steady_clock::now();
+   std::vector<std::string> queries;
+   if(identify)
+      queries.push_back("*IDN?");
+   for(int i=0; i< TEK_NCHANNEL; i++){
+      std::string ch = "CH"+std::to_string(i+1);
+      queries.push_back("DIS:GLO:"+ch+":STATE?");
+      queries.push_back(ch+":POS?");
+      queries.push_back(ch+":OFFS?");
+      queries.push_back(ch+":SCA?");
+      queries.push_back(ch+":BAN?");
+   }
+   queries.push_back("HOR:POS?");
+   queries.push_back("HOR:SCA?");
+   queries.push_back("HOR:SAMPLER?");
+   queries.push_back("ACQ:MODE?");
+   queries.push_back("HOR:MOD:RECO?");
+   std::vector<std::string> values = ReadCmds(queries);
+   fQueryTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+   int k = 0;
+   if(identify){
+      fIdentity = values[k++];
+      std::cout << fIdentity << std::endl;
+   }
+
    //get vertical 
    for(int i=0; i< TEK_NCHANNEL; i++){
-      std::string enabled = ReadCmd("DIS:GLO:CH"+std::to_string(i+1)+":STATE?\n");
+      std::string enabled = values[k++];
       if(enabled.front()=='1'){
          fChannelEnabled[i] = true;
       } else {
          fChannelEnabled[i] = false;
       }
-      fChannelPosition[i] = std::stof(ReadCmd("CH"+std::to_string(i+1)+":POS?\n"));
-      fChannelOffset[i] = std::stof(ReadCmd("CH"+std::to_string(i+1)+":OFFS?\n"));
-      fChannelScale[i] = std::stof(ReadCmd("CH"+std::to_string(i+1)+":SCA?\n"));
-      fChannelBandwidth[i] = std::stof(ReadCmd("CH"+std::to_string(i+1)+":BAN?\n"));
+      fChannelPosition[i] = std::stof(values[k++]);
+      fChannelOffset[i] = std::stof(values[k++]);
+      fChannelScale[i] = std::stof(values[k++]);
+      fChannelBandwidth[i] = std::stof(values[k++]);
    }
-   fHorizontalPosition = std::stof(ReadCmd("HOR:POS?\n"));
-   fHorizontalScale = std::stof(ReadCmd("HOR:SCA?\n"));
-   fHorizontalSampleRate = std::stof(ReadCmd("HOR:SAMPLER?\n"));
-   fAcquisitionMode = ReadCmd("ACQ:MODE?\n").substr(0,5);
+   fHorizontalPosition = std::stof(values[k++]);
+   fHorizontalScale = std::stof(values[k++]);
+   fHorizontalSampleRate = std::stof(values[k++]);
+   fAcquisitionMode = values[k++].substr(0,5);
+   fRecordLength = std::stod(values[k++]);
+
+   std::cout << "Queried " << queries.size() << " values in " << fQueryTime << " ms" << std::endl;
 }
 
-void tek::Connect(const std::string &ip, int port){
-   struct sockaddr_in servaddr, cli;
+//TCP connection to the socket server, rcvbuf 0 keeps the default receive buffer
+static int OpenSocket(const std::string &ip, int port, int rcvbuf){
+   struct sockaddr_in servaddr;
 
-   sockfd = socket(AF_INET, SOCK_STREAM, 0);
-   if (sockfd == -1) {
+   int fd = socket(AF_INET, SOCK_STREAM, 0);
+   if (fd == -1) {
       throw std::runtime_error("socket creation failed...");
    }
 
@@ -118,13 +282,58 @@ void tek::Connect(const std::string &ip, int port){
    servaddr.sin_addr.s_addr = inet_addr(ip.c_str());
    servaddr.sin_port = htons(port);
 
-   if (connect(sockfd, (struct sockaddr*)&servaddr, sizeof(servaddr)) != 0) {
+   //small commands go out immediately, the receive window has to cover a few ms of a 1 Gb/s link.
+   //Both before connect, the window scaling is negotiated in the handshake.
+   int one = 1;
+   setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+   if(rcvbuf)
+      setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+   if (connect(fd, (struct sockaddr*)&servaddr, sizeof(servaddr)) != 0) {
+      close(fd);
       throw std::runtime_error("connection failed...");
    }
+   return fd;
+}
 
-   std::cout << ReadCmd("*IDN?");
-   WriteCmd("*CLS\n");
-   QueryState();
+void tek::Connect(const std::string &ip, int port, bool control){
+   sockfd = OpenSocket(ip, port, kSocketBufferSize);
+
+   int rcvbuf;
+   socklen_t len = sizeof(rcvbuf);
+   getsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, &len);
+   std::cout << "Socket receive buffer " << rcvbuf/1024 << " kB" << std::endl;
+
+   fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) | O_NONBLOCK);
+   fEpollIn = epoll_create1(EPOLL_CLOEXEC);
+   fEpollOut = epoll_create1(EPOLL_CLOEXEC);
+   if (fEpollIn < 0 || fEpollOut < 0) {
+      throw std::runtime_error("epoll creation failed...");
+   }
+   struct epoll_event event;
+   event.data.fd = sockfd;
+   event.events = EPOLLIN;
+   epoll_ctl(fEpollIn, EPOLL_CTL_ADD, sockfd, &event);
+   event.events = EPOLLOUT;
+   epoll_ctl(fEpollOut, EPOLL_CTL_ADD, sockfd, &event);
+
+   //the run goes on without one if the socket server takes a single client
+   if(control){
+      try{
+         fControlFd = OpenSocket(ip, port, 0);
+         struct timeval timeout = {fTimeout/1000, (fTimeout%1000)*1000};
+         setsockopt(fControlFd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+         setsockopt(fControlFd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+         std::cout << "Control connection open" << std::endl;
+      } catch(std::runtime_error &ex){
+         std::cout << "no control connection, " << ex.what() << std::endl;
+      }
+   }
+
+   QueueCmd("*CLS\n");
+   if(fControlFd >= 0)
+      Flush();
+   QueryState(true);
 }
 
 bool tek::IsStreaming(){
@@ -136,47 +345,72 @@ bool tek::IsReceivingData(){
 }
 
 bool tek::IsBusy(){
-   char buff[2];
-   buff[0]=0;
-   buff[1]=0;
-   
-   WriteCmd("BUSY?\n");
+   std::string busy = ReadCmd("BUSY?\n");
+   while(busy.empty())
+      busy = ReadLine();
 
-   int n = ReadFromSocket(buff, sizeof(buff));
-   while(n <= 0) ReadFromSocket(buff, sizeof(buff));
-
-   if(buff[0]== '0')
+   if(busy.front()== '0')
       return false;
    else
       return true;
 }
 
 void tek::Start(){
-   Configure();
+   TraceScope trace("Start");
+   //Configure uses the state, its commands go out with the ones below
    QueryState();
+   Configure();
    BeginOfRun();
 
    std::cout << "Starting... ";
-   WriteCmd("DATA:ENC RPB\n");
-   WriteCmd("DIS:WAVE OFF\n");
-   WriteCmd("DAT:WID 2\n");
-   WriteCmd("WFMO:BYT_O LSB\n");
+   QueueCmd("DATA:ENC RPB\n");
+   QueueCmd("DIS:WAVE OFF\n");
+   QueueCmd("DAT:WID " + std::to_string(fSampleWidth) + "\n");
+   QueueCmd("WFMO:BYT_O LSB\n");
+   if(fFastFrames > 1){
+      QueueCmd("HOR:FAST:STATE ON\n");
+      QueueCmd("HOR:FAST:COUN " + std::to_string(fFastFrames) + "\n");
+      QueueCmd("DAT:FRAMESTAR 1\n");
+      QueueCmd("DAT:FRAMESTOP " + std::to_string(fFastFrames) + "\n");
+   } else {
+      QueueCmd("HOR:FAST:STATE OFF\n");
+   }
+   fFrameTimes.assign(fFastFrames, 0);
+   //CURVESTREAM? sends whole records, windows are read in pull mode only
+   fChunks = 1;
+   fChunk = 0;
+   if(!fPushMode && fChunkPoints > 0 && fChunkPoints < fRecordLength){
+      if(fFastFrames > 1)
+         std::cout << "FastFrame records are read whole" << std::endl;
+      else
+         fChunks = (fRecordLength + fChunkPoints - 1) / fChunkPoints;
+   }
+   fCurveBytes = 0;
+   fStartTime = std::chrono::steady_clock::now();
+   fArmed = fCompleted = fCurvePending = fAcquisitionStopped = false;
+   fAcquisitions = fLiveNs = fDeadNs = 0;
    if(fPushMode){
-      WriteCmd("ACQ:STATE RUN\n");
-      WriteCmd("CURVES?\n");
+      QueueCmd("ACQ:STATE RUN\n");
+      QueueCmd("CURVES?\n");
    } else {
-      WriteCmd("ACQ:STATE STOP\n");
-      WriteCmd("ACQ:STOPA SEQUENCE\n");
-      WriteCmd("ACQ:STATE RUN\n");
-
+      QueueCmd("ACQ:STATE STOP\n");
+      QueueCmd("ACQ:STOPA SEQUENCE\n");
+      Arm();
    }
+   Flush();
    std::cout << "DONE!"<< std::endl;
    state = 1;
 }
 
 void tek::Stop(){
+   TraceScope trace("Stop");
    std::cout << "Stopping... ";
-   if(fPushMode){
+   if(!fAcquisitionStopped)
+      fStopStart = std::chrono::steady_clock::now();
+   fStopDiscarded = 0;
+   if(fControlFd >= 0){
+      StopStream();
+   } else if(fPushMode){
       state = 0;
       SendClear();
 
@@ -188,7 +422,7 @@ void tek::Stop(){
       }
       printf("Other thread stopped\n");
 
-      EmptySocket();
+      fStopDiscarded = EmptySocket();
 
       WaitOperationComplete();
 
@@ -197,79 +431,264 @@ void tek::Stop(){
          ReadData();
       }*/
       
-      WriteCmd("ACQ:STATE STOP\n");
+      QueueCmd("ACQ:STATE STOP\n");
    } else {
       state = 0;
-      WriteCmd("ACQ:STATE STOP\n");
+      //wait for other thread to receive state, the flags are final once it is idle
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      while(IsReceivingData()){
+         std::this_thread::yield();
+      }
+      if(fOpcPending || fCurvePending){
+         //the acquisition may never complete, the device clear drops the pending *OPC? and CURV?
+         SendClear();
+         fStopDiscarded = EmptySocket();
+         fOpcPending = fCurvePending = false;
+      }
+      QueueCmd("ACQ:STATE STOP\n");
    }
-   WriteCmd("DIS:WAVE ON\n");
-   std::cout << "DONE!"<< std::endl;
+   if(fControlFd >= 0)
+      ControlCmd("DIS:WAVE ON\n");
+   else
+      WriteCmd("DIS:WAVE ON\n");
+   fStopTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - fStopStart).count();
+   std::cout << "DONE in " << fStopTime << " ms, " << fStopDiscarded << " bytes discarded" << std::endl;
 
    EndOfRun();
 }
 
+//Stop with the control connection: the acquisition is stopped first, the data connection
+//carries on until what was acquired before the stop has been read, no curve is cut off
+void tek::StopStream(){
+   if(fPushMode){
+      StopAcquisition();
+      //the readout thread reads the curves in flight, done when 20 ms pass without one
+      Deadline deadline = After(fTimeout);
+      int events;
+      do{
+         events = fEventNumber;
+         std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      } while((events != fEventNumber || IsReceivingData()) && std::chrono::steady_clock::now() < deadline);
+      state = 0;
+   } else {
+      //an acquisition still waiting for triggers would be cut short by the stop, it is not read
+      state = 0;
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      ControlCmd("ACQ:STATE STOP;*OPC?\n");
+   }
+   while(IsReceivingData()){
+      std::this_thread::yield();
+   }
+
+   //leaves CURVESTREAM and drops a pending *OPC? and CURV?, one round trip if nothing is in flight
+   if(fPushMode || fOpcPending || fCurvePending){
+      SendClear();
+      fStopDiscarded = Resync();
+   }
+   fOpcPending = fCurvePending = false;
+}
+
+//push mode with the control connection: no new acquisitions, the curves acquired before are still
+//read with HasEvent and ReadData. For a caller without a readout thread, Stop calls it otherwise.
+void tek::StopAcquisition(){
+   if(fControlFd < 0 || !fPushMode || fAcquisitionStopped)
+      return;
+   fStopStart = std::chrono::steady_clock::now();
+   ControlCmd("ACQ:STATE STOP;*OPC?\n");
+   fAcquisitionStopped = true;
+}
+
+//after a device clear, everything before the reply to *IDN? was sent before the clear
+int tek::Resync(){
+   WriteCmd("*IDN?\n");
+   int discarded = 0;
+   while(true){
+      std::string line = ReadLine();
+      //timeout
+      if(line.empty() || line.back() != '\n')
+         return discarded + line.size();
+      if(line.size() == fIdentity.size() + 1 && line.compare(0, fIdentity.size(), fIdentity) == 0)
+         return discarded;
+      discarded += line.size();
+   }
+}
+
 void tek::Configure(){
 }
 
 bool tek::HasEvent(){
 
    if(fPushMode){
+      if(!IsStreaming())
+         return false;
+      TraceScope trace("HasEvent");
       //wait max 0.01 s
-      fd_set fds;
-      struct timeval tv;
-      tv.tv_sec=0;
-      tv.tv_usec=10000;
-      FD_ZERO(&fds);
-      FD_SET(sockfd, &fds);
-      int ret = select(sockfd+1, &fds, 0, 0, &tv);
-      if(ret > 0){
+      if(WaitReadable(10)){
+         fEventTime = std::chrono::steady_clock::now();
          return true;
       } else {
+         trace.Discard();
+         return false;
+      }
+   } else if(fChunk > 0){
+      //the rest of the record of the last acquisition
+      return IsStreaming();
+   } else if(fOpcCompletion){
+      if(!IsStreaming())
          return false;
+      //re-arm if the last ReadData failed or was skipped, otherwise it has armed already
+      if(!fOpcPending){
+         if(fCurvePending){
+            EmptySocket();
+            fCurvePending = false;
+         }
+         Arm();
+         Flush();
       }
+      TraceScope trace("HasEvent");
+      receivingData = true;
+      bool complete = false;
+      //wait max 0.01 s for the *OPC? of Arm
+      if(WaitReadable(10)){
+         std::string reply = ReadLine();
+         fOpcPending = false;
+         complete = !reply.empty() && reply.front() == '1';
+         if(complete)
+            Completed();
+         else
+            std::cout << "unexpected reply to *OPC?: " << reply << std::endl;
+      } else {
+         trace.Discard();
+      }
+      receivingData = false;
+      return complete;
    } else {
       if(IsBusy()){
          return false;
       } else {
+         Completed();
     return true;
       }
    }
 }
 
-void tek::EmptySocket(){
-   char* buff[1000];
+//single sequence acquisition in pull mode, queued
+void tek::Arm(){
+   QueueCmd("ACQ:STATE RUN\n");
+   if(fOpcCompletion){
+      //*WAI holds CURV? until the acquisition is complete, the transfer starts without a round trip
+      QueueCmd("*OPC?\n");
+      QueueCmd("*WAI\n");
+      if(fChunks > 1)
+         QueueWindow(0);
+      QueueCmd("CURV?\n");
+      fOpcPending = true;
+      fCurvePending = true;
+   }
+   auto now = std::chrono::steady_clock::now();
+   if(fCompleted)
+      fDeadNs += std::chrono::duration_cast<std::chrono::nanoseconds>(now - fCompleteTime).count();
+   fArmTime = now;
+   fArmed = true;
+}
+
+//points chunk*fChunkPoints + 1 to the end of the window or of the record, DAT:STAR counts from 1
+void tek::QueueWindow(int chunk){
+   int first = chunk*fChunkPoints + 1;
+   int last = first + fChunkPoints - 1;
+   QueueCmd("DAT:STAR " + std::to_string(first) + "\n");
+   QueueCmd("DAT:STOP " + std::to_string(last < fRecordLength ? last : fRecordLength) + "\n");
+}
+
+void tek::Completed(){
+   fEventTime = std::chrono::steady_clock::now();
+   if(!fArmed)
+      return;
+   fCompleteTime = fEventTime;
+   fLiveNs += std::chrono::duration_cast<std::chrono::nanoseconds>(fCompleteTime - fArmTime).count();
+   fAcquisitions++;
+   fArmed = false;
+   fCompleted = true;
+}
+
+tek::AcquisitionStats tek::GetAcquisitionStats(){
+   AcquisitionStats stats;
+   stats.acquisitions = fAcquisitions;
+   stats.triggers = stats.acquisitions * fFastFrames;
+   stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - fStartTime).count();
+   stats.live = fLiveNs * 1e-9;
+   stats.dead = fDeadNs * 1e-9;
+   stats.bytes = fCurveBytes;
+   return stats;
+}
+
+int tek::EmptySocket(){
    int n=0;
-   int total=0;
+   int total=fRxTail-fRxHead;
+   fRxHead = fRxTail = 0;
+   //until the scope has been quiet for fTimeout
    do{
-      n = ReadFromSocket(buff, sizeof(buff));
+      n = RecvSocket(fRxBuffer.data(), kRxBufferSize, After(fTimeout));
       if (n>0) total += n;
    } while (n>=0);
 
    printf("consumed %d bytes\n", total);
+   return total;
 }
 
 int tek::ReadFromSocket(void* buffer, int n){
-   fd_set fds;
-   struct timeval tv;
-   tv.tv_sec=1;
-   tv.tv_usec=0;
-   FD_ZERO(&fds);
-   FD_SET(sockfd, &fds);
-   int ret = select(sockfd+1, &fds, 0, 0, &tv);
-   if(ret > 0){
-      return read(sockfd, buffer, n);
-   } else {
-      return -1;
+   if(fRxHead == fRxTail){
+      //payload, no need to go through the buffer
+      if(n >= kRxBufferSize/4)
+         return RecvSocket(buffer, n, After(fTimeout));
+      int ret = FillRxBuffer();
+      if(ret <= 0)
+         return ret;
    }
+
+   int size = fRxTail - fRxHead;
+   if(size > n)
+      size = n;
+   memcpy(buffer, &fRxBuffer[fRxHead], size);
+   fRxHead += size;
+   return size;
+}
+
+int tek::FillRxBuffer(){
+   fRxHead = fRxTail = 0;
+   int n = RecvSocket(fRxBuffer.data(), kRxBufferSize, After(fTimeout));
+   if(n > 0)
+      fRxTail = n;
+   return n;
 }
 
-int tek::CharArrayToInt(char* array, int n){
-   int base = 1;
-   int ret = 0;
-   for (int i=n-1; i>=0; i--){
-      ret += (array[i]-'0')*base;
-      base *= 10;
+int tek::RecvSocket(void* buffer, int n, Deadline deadline){
+   //the small reads are cheap, timing all of them would cost more than 1%
+   uint64_t start = 0;
+   if(fSocketLatency && receivingData && (++fSocketCalls % kSocketSampling) == 0)
+      start = LatencyRecorder::Now();
+
+   //try first, the data is usually there already
+   int ret;
+   while(true){
+      ret = read(sockfd, buffer, n);
+      if(ret > 0)
+         break;
+      if(ret == 0){
+         std::cout << "connection closed by the scope" << std::endl;
+         ret = -1;
+         break;
+      }
+      if(errno == EINTR)
+         continue;
+      if(errno != EAGAIN || !WaitSocket(fEpollIn, deadline)){
+         ret = -1;
+         break;
+      }
    }
+
+   if(start)
+      fSocketLatency->Add(fSocketStage, LatencyRecorder::Now() - start, kSocketSampling);
    return ret;
 }
 
@@ -288,10 +707,50 @@ bool tek::ConsumeChannel(int npt, int id){
    return true;
 }
 
+//"02 Mar 2024 20:10:54.542 037 272 620" per frame, comma separated
+std::string tek::FrameTimesQuery(){
+   int source = 0;
+   while(source < TEK_NCHANNEL-1 && !fChannelEnabled[source])
+      source++;
+   return "HOR:FAST:TIMES:ALL:CH" + std::to_string(source+1) + "? 1," + std::to_string(fFastFrames) + "\n";
+}
+
+void tek::ParseFrameTimes(const std::string &reply){
+   TraceScope trace("ParseFrameTimes");
+   fFrameTimes.assign(fFastFrames, 0);
+   std::istringstream stream(reply);
+   std::string stamp;
+   for(int i=0; i<fFastFrames && getline(stream, stamp, ','); i++){
+      size_t colon = stamp.find(':');
+      if(colon == std::string::npos || colon < 2 || stamp.size() < colon + 7)
+         continue;
+      const char* p = stamp.c_str() + colon - 2;
+      uint64_t seconds = ((p[0]-'0')*10 + (p[1]-'0'))*3600 + ((p[3]-'0')*10 + (p[4]-'0'))*60 + (p[6]-'0')*10 + (p[7]-'0');
+      //fraction in up to 12 digits, grouped by spaces
+      uint64_t ps = 0;
+      int ndigits = 0;
+      for(p += 9; *p && ndigits < 12; p++){
+         if(*p >= '0' && *p <= '9'){
+            ps = ps*10 + (*p-'0');
+            ndigits++;
+         } else if(*p != ' ') {
+            break;
+         }
+      }
+      for(; ndigits < 12; ndigits++)
+         ps *= 10;
+      fFrameTimes[i] = seconds*1000000000000ull + ps;
+   }
+}
+
 bool tek::ReadData(){
-   char buff[80];
+   TraceScope trace("tek::ReadData", true);
+   trace.SetArg(fEventNumber);
    int iChannelBlk=0;
    bool gotFooter=false;
+   //a failed read starts over with the next acquisition
+   int chunk = fChunk;
+   fChunk = 0;
 
    receivingData = true;
    //if pull mode, fetch data
@@ -305,15 +764,21 @@ bool tek::ReadData(){
          channels = ReadCmd("DAT:SOU:AVAIL?\n");
          std::cout << "Available: "<< channels;
       }*/
-      WriteCmd("CURV?\n");
-      fd_set fds;
-      struct timeval tv;
-      tv.tv_sec=0;
-      tv.tv_usec=100000;
-      FD_ZERO(&fds);
-      FD_SET(sockfd, &fds);
-      int ret = select(sockfd+1, &fds, 0, 0, &tv);
-      if(ret <= 0){
+      if(fCurvePending){
+         fCurvePending = false; //requested by Arm or with the last window, the curve follows
+      } else {
+         if(fChunks > 1)
+            QueueWindow(chunk);
+         QueueCmd("CURV?\n");
+      }
+      //the next window goes out now, its transfer follows this one without a round trip
+      if(chunk + 1 < fChunks){
+         QueueWindow(chunk + 1);
+         QueueCmd("CURV?\n");
+         fCurvePending = true;
+      }
+      Flush();
+      if(!WaitReadable(100)){
          std::cout << "No data received" << std::endl;
          std::cout << ReadCmd("*ESR?\n");
          std::cout << ReadCmd("ALLEV?\n");
@@ -323,51 +788,79 @@ bool tek::ReadData(){
    }
 
    while(!gotFooter){
-      int n = ReadFromSocket(buff, 1);
+      //definite length block: #<number of digits><length><payload>
+      int c = GetByte();
 
       //consume until header
-      while(n>0 && buff[0] != '#'){
-         n = ReadFromSocket(buff, 1);
+      while(c >= 0 && c != '#'){
+         c = GetByte();
       }
       //std::cout << "Header found" << std::endl;
 
-      n = ReadFromSocket(buff, 1);
-      if(buff[0] < '0' || buff[0] > '9') {
+      int digits = GetByte();
+      if(digits < '0' || digits > '9') {
          receivingData = false;
          return false;
       }
-      n = ReadFromSocket(buff, buff[0]-'0');
-
-      int npt = CharArrayToInt(buff, n);
+      int npt = 0;
+      for(int i=0; i<digits-'0'; i++){
+         c = GetByte();
+         if(c < '0' || c > '9') {
+            receivingData = false;
+            return false;
+         }
+         npt = npt*10 + (c-'0');
+      }
       //printf("got event with %d bytes\n", npt);
 
       if (! ConsumeChannel(npt, iChannelBlk)){
          receivingData = false;
          return false;
       }
+      fCurveBytes += npt;
       //std::cout << "Read channel " << iChannelBlk << std::endl;
 
       //read footer
-      n = ReadFromSocket(buff, 1);
-      if(n == 1 && buff[0]==10){
+      c = GetByte();
+      if(c == '\n'){
          //std::cout << "Got Last Channel "<< iChannelBlk << std::endl;
          gotFooter = true;
-      } else if (n==1 && buff[0] == ';'){
+      } else if (c == ';'){
          //std::cout << "Got Channel "<< iChannelBlk << std::endl;
          iChannelBlk ++; 
       } else {
-         printf("bad footer, got %d with val %d\n", n, buff[0]);
+         printf("bad footer, got %d\n", c);
          receivingData = false;
          return false;
       }
    }
 
    //std::cout << "Event done" << std::endl;
+   fLastChunk.acquisition = fEventNumber;
+   fLastChunk.index = chunk;
+   fLastChunk.count = fChunks;
+   fLastChunk.first = chunk*fChunkPoints;
+   fLastChunk.points = fChunks > 1 && fRecordLength - fLastChunk.first > fChunkPoints ? fChunkPoints : fRecordLength - fLastChunk.first;
+   if(chunk + 1 < fChunks){
+      fChunk = chunk + 1;
+      receivingData = false;
+      return true;
+   }
    fEventNumber++;
 
-   //if pull mode, arm trigger
-   if(!fPushMode)
-      WriteCmd("ACQ:STATE RUN\n");
+   //if pull mode, re-arm as soon as the curve is in. The frame times query goes out first so that
+   //the next acquisition does not replace them.
+   if(!fPushMode){
+      if(fFastFrames > 1)
+         QueueCmd(FrameTimesQuery());
+      //not once Stop has begun
+      if(IsStreaming())
+         Arm();
+      Flush();
+      //the scope is acquiring again while the reply is parsed and the event is submitted
+      if(fFastFrames > 1)
+         ParseFrameTimes(ReadLine());
+   }
 
    receivingData = false;
    return true;
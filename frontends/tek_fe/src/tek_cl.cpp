@@ -1,17 +1,27 @@
 #include "tek.h"
+#include "BinaryWriter.h"
 #include <iostream>
 #include <fstream>
 #include <chrono>
+#include <memory>
+#include <stdlib.h> // atoi()
 #include <unistd.h> // read(), write(), close()
 #include <sys/poll.h> //poll()
 
 class tek_file: public tek {
    std::ofstream fOutputStream;
+   std::vector<unsigned short> fSamples;
+   std::string fLine;
+   //binary mode, the socket is read straight into the writer buffer
+   std::unique_ptr<BinaryWriter> fWriter;
 
 public:
-   tek_file(std::string output = "test.txt", bool pushMode = false): tek(pushMode){
-      fOutputStream.open(output, std::ofstream::out);
-      std::cout << "opened file "<< output <<std::endl;
+   tek_file(std::string output = "test.txt", bool pushMode = false, bool binary = false): tek(pushMode){
+      if(binary)
+         fWriter.reset(new BinaryWriter(output));
+      else
+         fOutputStream.open(output, std::ofstream::out);
+      std::cout << "opened "<< (binary ? "binary " : "") << "file " << output <<std::endl;
       if(IsPushMode())
 	  std::cout << "Push Mode" << std::endl;
       else
@@ -24,19 +34,14 @@ public:
 
    void Configure(){
       //set transmit window to full recordlenght
-      WriteCmd("DAT:STAR 1\n");
-      std::string points = ReadCmd("HOR:MOD:RECO?\n");
-      WriteCmd("DAT:STOP "+ points + "\n");
-
-      //set 8 bit
-      //WriteCmd("DAT:WID 1\n");
+      QueueCmd("DAT:STAR 1\n");
+      QueueCmd("DAT:STOP "+ std::to_string(fRecordLength) + "\n");
 
       //send all enabled channels
       /*std::string channels = ReadCmd("DAT:SOU:AVAIL?\n");*/
       std::string channels = "";
       for(int i=0; i< TEK_NCHANNEL; i++){
-	 std::string enabled = ReadCmd("DIS:GLO:CH"+std::to_string(i+1)+":STATE?\n");
-	 if(enabled.front()=='1'){
+	 if(fChannelEnabled[i]){
 		if(channels.length())
 			channels += ",";
 		 channels += "CH"+std::to_string(i+1);
@@ -44,47 +49,92 @@ public:
       }
       channels += '\n';
       //std::cout << "Enabled Channels: " << channels;
-      WriteCmd("DAT:SOU " + channels + "\n");
+      QueueCmd("DAT:SOU " + channels + "\n");
       
       if(IsPushMode()){
-          WriteCmd("!t 300000\n");
+          QueueCmd("!t 300000\n");
       } else {
-          WriteCmd("!t 10000\n");
+          QueueCmd("!t 10000\n");
       }
    }
 
    void BeginOfRun(){
+      //the settings go to the terminal in binary mode
+      std::ostream& out = fWriter ? std::cout : fOutputStream;
       for(int i=0; i<TEK_NCHANNEL; i++){
          if(fChannelEnabled[i]){
-            fOutputStream << "# Channel " << i << ": Position=" << fChannelPosition[i] << " Offset=" << fChannelOffset[i] << " Scale=" << fChannelScale[i] << std::endl; 
+            out << "# Channel " << i << ": Position=" << fChannelPosition[i] << " Offset=" << fChannelOffset[i] << " Scale=" << fChannelScale[i] << std::endl; 
          }
       }
 
-      fOutputStream << "# Horizontal: Position=" << fHorizontalPosition << " Scale=" << fHorizontalScale << " SampleRate="<< fHorizontalSampleRate << std::endl; 
+      out << "# Horizontal: Position=" << fHorizontalPosition << " Scale=" << fHorizontalScale << " SampleRate="<< fHorizontalSampleRate << std::endl; 
+      out << "# Sample Width: " << 8*GetSampleWidth() << " bit" << std::endl;
 
    }
 
+   void EndOfRun(){
+      if(fWriter){
+         fWriter->Close();
+         std::cout << "wrote " << fWriter->GetBytes() << " bytes, waited " << fWriter->GetWaits() << " times for the disk" << std::endl;
+      }
+      fOutputStream.flush();
+   }
+
    bool ConsumeChannel(int npt, int id){
       //std::cout << "Consuming channel " << id << ", " << npt << " points" << std::endl;
-      unsigned short buff[10000];
-      if (npt > 10000*sizeof(unsigned short)){
-         std::cout << "Channel cannot fit in buffer!" << std::endl;
-	 return false;
+      if(fWriter){
+         char* p = (char*)fWriter->Reserve(fEventNumber, id, GetSampleWidth(), fFastFrames, npt);
+         int nbyte = 0;
+         while(nbyte < npt){
+            int n = ReadFromSocket(p + nbyte, npt-nbyte);
+            if (n < 0){
+               fWriter->Discard();
+               return false;
+            }
+            nbyte += n;
+         }
+         return true;
       }
 
+      fSamples.resize(npt/sizeof(unsigned short) + 1);
+      const unsigned char* bytes = (const unsigned char*)fSamples.data();
+
       int nbyte = 0;
-      fOutputStream << fEventNumber << ", " << id;
       while(nbyte < npt){
-         int size = (sizeof(buff)>(npt-nbyte))?(npt-nbyte):sizeof(buff);
-         int n = ReadFromSocket((char*)buff + nbyte, size);
+         int n = ReadFromSocket((char*)fSamples.data() + nbyte, npt-nbyte);
 	 if (n < 0) return false;
          nbyte += n;
       }
-      for(int i=0; i<npt/sizeof(unsigned short); i++){
-	      fOutputStream << ", " << buff[i];
-      }
 
-      fOutputStream << std::endl;
+      //formatted by hand, the stream operators are slower than the link.
+      //One line per trigger, with FastFrame the first column counts frames. With -k one line per
+      //window of the record, in order.
+      int nsamples = npt/GetSampleWidth();
+      int frameSize = nsamples/fFastFrames;
+      if(frameSize == 0)
+         frameSize = nsamples ? nsamples : 1;
+      fLine.resize(32*fFastFrames + nsamples*(GetSampleWidth() == 1 ? 5 : 7));
+      char* p = &fLine[0];
+      for(int i=0; i<nsamples; i++){
+         if(i % frameSize == 0){
+            if(i)
+               *p++ = '\n';
+            p += snprintf(p, 32, "%d, %d", fEventNumber*fFastFrames + i/frameSize, id);
+         }
+         char digits[5];
+         int nd = 0;
+         unsigned value = GetSampleWidth() == 1 ? bytes[i] : fSamples[i];
+         do{
+            digits[nd++] = '0' + value%10;
+            value /= 10;
+         } while(value);
+         *p++ = ',';
+         *p++ = ' ';
+         while(nd)
+            *p++ = digits[--nd];
+      }
+      *p++ = '\n';
+      fOutputStream.write(fLine.data(), p - fLine.data());
       return true;
 
    };
@@ -94,54 +144,119 @@ public:
 int main(int argc, char** argv){
    bool pushMode = true;
    std::string outfile = "test.txt";
+   int frames = 1;
+   int width = 2;
+   std::string address = "192.168.50.25";
+   int port = 4000;
+   bool binary = false;
+   bool opc = true;
+   bool control = false;
+   int chunk = 0;
+
+   //-a and -p to run against another scope or tek_emu
+   int opt;
+   while((opt = getopt(argc, argv, "a:p:k:bqc")) != -1){
+      if(opt == 'b')
+         binary = true;
+      else if(opt == 'c')
+         control = true;
+      else if(opt == 'q')
+         opc = false;
+      else if(opt == 'a')
+         address = optarg;
+      else if(opt == 'p')
+         port = atoi(optarg);
+      else if(opt == 'k')
+         chunk = atoi(optarg);
+      else
+         argc = -1;
+   }
+   int nargs = argc - optind;
+   char** args = argv + optind;
 
-   if(argc == 2)
-      outfile = argv[1];
-   else if (argc == 3) {
-      outfile = argv[1];
-      if(argv[2][0] == '0'){
+   if(nargs == 1)
+      outfile = args[0];
+   else if (nargs >= 2 && nargs <= 4) {
+      outfile = args[0];
+      if(args[1][0] == '0'){
 	      pushMode = false;
       } else {
 	      pushMode = true;
       }
-   } else if(argc > 1){
-	std::cout << "Usage: tek_cl [filename.txt] [pushMode]" <<std::endl;
+      if(nargs >= 3)
+         frames = atoi(args[2]);
+      if(nargs == 4)
+         width = atoi(args[3]);
+   } else if(nargs != 0){
+	std::cout << "Usage: tek_cl [-a address] [-p port] [-b] [-q] [-c] [-k points] [filename.txt] [pushMode] [FastFrame count] [bytes per sample]" <<std::endl;
 	return -1;
    }
 
-   tek* instrument = new tek_file(outfile, pushMode);
-   instrument->Connect("192.168.50.25", 4000);
+   tek* instrument = new tek_file(outfile, pushMode, binary);
+   instrument->SetFastFrames(frames);
+   instrument->SetSampleWidth(width);
+   //-q polls BUSY? in pull mode instead of waiting for *OPC?
+   instrument->SetOpcCompletion(opc);
+   //-k reads long records in windows of this many points, pull mode only
+   instrument->SetChunkPoints(chunk);
+   if(chunk && pushMode)
+      std::cout << "-k needs pull mode, records are read whole" << std::endl;
+   //-c stops the run over a second connection
+   instrument->Connect(address, port, control);
 
    instrument->Start();
    std::chrono::high_resolution_clock::time_point tstart = std::chrono::high_resolution_clock::now();
    int nevents = 0;
    bool run = true;
+   bool stopping = false;
    while(run){
       struct pollfd fds;
       int ret;
       fds.fd = 0; /* this is STDIN */
       fds.events = POLLIN;
       ret = poll(&fds, 1, 0);
-      if(ret == 1){
+      if(ret == 1 && !stopping){
          std::cout << "Closing\n" << std::endl;
-         run = false;
+         //-c in push mode: no new acquisitions, the curves in flight are still read below
+         instrument->StopAcquisition();
+         stopping = true;
+         run = control && pushMode;
       } else if(ret<0){
          std::cout << "Error in poll stopping\n" << std::endl;
          run=false;
       }
 
-      if(instrument->HasEvent())
+      if(instrument->HasEvent()){
          if(instrument->ReadData()){
-            std::cout << "Success! " << nevents << std::endl;
-            nevents++;
+            //one ReadData per window with -k
+            const tek::Chunk& window = instrument->GetChunk();
+            if(window.index + 1 == window.count){
+               std::cout << "Success! " << nevents << std::endl;
+               nevents++;
+            }
+         } else if(!pushMode){
+            usleep(10000);
          }
-      else if(!pushMode)
-	 usleep(10000);
+      } else if(stopping){
+         run = false;
+      }
    }
    std::chrono::high_resolution_clock::time_point tstop = std::chrono::high_resolution_clock::now();
    instrument->Stop();
 
    std::chrono::duration<double> time_span = std::chrono::duration_cast<std::chrono::duration<double>>(tstop - tstart);
    std::cout << "Collected " << nevents << " Events in " << time_span.count() <<" seconds. Rate : " << nevents/time_span.count() << std::endl;
+   auto stats = instrument->GetAcquisitionStats();
+   std::cout << "Curve data: " << stats.bytes/1e6 << " MB, " << stats.bytes/1e6/time_span.count() << " MB/s";
+   if(instrument->GetChunk().count > 1)
+      std::cout << " in windows of " << chunk << " points";
+   std::cout << std::endl;
+   std::cout << "Stop: " << instrument->GetStopTime() << " ms, " << instrument->GetStopDiscarded() << " bytes discarded" << std::endl;
+   if(!pushMode){
+      std::cout << "Acquisitions: " << stats.acquisitions << ", Dead fraction: " << 100.*stats.DeadFraction()
+                << "%, Live: " << stats.live << " s, Dead: " << stats.dead << " s" << std::endl;
+   }
+   if(frames > 1)
+      std::cout << "Triggers: " << nevents*instrument->GetFastFrames() << ", Rate : " << nevents*instrument->GetFastFrames()/time_span.count() << std::endl;
    return 0;
 }
@@ -0,0 +1,717 @@
+// Emulator of the Tektronix 4 Series MSO socket server, for running tek_cl and tek_fe without
+// the scope.
+//
+// Only the subset of SCPI used by the tek class is implemented: *IDN?, *OPC?, *CLS, BUSY?,
+// the CH<n>: and HOR: settings, DAT:*, ACQ:*, FastFrame, CURVE? (pull mode) and CURVEStream?
+// (push mode), plus the socket server commands !d (device clear) and !t (timeout).
+// Headers are accepted in short and long form, ';' separated and with a leading ':'.
+//
+// The waveforms are synthetic: a negative pulse on a noisy baseline, a few precomputed
+// variants per channel so that generating an event costs no more than copying it.
+// Triggers come at the configured rate; in push mode a trigger is skipped while the previous
+// event is still being sent, as on the scope. In single sequence mode *OPC? is answered when the
+// acquisition completes and *WAI holds the following commands until then. The time from
+// completion to the CURVE? that reads it is reported together with the queries per acquisition.
+// Up to four clients can be connected, as to the socket server of the scope. They share the
+// acquisition, so one of them can query the settings or stop the acquisition while another streams.
+// -d holds every command for a fixed time after it arrives, standing in for the network round
+// trip to a real scope that the loopback interface does not have.
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <deque>
+#include <chrono>
+#include <math.h> // exp()
+#include <stdio.h>
+#include <stdlib.h> // atoi(), atof()
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h> // read(), write(), close()
+#include <fcntl.h>
+#include <poll.h> // ppoll()
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#define EMU_NCHANNEL 6
+
+typedef std::chrono::steady_clock Clock;
+
+//long form to short form of the mnemonics, anything else is only accepted as written
+static const std::map<std::string, std::string> kShortForm = {
+   {"ACQUIRE", "ACQ"}, {"ALLEVENTS", "ALLEV"}, {"AVAILABLE", "AVAIL"}, {"BANDWIDTH", "BAN"},
+   {"BYT_ORDER", "BYT_O"}, {"COUNT", "COUN"}, {"CURVE", "CURV"}, {"CURVESTREAM", "CURVES"},
+   {"DATA", "DAT"}, {"DISPLAY", "DIS"}, {"ENCDG", "ENC"}, {"FASTFRAME", "FAST"},
+   {"FRAMESTART", "FRAMESTAR"}, {"GLOBAL", "GLO"}, {"HORIZONTAL", "HOR"}, {"MODE", "MOD"},
+   {"OFFSET", "OFFS"}, {"POSITION", "POS"}, {"RECORDLENGTH", "RECO"}, {"SAMPLERATE", "SAMPLER"},
+   {"SCALE", "SCA"}, {"SOURCE", "SOU"}, {"START", "STAR"}, {"STOPAFTER", "STOPA"},
+   {"TIMESTAMP", "TIMES"}, {"WAVEFORM", "WAVE"}, {"WFMOUTPRE", "WFMO"}, {"WIDTH", "WID"},
+};
+
+class tek_emu {
+   //settings
+   bool fChannelEnabled[EMU_NCHANNEL];
+   double fChannelScale[EMU_NCHANNEL];
+   double fChannelPosition[EMU_NCHANNEL];
+   double fChannelOffset[EMU_NCHANNEL];
+   double fChannelBandwidth[EMU_NCHANNEL];
+   double fHorizontalScale = 1e-6;
+   double fHorizontalPosition = 50;
+   double fHorizontalSampleRate = 6.25e9;
+   std::string fAcquisitionMode = "SAMPLE";
+   int fRecordLength;
+   int fDataStart = 1;
+   int fDataStop = 1000000000;
+   int fSampleWidth = 1;
+   bool fLsbFirst = false;
+   std::vector<int> fSources = {0};
+   bool fFastFrame = false;
+   int fFastFrames = 1;
+   int fSocketTimeout = 0; //!t, ms, only stored
+
+   //acquisition
+   double fRate; //triggers per second, 0 is as fast as possible
+   int fLatency; //us before each query reply
+   int fDelay; //us from the arrival of a command to its processing, -d
+   bool fRunning = false;
+   bool fSequence = false; //ACQ:STOPA SEQUENCE, stop after one acquisition
+   Clock::time_point fAcquisitionDone;
+   std::vector<uint64_t> fFrameTimes; //ns since the epoch, of the last acquisition
+   bool fRead = true; //the last acquisition was read with CURVE?
+   std::vector<double> fReadLatency; //us from acquisition complete to CURVE?
+
+   //synthetic waveforms, up to kVariants per channel, fewer for long records
+   static const int kVariants = 8;
+   static const size_t kWaveformPoints = 64 * 1024 * 1024; //of all channels and variants
+   int fVariants = kVariants;
+   std::vector<std::vector<uint16_t>> fWaveforms;
+   int fEventNumber = 0;
+
+   //one client connection of the socket server, the acquisition is shared between them
+   struct Session {
+      int fd = -1;
+      std::string in;
+      std::deque<std::pair<Clock::time_point, std::string>> inFlight; //input not yet delivered, -d
+      std::string out;
+      size_t outSent = 0;
+      std::string deferred; //reply held back by *OPC? until the acquisition is complete
+      bool waiting = false; //*WAI, input is held until the acquisition is complete
+      bool streaming = false;
+      Clock::time_point nextTrigger;
+   };
+   static const size_t kMaxSessions = 4;
+   std::vector<Session> fSessions;
+   Session* fSession = nullptr; //the one being served
+   Clock::time_point fStart; //first connection
+   uint64_t fEvents = 0;
+   uint64_t fSkipped = 0;
+   uint64_t fBytes = 0;
+   uint64_t fQueries = 0;
+   uint64_t fAcquisitions = 0;
+
+public:
+   tek_emu(int recordLength, double rate, int channels, int latency, int delay):
+      fRecordLength(recordLength), fRate(rate), fLatency(latency), fDelay(delay){
+      for(int i=0; i<EMU_NCHANNEL; i++){
+         fChannelEnabled[i] = i < channels;
+         fChannelScale[i] = 0.1;
+         fChannelPosition[i] = 0;
+         fChannelOffset[i] = 0;
+         fChannelBandwidth[i] = 1e9;
+      }
+      Generate();
+   }
+
+   //all connections, returns on an error of the listening socket
+   void Serve(int sock){
+      fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+      char buff[65536];
+      while(true){
+         std::vector<struct pollfd> pfds(1 + fSessions.size());
+         pfds[0] = {sock, POLLIN, 0};
+
+         //completion of the acquisition for a deferred *OPC?, the next trigger of a stream that has
+         //nothing left to send or the delivery of delayed input, the earliest of all sessions.
+         //The last 200 us are spun, a timed wake-up comes up to the timer slack late and would be
+         //counted as readout latency.
+         bool timed = false;
+         Clock::time_point deadline;
+         auto until = [&](Clock::time_point t){
+            if(!timed || t < deadline)
+               deadline = t;
+            timed = true;
+         };
+         for(size_t i=0; i<fSessions.size(); i++){
+            Session& s = fSessions[i];
+            pfds[i+1] = {s.fd, POLLIN, 0};
+            if(s.outSent < s.out.size())
+               pfds[i+1].events |= POLLOUT;
+            if(!s.deferred.empty() || s.waiting)
+               until(fAcquisitionDone);
+            else if(s.streaming && fRunning && s.outSent == s.out.size())
+               until(s.nextTrigger);
+            if(!s.inFlight.empty())
+               until(s.inFlight.front().first + std::chrono::microseconds(fDelay));
+         }
+         struct timespec timeout = {1, 0};
+         if(timed){
+            auto wait = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - Clock::now()).count() - 200000;
+            if(wait < 0)
+               wait = 0;
+            timeout.tv_sec = wait / 1000000000;
+            timeout.tv_nsec = wait % 1000000000;
+         }
+
+         int ret = ppoll(pfds.data(), pfds.size(), &timeout, nullptr);
+         if(ret < 0 && errno != EINTR)
+            return;
+
+         for(size_t i=0; i<fSessions.size(); i++){
+            fSession = &fSessions[i];
+            if(!Service(pfds[i+1].revents, buff, sizeof(buff))){
+               close(fSession->fd);
+               fSession->fd = -1;
+            }
+         }
+         fSession = nullptr;
+         size_t open = fSessions.size();
+         fSessions.erase(std::remove_if(fSessions.begin(), fSessions.end(), [](const Session& s){ return s.fd < 0; }),
+                         fSessions.end());
+         if(open && fSessions.empty())
+            Report();
+
+         if(pfds[0].revents & POLLIN)
+            Accept(sock);
+      }
+   }
+
+private:
+   void Accept(int sock){
+      int fd = accept(sock, nullptr, nullptr);
+      if(fd < 0)
+         return;
+      if(fSessions.size() >= kMaxSessions){
+         std::cout << "Refusing client, " << kMaxSessions << " sessions open" << std::endl;
+         close(fd);
+         return;
+      }
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+      int one = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      //the statistics cover the time from the first connection to the last disconnection
+      if(fSessions.empty()){
+         fEvents = fSkipped = fBytes = fQueries = fAcquisitions = 0;
+         fReadLatency.clear();
+         fStart = Clock::now();
+      }
+      fSessions.emplace_back();
+      fSessions.back().fd = fd;
+      std::cout << "Client connected, " << fSessions.size() << " session(s)" << std::endl;
+   }
+
+   //one pass over fSession, false when the client has gone
+   bool Service(short revents, char* buff, size_t size){
+      Session& s = *fSession;
+      if(revents & (POLLIN | POLLHUP | POLLERR)){
+         int n = read(s.fd, buff, size);
+         if(n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR))
+            return false;
+         if(n > 0 && fDelay > 0){
+            s.inFlight.emplace_back(Clock::now(), std::string(buff, n));
+         } else if(n > 0){
+            s.in.append(buff, n);
+            ProcessInput();
+         }
+      }
+
+      if(!s.inFlight.empty()){
+         Clock::time_point now = Clock::now();
+         bool delivered = false;
+         while(!s.inFlight.empty() && s.inFlight.front().first + std::chrono::microseconds(fDelay) <= now){
+            s.in += s.inFlight.front().second;
+            s.inFlight.pop_front();
+            delivered = true;
+         }
+         if(delivered)
+            ProcessInput();
+      }
+
+      if(!s.deferred.empty() && !Busy()){
+         s.out += s.deferred;
+         s.deferred.clear();
+      }
+      if(s.waiting && !Busy()){
+         s.waiting = false;
+         ProcessInput();
+      }
+
+      //ACQ:STATE STOP, from any session, ends the triggers of the stream
+      if(s.streaming && fRunning && s.outSent == s.out.size() && Clock::now() >= s.nextTrigger){
+         Trigger();
+         AppendCurve();
+      }
+
+      return s.outSent == s.out.size() || Send();
+   }
+
+   void Report(){
+      double seconds = std::chrono::duration<double>(Clock::now() - fStart).count();
+      std::cout << "Client disconnected after " << seconds << " s: " << fEvents << " events, "
+                << fBytes/1e6 << " MB (" << fBytes/1e6/seconds << " MB/s), "
+                << fSkipped << " triggers skipped" << std::endl;
+      if(fAcquisitions){
+         std::cout << "Single sequence: " << fAcquisitions << " acquisitions, "
+                   << (double)fQueries/fAcquisitions << " queries per acquisition" << std::endl;
+      }
+      if(!fReadLatency.empty()){
+         std::sort(fReadLatency.begin(), fReadLatency.end());
+         auto at = [this](double q){ return fReadLatency[(size_t)(q*(fReadLatency.size()-1))]; };
+         std::cout << "Complete to CURVE? (us): p50 " << at(0.5) << ", p90 " << at(0.9) << ", p99 " << at(0.99)
+                   << ", max " << fReadLatency.back() << std::endl;
+      }
+   }
+
+   void Generate(){
+      size_t fit = kWaveformPoints / ((size_t)EMU_NCHANNEL * fRecordLength);
+      fVariants = fit < 1 ? 1 : (fit > (size_t)kVariants ? kVariants : fit);
+      fWaveforms.assign(EMU_NCHANNEL * fVariants, std::vector<uint16_t>(fRecordLength));
+      uint32_t seed = 12345;
+      for(int c=0; c<EMU_NCHANNEL; c++){
+         for(int v=0; v<fVariants; v++){
+            std::vector<uint16_t>& wf = fWaveforms[c*fVariants + v];
+            double amplitude = 4000. * (c + 1) * (1 + 0.1*v);
+            double center = fRecordLength * (0.4 + 0.01*v);
+            double rise = fRecordLength / 200. + 1;
+            double fall = fRecordLength / 40. + 1;
+            for(int i=0; i<fRecordLength; i++){
+               seed = seed*1664525 + 1013904223;
+               double value = 49152 + (int)(seed >> 24) - 128;
+               double t = i - center;
+               if(t >= -4*rise)
+                  value -= amplitude * (t < 0 ? exp(-t*t/(2*rise*rise)) : exp(-t/fall));
+               wf[i] = value < 0 ? 0 : (value > 65535 ? 65535 : value);
+            }
+         }
+      }
+   }
+
+   static std::string ToUpper(std::string s){
+      for(auto& c: s)
+         c = toupper(c);
+      return s;
+   }
+
+   //"DATA:SOURCE" and "dat:sou" to "DAT:SOU"
+   static std::string Normalize(const std::string& header){
+      std::string out;
+      size_t start = 0;
+      while(start <= header.size()){
+         size_t end = header.find(':', start);
+         if(end == std::string::npos)
+            end = header.size();
+         std::string word = ToUpper(header.substr(start, end - start));
+         bool query = !word.empty() && word.back() == '?';
+         if(query)
+            word.pop_back();
+         auto it = kShortForm.find(word);
+         if(it != kShortForm.end())
+            word = it->second;
+         if(!out.empty())
+            out += ':';
+         out += word + (query ? "?" : "");
+         start = end + 1;
+      }
+      return out;
+   }
+
+   //"CH3:..." to 2, -1 if the header does not start with a channel
+   static int Channel(const std::string& header, size_t pos = 0){
+      if(header.compare(pos, 2, "CH") || pos + 2 >= header.size())
+         return -1;
+      int ch = header[pos+2] - '1';
+      return ch >= 0 && ch < EMU_NCHANNEL ? ch : -1;
+   }
+
+   static std::string Number(double value){
+      char buff[32];
+      snprintf(buff, sizeof(buff), "%.4E", value);
+      return buff;
+   }
+
+   //complete lines of fSession->in, until a *WAI has to wait
+   void ProcessInput(){
+      //a device clear is honoured even while the input is held
+      if(fSession->waiting){
+         size_t clear = fSession->in.rfind("!d");
+         if(clear != std::string::npos && (clear == 0 || fSession->in[clear-1] == '\n')){
+            fSession->in.erase(0, clear);
+            fSession->waiting = false;
+         }
+      }
+      size_t pos;
+      while(!fSession->waiting && (pos = fSession->in.find('\n')) != std::string::npos){
+         std::string line = fSession->in.substr(0, pos);
+         fSession->in.erase(0, pos + 1);
+         Execute(line);
+      }
+   }
+
+   //one line from the client, ';' separated commands
+   void Execute(const std::string& line){
+      if(!line.empty() && line[0] == '!'){
+         SocketCommand(line);
+         return;
+      }
+
+      std::vector<std::string> replies;
+      bool deferred = false;
+      size_t start = 0;
+      while(start < line.size()){
+         size_t end = line.find(';', start);
+         if(end == std::string::npos)
+            end = line.size();
+         std::string cmd = line.substr(start, end - start);
+         start = end + 1;
+
+         while(!cmd.empty() && (cmd.back() == '\r' || cmd.back() == ' '))
+            cmd.pop_back();
+         if(!cmd.empty() && cmd[0] == ':')
+            cmd.erase(0, 1);
+         if(cmd.empty())
+            continue;
+
+         size_t space = cmd.find(' ');
+         std::string header = Normalize(cmd.substr(0, space));
+         std::string arg = space == std::string::npos ? "" : cmd.substr(space + 1);
+         if(header.empty())
+            continue;
+
+         if(header.back() == '?')
+            fQueries++;
+
+         if(header == "*WAI" && Busy()){
+            //the rest of the line runs after the acquisition
+            Reply(replies, deferred);
+            fSession->in.insert(0, line.substr(start < line.size() ? start : line.size()) + "\n");
+            fSession->waiting = true;
+            return;
+         }
+
+         if(header == "CURV?"){
+            //the block is its own reply, after any values of the same line
+            Reply(replies);
+            replies.clear();
+            if(fSequence && !fRead && !Busy()){
+               fReadLatency.push_back(std::chrono::duration<double, std::micro>(Clock::now() - fAcquisitionDone).count());
+               fRead = true;
+            }
+            AppendCurve();
+         } else if(header == "CURVES?"){
+            fSession->streaming = true;
+            fSession->nextTrigger = Clock::now();
+         } else if(header == "*OPC?" && Busy()){
+            deferred = true;
+            replies.push_back("1");
+         } else if(header.back() == '?'){
+            replies.push_back(Query(header));
+         } else {
+            Set(header, arg);
+         }
+      }
+      Reply(replies, deferred);
+   }
+
+   void Reply(const std::vector<std::string>& replies, bool deferred = false){
+      if(replies.empty())
+         return;
+      if(fLatency)
+         usleep(fLatency);
+      std::string reply;
+      for(size_t i=0; i<replies.size(); i++)
+         reply += (i ? ";" : "") + replies[i];
+      //later replies wait behind a deferred one, as in the output queue of the scope
+      if(deferred || !fSession->deferred.empty())
+         fSession->deferred += reply + "\n";
+      else
+         fSession->out += reply + "\n";
+   }
+
+   void SocketCommand(const std::string& line){
+      if(line.compare(0, 2, "!d") == 0){
+         //device clear: stop the stream and drop whatever was not sent yet
+         fSession->streaming = false;
+         fSession->out.clear();
+         fSession->deferred.clear();
+         fSession->waiting = false;
+         fSession->outSent = 0;
+      } else if(line.compare(0, 2, "!t") == 0){
+         fSocketTimeout = atoi(line.c_str() + 2);
+      } else {
+         std::cout << "unknown socket server command " << line << std::endl;
+      }
+   }
+
+   std::string Query(const std::string& header){
+      int ch = Channel(header);
+      if(ch >= 0){
+         std::string item = header.substr(4);
+         if(item == "POS?") return Number(fChannelPosition[ch]);
+         if(item == "OFFS?") return Number(fChannelOffset[ch]);
+         if(item == "SCA?") return Number(fChannelScale[ch]);
+         if(item == "BAN?") return Number(fChannelBandwidth[ch]);
+      }
+      if(header.compare(0, 8, "DIS:GLO:") == 0){
+         ch = Channel(header, 8);
+         if(ch >= 0)
+            return fChannelEnabled[ch] ? "1" : "0";
+      }
+      if(header.compare(0, 20, "HOR:FAST:TIMES:ALL:C") == 0)
+         return FrameTimes();
+
+      if(header == "*IDN?") return "TEKTRONIX,MSO64,EMULATOR,CF:91.1CT FV:1.0";
+      if(header == "*OPC?") return "1";
+      if(header == "*ESR?") return "0";
+      if(header == "ALLEV?") return "0,\"No events to report - queue empty\"";
+      if(header == "BUSY?") return Busy() ? "1" : "0";
+      if(header == "ACQ:STATE?") return fRunning && !(fSequence && !Busy()) ? "1" : "0";
+      if(header == "ACQ:MOD?") return fAcquisitionMode;
+      if(header == "HOR:POS?") return Number(fHorizontalPosition);
+      if(header == "HOR:SCA?") return Number(fHorizontalScale);
+      if(header == "HOR:SAMPLER?") return Number(fHorizontalSampleRate);
+      if(header == "HOR:MOD:RECO?") return std::to_string(fRecordLength);
+      if(header == "HOR:FAST:STATE?") return fFastFrame ? "1" : "0";
+      if(header == "HOR:FAST:COUN?") return std::to_string(fFastFrames);
+      if(header == "DAT:WID?") return std::to_string(fSampleWidth);
+      if(header == "DAT:STAR?") return std::to_string(fDataStart);
+      if(header == "DAT:STOP?") return std::to_string(fDataStop);
+      if(header == "DAT:SOU?" || header == "DAT:SOU:AVAIL?"){
+         std::string list;
+         for(int s: fSources)
+            list += (list.empty() ? "CH" : ",CH") + std::to_string(s + 1);
+         return list;
+      }
+
+      std::cout << "unknown query " << header << std::endl;
+      return "";
+   }
+
+   static bool IsOn(const std::string& arg){
+      std::string value = ToUpper(arg);
+      return value == "1" || value == "ON" || value == "RUN";
+   }
+
+   void Set(const std::string& header, const std::string& arg){
+      int ch = Channel(header);
+      if(ch >= 0){
+         std::string item = header.substr(4);
+         if(item == "POS") fChannelPosition[ch] = atof(arg.c_str());
+         else if(item == "OFFS") fChannelOffset[ch] = atof(arg.c_str());
+         else if(item == "SCA") fChannelScale[ch] = atof(arg.c_str());
+         else if(item == "BAN") fChannelBandwidth[ch] = atof(arg.c_str());
+         return;
+      }
+      if(header.compare(0, 8, "DIS:GLO:") == 0 && (ch = Channel(header, 8)) >= 0){
+         fChannelEnabled[ch] = IsOn(arg);
+         return;
+      }
+
+      if(header == "ACQ:STATE"){
+         fRunning = IsOn(arg);
+         if(fRunning){
+            //an acquisition in sequence mode takes one trigger period per frame
+            double period = fRate > 0 ? 1./fRate : 0;
+            fAcquisitionDone = Clock::now() + std::chrono::duration_cast<Clock::duration>(
+               std::chrono::duration<double>(period * (fFastFrame ? fFastFrames : 1)));
+            if(fSequence){
+               Trigger();
+               fAcquisitions++;
+               fRead = false;
+            }
+         }
+      } else if(header == "ACQ:STOPA"){
+         fSequence = ToUpper(arg).compare(0, 3, "SEQ") == 0;
+      } else if(header == "ACQ:MOD"){
+         fAcquisitionMode = ToUpper(arg);
+      } else if(header == "HOR:MOD:RECO"){
+         fRecordLength = atoi(arg.c_str()) > 0 ? atoi(arg.c_str()) : fRecordLength;
+         Generate();
+      } else if(header == "HOR:POS"){
+         fHorizontalPosition = atof(arg.c_str());
+      } else if(header == "HOR:SCA"){
+         fHorizontalScale = atof(arg.c_str());
+      } else if(header == "HOR:FAST:STATE"){
+         fFastFrame = IsOn(arg);
+      } else if(header == "HOR:FAST:COUN"){
+         fFastFrames = atoi(arg.c_str()) > 0 ? atoi(arg.c_str()) : 1;
+      } else if(header == "DAT:WID"){
+         fSampleWidth = atoi(arg.c_str()) == 2 ? 2 : 1;
+      } else if(header == "DAT:STAR"){
+         fDataStart = atoi(arg.c_str());
+      } else if(header == "DAT:STOP"){
+         fDataStop = atoi(arg.c_str());
+      } else if(header == "WFMO:BYT_O"){
+         fLsbFirst = ToUpper(arg).compare(0, 3, "LSB") == 0;
+      } else if(header == "DAT:SOU"){
+         fSources.clear();
+         std::string list = ToUpper(arg);
+         for(size_t pos = list.find("CH"); pos != std::string::npos; pos = list.find("CH", pos + 2)){
+            int s = Channel(list, pos);
+            if(s >= 0)
+               fSources.push_back(s);
+         }
+      } else if(header == "*CLS" || header == "*RST" || header == "*WAI" || header == "DAT:ENC" || header == "DIS:WAVE"
+                || header == "DAT:FRAMESTAR" || header == "DAT:FRAMESTOP"){
+         //accepted, no effect on the emulation
+      } else {
+         std::cout << "unknown command " << header << " " << arg << std::endl;
+      }
+   }
+
+   bool Busy(){
+      return fRunning && fSequence && Clock::now() < fAcquisitionDone;
+   }
+
+   //one acquisition: frame times and the next trigger of the stream
+   void Trigger(){
+      int frames = fFastFrame ? fFastFrames : 1;
+      double period = fRate > 0 ? 1./fRate : 0;
+      uint64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+         std::chrono::system_clock::now().time_since_epoch()).count();
+      fFrameTimes.resize(frames);
+      for(int f=0; f<frames; f++)
+         fFrameTimes[f] = now + (uint64_t)(f * period * 1e9);
+
+      if(fSession->streaming){
+         auto step = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(period * frames));
+         Clock::time_point now = Clock::now();
+         fSession->nextTrigger += step;
+         //the scope does not trigger while it sends, these triggers are lost
+         while(step.count() > 0 && fSession->nextTrigger < now){
+            fSession->nextTrigger += step;
+            fSkipped += frames;
+         }
+         if(step.count() <= 0)
+            fSession->nextTrigger = now;
+      }
+   }
+
+   //"02 Mar 2024 20:10:54.542 037 272 620" per frame, comma separated
+   std::string FrameTimes(){
+      std::string reply;
+      for(size_t f=0; f<fFrameTimes.size(); f++){
+         time_t seconds = fFrameTimes[f] / 1000000000;
+         uint64_t ps = fFrameTimes[f] % 1000000000 * 1000;
+         struct tm t;
+         localtime_r(&seconds, &t);
+         char date[32], buff[80];
+         strftime(date, sizeof(date), "%d %b %Y %H:%M:%S", &t);
+         snprintf(buff, sizeof(buff), "%s%s.%03d %03d %03d %03d", f ? "," : "", date,
+                  (int)(ps / 1000000000), (int)(ps / 1000000 % 1000), (int)(ps / 1000 % 1000), (int)(ps % 1000));
+         reply += buff;
+      }
+      return reply.empty() ? "0" : reply;
+   }
+
+   //one definite length block per source, ';' between them and '\n' at the end
+   void AppendCurve(){
+      int first = fDataStart < 1 ? 0 : fDataStart - 1;
+      int last = fDataStop > fRecordLength ? fRecordLength : fDataStop;
+      int npt = last > first ? last - first : 0;
+      int frames = fFastFrame ? fFastFrames : 1;
+      size_t size = (size_t)npt * frames * fSampleWidth;
+      std::string length = std::to_string(size);
+
+      //behind a deferred *OPC? reply, as in the output queue of the scope
+      std::string& out = fSession->deferred.empty() ? fSession->out : fSession->deferred;
+      for(size_t s=0; s<fSources.size(); s++){
+         out += "#" + std::to_string(length.size()) + length;
+         size_t pos = out.size();
+         out.resize(pos + size);
+         char* p = &out[pos];
+         for(int f=0; f<frames; f++){
+            const uint16_t* wf = fWaveforms[fSources[s]*fVariants + (fEventNumber + f) % fVariants].data() + first;
+            if(fSampleWidth == 1){
+               for(int i=0; i<npt; i++)
+                  *p++ = wf[i] >> 8;
+            } else if(fLsbFirst){
+               memcpy(p, wf, npt*sizeof(uint16_t));
+               p += npt*sizeof(uint16_t);
+            } else {
+               for(int i=0; i<npt; i++){
+                  *p++ = wf[i] >> 8;
+                  *p++ = wf[i] & 0xFF;
+               }
+            }
+         }
+         out += s + 1 < fSources.size() ? ';' : '\n';
+      }
+      fEventNumber++;
+      fEvents++;
+   }
+
+   bool Send(){
+      int n = write(fSession->fd, fSession->out.data() + fSession->outSent, fSession->out.size() - fSession->outSent);
+      if(n < 0)
+         return errno == EAGAIN || errno == EINTR;
+      fSession->outSent += n;
+      fBytes += n;
+      if(fSession->outSent == fSession->out.size()){
+         fSession->out.clear();
+         fSession->outSent = 0;
+      }
+      return true;
+   }
+};
+
+int main(int argc, char** argv){
+   int port = 4000;
+   int recordLength = 10000;
+   double rate = 1000;
+   int channels = 4;
+   int latency = 0;
+   int delay = 0;
+
+   int opt;
+   while((opt = getopt(argc, argv, "p:n:r:c:l:d:")) != -1){
+      switch(opt){
+         case 'p': port = atoi(optarg); break;
+         case 'n': recordLength = atoi(optarg); break;
+         case 'r': rate = atof(optarg); break;
+         case 'c': channels = atoi(optarg); break;
+         case 'l': latency = atoi(optarg); break;
+         case 'd': delay = atoi(optarg); break;
+         default:
+            std::cout << "Usage: tek_emu [-p port] [-n record length] [-r trigger rate (Hz), 0 is unlimited]"
+                      << " [-c enabled channels] [-l query latency (us)]"
+                      << " [-d command delay (us)]" << std::endl;
+            return -1;
+      }
+   }
+
+   signal(SIGPIPE, SIG_IGN);
+   int sock = socket(AF_INET, SOCK_STREAM, 0);
+   int one = 1;
+   setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+   struct sockaddr_in addr;
+   memset(&addr, 0, sizeof(addr));
+   addr.sin_family = AF_INET;
+   addr.sin_port = htons(port);
+   addr.sin_addr.s_addr = htonl(INADDR_ANY);
+   if(bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(sock, 4) < 0){
+      perror("tek_emu");
+      return -1;
+   }
+
+   std::cout << "Emulating a scope on port " << port << ": " << channels << " channels, "
+             << recordLength << " points, " << rate << " triggers/s" << std::endl;
+   tek_emu emulator(recordLength, rate, channels, latency, delay);
+   emulator.Serve(sock);
+   perror("tek_emu");
+   return -1;
+}
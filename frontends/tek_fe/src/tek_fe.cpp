@@ -11,25 +11,64 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <iostream>
+#include <atomic>
+#include <stdexcept>
 #include "midas.h"
 #include "msystem.h"
 
 #include "mfe.h"
 #include "tek.h"
 #include "odbxx.h"
+#include "WaveformSampler.h"
+#include "WaveformFeatures.h"
+#include "Tracer.h"
+#include "BackpressureController.h"
+#include "ThreadPlacement.h"
+#include "HugePages.h"
 
 using namespace std::placeholders;
 
 class tek_midas: public tek {
    char* fPointer = nullptr;
    midas::odb   fOdbSettings{};
+   //address and state of this scope, Settings/Scope <k> for scope k > 0
+   midas::odb   fOdbScope{};
+   int fIndex; //scope, 0 writes TEK<n> banks and scope k TK<k><n>
+   int fScopes = 1; //in the frontend, they share max_event_size
+   std::string fTag; //of the messages
+   WaveformSampler fSampler;
+   bool fSampling = false;
+   LatencyMonitor fLatency{{"HasEvent", "RingBuffer", "ReadData", "Socket"}};
+   BackpressureController fBackpressure;
+   BackpressureController::Decision fDecision = BackpressureController::kFull;
+   std::vector<int32_t> fFeatures;
+   bool fWiden = false; //8 bit samples written as TID_UINT16 on the 16 bit scale
+   std::vector<uint16_t> fWide; //8 bit samples widened for the sampler and features
+   HugePageBuffer fStaging;
+   PageFaultMonitor fPageFaults;
+   PageFaultMonitor::Counters fLastPageFaults;
+   uint64_t fLastPageFaultEvents = 0;
+   //TEKV of the last scope state, into the next event when it changes
+   std::mutex fCalibrationMutex;
+   std::vector<double> fCalibration;
+   bool fCalibrationPending = false;
 
    public:
+   enum LatencyStage {kWaitEvent, kRingBuffer, kReadData, kSocket};
+
    void stateCallback(midas::odb &o) {
 	   printf("callback\n");
+      //placement changes take effect immediately, the other settings at the next run
+      std::string name = o.get_name();
+      for(std::string suffix: {" CPUs", " Priority"}){
+         if(name.size() >= suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0)
+            ApplyPlacement();
+      }
    }
-   tek_midas(bool pushMode = false): tek(pushMode){
+   tek_midas(bool pushMode = false, int index = 0): tek(pushMode), fIndex(index){
+      fTag = fIndex ? "Trigger scope " + std::to_string(fIndex) : "Trigger";
       midas::odb settings = {
          { "IP Address", "192.168.50.25"},
          { "IP Port", 4000},
@@ -41,18 +80,68 @@ class tek_midas: public tek {
          { "Horizontal Position", 1.},
          { "Horizontal Scale", 1.},
          { "Sample Rate", 1.},
-         { "Acquisition Mode", "SAMPLE"}
+         { "Acquisition Mode", "SAMPLE"},
+         { "Live Rate", 10.},
+         { "Live Points", 1000},
+         { "Trace Enable", false},
+         { "Trace Threshold (ms)", 0.},
+         { "Trace Directory", ""},
+         { "Backpressure Policy", "none"},
+         { "Backpressure High (%)", 80.},
+         { "Backpressure Low (%)", 50.},
+         { "Backpressure Prescale", 10},
+         { "Backpressure Sample Rate (Hz)", 10.},
+         { "Main CPUs", ""},
+         { "Main Priority", 0},
+         { "Readout CPUs", ""},
+         { "Readout Priority", 0},
+         { "Huge Pages", true},
+         { "Socket Timeout (ms)", 1000},
+         { "FastFrame Count", 1},
+         { "Sample Width", 2},
+         { "Widen 8 Bit", false},
+         { "Pull Wait OPC", true},
+         { "Control Connection", true},
+         { "Scopes", 1},
+         { "Merge Window (ms)", 0.},
+         { "Merge Timeout (ms)", 100.},
+         { "Pull Mode", false},
+         { "Chunk Points", 0}
       };
       settings.connect("/Equipment/Trigger/Settings");
 
       fOdbSettings.connect("/Equipment/Trigger/Settings");
-      fOdbSettings["Channel Enable"].resize(TEK_NCHANNEL);
-      fOdbSettings["Channel Position"].resize(TEK_NCHANNEL);
-      fOdbSettings["Channel Offset"].resize(TEK_NCHANNEL);
-      fOdbSettings["Channel Scale"].resize(TEK_NCHANNEL);
-      fOdbSettings["Channel Bandwidth"].resize(TEK_NCHANNEL);
 
-      Connect(fOdbSettings["IP Address"], fOdbSettings["IP Port"]);
+      //the other scopes only have their own address and state, the rest is shared
+      std::string scopePath = "/Equipment/Trigger/Settings";
+      if(fIndex){
+         scopePath += "/Scope " + std::to_string(fIndex);
+         midas::odb scope = {
+            { "IP Address", ""},
+            { "IP Port", 4000},
+            { "Channel Enable", false},
+            { "Channel Position", 1.},
+            { "Channel Offset", 1.},
+            { "Channel Scale", 1.},
+            { "Channel Bandwidth", 1.},
+            { "Horizontal Position", 1.},
+            { "Horizontal Scale", 1.},
+            { "Sample Rate", 1.},
+            { "Acquisition Mode", "SAMPLE"}
+         };
+         scope.connect(scopePath);
+      }
+      fOdbScope.connect(scopePath);
+      fOdbScope["Channel Enable"].resize(TEK_NCHANNEL);
+      fOdbScope["Channel Position"].resize(TEK_NCHANNEL);
+      fOdbScope["Channel Offset"].resize(TEK_NCHANNEL);
+      fOdbScope["Channel Scale"].resize(TEK_NCHANNEL);
+      fOdbScope["Channel Bandwidth"].resize(TEK_NCHANNEL);
+
+      ApplyTraceSettings();
+      ApplyPlacement();
+      SetTimeout(fOdbSettings["Socket Timeout (ms)"]);
+      Connect(fOdbScope["IP Address"], fOdbScope["IP Port"], fOdbSettings["Control Connection"]);
       AlignODB();
 
       fOdbSettings.set_trigger_hotlink(false);
@@ -65,6 +154,32 @@ class tek_midas: public tek {
          std::cout << "Pull Mode" << std::endl;
    }
 
+   midas::odb& GetSettings(){
+      return fOdbSettings;
+   };
+
+   void SetScopeCount(int n){
+      fScopes = n;
+   };
+
+   const char* Tag(){
+      return fTag.c_str();
+   };
+
+   //TEK<suffix> for the first scope, TK<k><suffix> for scope k
+   std::string BankName(char suffix){
+      std::string name = fIndex ? "TK" + std::to_string(fIndex) : "TEK";
+      return name + suffix;
+   };
+
+   //equipment Variables, in Scope <k> for scope k
+   std::string VariablePath(const std::string& name){
+      std::string path = "/Equipment/Trigger/Variables/";
+      if(fIndex)
+         path += "Scope " + std::to_string(fIndex) + "/";
+      return path + name;
+   };
+
    ~tek_midas(){
    }
 
@@ -73,29 +188,60 @@ class tek_midas: public tek {
          QueryState();
 
       for(int i=0; i<TEK_NCHANNEL; i++){
-         fOdbSettings["Channel Enable"][i] = fChannelEnabled[i];
+         fOdbScope["Channel Enable"][i] = fChannelEnabled[i];
          if(fChannelEnabled[i]){
-            fOdbSettings["Channel Position"][i] = fChannelPosition[i];
-            fOdbSettings["Channel Offset"][i] = fChannelOffset[i];
-            fOdbSettings["Channel Scale"][i] = fChannelScale[i];
-            fOdbSettings["Channel Bandwidth"][i] = fChannelBandwidth[i];
+            fOdbScope["Channel Position"][i] = fChannelPosition[i];
+            fOdbScope["Channel Offset"][i] = fChannelOffset[i];
+            fOdbScope["Channel Scale"][i] = fChannelScale[i];
+            fOdbScope["Channel Bandwidth"][i] = fChannelBandwidth[i];
          }
       }
 
-      fOdbSettings["Horizontal Position"] = fHorizontalPosition;
-      fOdbSettings["Horizontal Scale"] = fHorizontalScale;
-      fOdbSettings["Sample Rate"] = fHorizontalSampleRate;
-      fOdbSettings["Acquisition Mode"] = fAcquisitionMode.substr(0,5);
+      fOdbScope["Horizontal Position"] = fHorizontalPosition;
+      fOdbScope["Horizontal Scale"] = fHorizontalScale;
+      fOdbScope["Sample Rate"] = fHorizontalSampleRate;
+      fOdbScope["Acquisition Mode"] = fAcquisitionMode.substr(0,5);
+      UpdateCalibration();
+   }
+
+   //RPB samples on the 16 bit scale, 8 bit samples are widened with v << 8
+   static constexpr double kCodesPerDivision = 6400; //25 levels per division of the 8 bit scale
+   static constexpr double kCenterCode = 32768;
+
+   //sample to volts and time of the scope state, pending for the next event if it changed
+   void UpdateCalibration(bool force = false){
+      std::vector<double> calibration(3 + 2*TEK_NCHANNEL, 0.);
+      calibration[0] = TEK_NCHANNEL;
+      if(fHorizontalSampleRate > 0){
+         calibration[1] = 1./fHorizontalSampleRate;
+         //Horizontal Position is the % of the record before the trigger
+         calibration[2] = -fHorizontalPosition/100. * fRecordLength * calibration[1];
+      }
+      for(int i=0; i<TEK_NCHANNEL; i++){
+         if(!fChannelEnabled[i])
+            continue;
+         double gain = fChannelScale[i]/kCodesPerDivision;
+         calibration[3 + i] = gain;
+         calibration[3 + TEK_NCHANNEL + i] = fChannelOffset[i] - fChannelPosition[i]*fChannelScale[i] - kCenterCode*gain;
+      }
+
+      std::lock_guard<std::mutex> lock(fCalibrationMutex);
+      if(force || calibration != fCalibration)
+         fCalibrationPending = true;
+      fCalibration = calibration;
    }
 
    void Configure(){
       //set transmit window to full recordlenght
-      WriteCmd("DAT:STAR 1\n");
-      std::string points = ReadCmd("HOR:MOD:RECO?\n");
-      WriteCmd("DAT:STOP "+ points + "\n");
+      QueueCmd("DAT:STAR 1\n");
+      QueueCmd("DAT:STOP "+ std::to_string(fRecordLength) + "\n");
 
-      //set 8 bit
-      //WriteCmd("DAT:WID 1\n");
+      //1 byte per sample halves the transfer, the bank is TID_UINT8 unless widened
+      SetSampleWidth(fOdbSettings["Sample Width"]);
+      fWiden = fOdbSettings["Widen 8 Bit"];
+      int bankWidth = GetSampleWidth() == 1 && !fWiden ? 1 : 2;
+      //pull mode, false polls BUSY?
+      SetOpcCompletion(fOdbSettings["Pull Wait OPC"]);
 
       //send all enabled channels
       /*std::string channels = ReadCmd("DAT:SOU:AVAIL?\n");*/
@@ -109,32 +255,303 @@ class tek_midas: public tek {
       }
       channels += '\n';
       std::cout << "Enabled Channels: " << channels;
-      WriteCmd("DAT:SOU " + channels + "\n");
+
+      //FastFrame, all frames of one acquisition go into one event
+      int frames = fOdbSettings["FastFrame Count"];
+      int nchannels = 0;
+      for(int i=0; i<TEK_NCHANNEL; i++)
+         nchannels += fChannelEnabled[i];
+      size_t frameSize = (size_t)fRecordLength*bankWidth*nchannels + 64*nchannels;
+      size_t eventSize = max_event_size / fScopes;
+      if(frames > 1 && frameSize*frames + 4096 > eventSize){
+         int fit = frameSize ? (eventSize - 4096)/frameSize : 1;
+         cm_msg(MERROR, "Configure", "%s: %d frames of %d points do not fit into max_event_size, using %d", Tag(), frames, fRecordLength, fit);
+         frames = fit;
+      }
+      SetFastFrames(frames);
+
+      //long records in DAT:STAR/DAT:STOP windows of Chunk Points, one event per window. A record
+      //that does not fit into the event is read in windows that do.
+      int chunk = fOdbSettings["Chunk Points"];
+      size_t pointSize = (size_t)bankWidth*nchannels;
+      int fitPoints = pointSize ? (eventSize - 4096 - 64*nchannels)/pointSize : fRecordLength;
+      if(frames <= 1 && fRecordLength > fitPoints){
+         if(IsPushMode()){
+            cm_msg(MERROR, "Configure", "%s: records of %d points do not fit into max_event_size, set Pull Mode to read them in windows", Tag(), fRecordLength);
+         } else if(chunk <= 0 || chunk > fitPoints){
+            cm_msg(MINFO, "Configure", "%s: records of %d points read in windows of %d", Tag(), fRecordLength, fitPoints);
+            chunk = fitPoints;
+         }
+      }
+      SetChunkPoints(chunk);
+      QueueCmd("DAT:SOU " + channels + "\n");
 
       if(IsPushMode()){
-         WriteCmd("!t 300000\n");
+         QueueCmd("!t 300000\n");
       } else {
-         WriteCmd("!t 10000\n");
+         QueueCmd("!t 10000\n");
       }
    }
 
+   //opt-in span tracing, see Tracer.h
+   void ApplyTraceSettings(){
+      Tracer& tracer = Tracer::Get();
+      tracer.SetDirectory(fOdbSettings["Trace Directory"]);
+      tracer.SetThreshold(fOdbSettings["Trace Threshold (ms)"]);
+      tracer.Enable(fOdbSettings["Trace Enable"]);
+   };
+
+   //CPU affinity and SCHED_FIFO priority of the Main and Readout threads
+   void ApplyPlacement(){
+      for(std::string role: {"Main", "Readout"})
+         ThreadPlacement::Get().Configure(role, fOdbSettings[role + " CPUs"], fOdbSettings[role + " Priority"]);
+   };
+
    void BeginOfRun(){
       AlignODB();
+      //every run starts with the calibration
+      UpdateCalibration(true);
+      ApplyTraceSettings();
+      ApplyPlacement();
+      //all threads of the frontend, once
+      if(fIndex == 0){
+         for(const auto& line: ThreadPlacement::Get().Report())
+            cm_msg(MINFO, "BeginOfRun", "%s: %s", Tag(), line.c_str());
+      }
+      cm_msg(MINFO, "BeginOfRun", "%s: scope state queried in %.1f ms", Tag(), fQueryTime);
+      fSampler.SetRate(fOdbSettings["Live Rate"]);
+      fSampler.SetPoints(fOdbSettings["Live Points"]);
+
+      fBackpressure.Configure(BackpressureController::ParsePolicy(fOdbSettings["Backpressure Policy"]),
+                              (double)fOdbSettings["Backpressure High (%)"]/100., (double)fOdbSettings["Backpressure Low (%)"]/100.,
+                              fOdbSettings["Backpressure Prescale"], fOdbSettings["Backpressure Sample Rate (Hz)"]);
+      fBackpressure.Reset();
+      fDecision = BackpressureController::kFull;
    };
 
    void SetEventPointer(WORD* ptr){
       fPointer = (char*)ptr;
+      fSampling = fDecision == BackpressureController::kFull && fSampler.Sample();
+      fFeatures.clear();
+   };
+
+   //ring buffer occupancy 0..1, applies to the next ReadData
+   BackpressureController::Decision Decide(double occupancy){
+      return fDecision = fBackpressure.Decide(occupancy);
+   };
+
+   //once the event is in the ring buffer or dropped, with what was done with it
+   void CountDecision(BackpressureController::Decision done){
+      fBackpressure.Count(done);
+   };
+
+   /* TEKF (TK<k>F): kFeatureWords int32 per channel of the last ReadData, see ExtractFeatures */
+   void WriteFeatureBank(WORD* pdata){
+      int32_t* pfeat;
+      bk_create(pdata, BankName('F').c_str(), TID_INT32, (void **)&pfeat);
+      memcpy(pfeat, fFeatures.data(), fFeatures.size()*sizeof(int32_t));
+      bk_close(pdata, pfeat + fFeatures.size());
+   };
+
+   //backpressure decision counters of the run into the equipment Variables
+   void UpdateBackpressure(){
+      HNDLE hDB;
+      cm_get_experiment_database(&hDB, NULL);
+      auto c = fBackpressure.GetCounters();
+      double values[8] = {(double)c.events, (double)c.full, (double)c.features, (double)c.dropped,
+                          (double)c.transitions, c.degradedTime, (double)c.active, 100.*c.occupancy};
+      const char* names[8] = {"Backpressure Events", "Backpressure Full", "Backpressure Features", "Backpressure Dropped",
+                              "Backpressure Transitions", "Backpressure Degraded (s)", "Backpressure Active", "Buffer Level (%)"};
+      for(int i=0; i<8; i++){
+         std::string path = VariablePath(names[i]);
+         db_set_value(hDB, 0, path.c_str(), &values[i], sizeof(double), 1, TID_DOUBLE);
+      }
+   };
+
+   /* TEKT (TK<k>T): with FastFrame, number of frames n in the TEK<n> banks, then one time per frame
+      in ps since midnight of the scope clock, 0 if unknown (push mode) */
+   void WriteFrameBank(WORD* pdata){
+      if(GetFastFrames() <= 1)
+         return;
+      uint64_t* ptime;
+      bk_create(pdata, BankName('T').c_str(), TID_UINT64, (void **)&ptime);
+      *(ptime++) = GetFastFrames();
+      for(uint64_t t: fFrameTimes)
+         *(ptime++) = t;
+      bk_close(pdata, ptime);
+   };
+
+   /* TEKC (TK<k>C): with Chunk Points, the TEK<n> banks hold one window of the record. Acquisition
+      number, window index, windows per acquisition, first point of the window counted from 0,
+      points in the window and record length */
+   void WriteChunkBank(WORD* pdata){
+      const Chunk& chunk = GetChunk();
+      if(chunk.count <= 1)
+         return;
+      uint32_t* pchunk;
+      bk_create(pdata, BankName('C').c_str(), TID_UINT32, (void **)&pchunk);
+      *(pchunk++) = chunk.acquisition;
+      *(pchunk++) = chunk.index;
+      *(pchunk++) = chunk.count;
+      *(pchunk++) = chunk.first;
+      *(pchunk++) = chunk.points;
+      *(pchunk++) = GetRecordLength();
+      bk_close(pdata, pchunk);
+   };
+
+   /* TEKV (TK<k>V): number of channels, s per sample, s from the trigger to the first sample of the
+      record, V per code and V at code 0 of each channel (0 if disabled), see UpdateCalibration */
+   void WriteCalibrationBank(WORD* pdata){
+      std::lock_guard<std::mutex> lock(fCalibrationMutex);
+      if(!fCalibrationPending)
+         return;
+      double* pcal;
+      bk_create(pdata, BankName('V').c_str(), TID_DOUBLE, (void **)&pcal);
+      memcpy(pcal, fCalibration.data(), fCalibration.size()*sizeof(double));
+      bk_close(pdata, pcal + fCalibration.size());
+      fCalibrationPending = false;
+   };
+
+   /* TEKW (TK<k>W): with 8 bit samples, bits per sample as read from the scope (8), then 1 if the
+      TEK<n> banks were widened to TID_UINT16 (v << 8) or 0 if they are TID_UINT8 */
+   void WriteWidthBank(WORD* pdata){
+      if(GetSampleWidth() != 1)
+         return;
+      uint32_t* pwidth;
+      bk_create(pdata, BankName('W').c_str(), TID_UINT32, (void **)&pwidth);
+      *(pwidth++) = 8*GetSampleWidth();
+      *(pwidth++) = fWiden;
+      bk_close(pdata, pwidth);
+   };
+
+   void PublishSample(){
+      if(fSampling)
+         fSampler.Publish(fEventNumber);
+      fSampling = false;
+   };
+
+   WaveformSampler& GetSampler(){
+      return fSampler;
+   };
+
+   //called once by the readout thread
+   LatencyRecorder& AddLatencyThread(){
+      LatencyRecorder& recorder = fLatency.AddThread();
+      SetSocketLatency(&recorder, kSocket);
+      fPageFaults.Attach();
+      return recorder;
+   };
+
+   //staging buffer of the readout thread for degraded events, only mapped here
+   bool AllocateBuffers(size_t size){
+      try{
+         fStaging = HugePageBuffer(size, fOdbSettings["Huge Pages"]);
+      } catch(std::bad_alloc &ex){
+         cm_msg(MERROR, "AllocateBuffers", "%s: cannot allocate %zu bytes of staging buffer", Tag(), size);
+         return false;
+      }
+      return true;
+   };
+
+   //readout thread, after ThreadPlacement::Register, so the pages are on its NUMA node
+   void PrefaultBuffers(){
+      fStaging.Prefault();
+      cm_msg(MINFO, "PrefaultBuffers", "%s: staging buffer %s", Tag(), fStaging.Describe().c_str());
+   };
+
+   WORD* GetStaging(){
+      return (WORD*)fStaging.Data();
+   };
+
+   //readout thread page faults and dTLB misses per event into the equipment Variables
+   void UpdatePageFaults(){
+      HNDLE hDB;
+      cm_get_experiment_database(&hDB, NULL);
+      auto c = fPageFaults.Read();
+      uint64_t events = fBackpressure.GetCounters().events;
+      double n = events > fLastPageFaultEvents ? events - fLastPageFaultEvents : 0;
+      double values[3] = {0, (double)c.majorFaults, -1};
+      if(n){
+         values[0] = (c.minorFaults - fLastPageFaults.minorFaults)/n;
+         if(c.tlbMisses >= 0 && fLastPageFaults.tlbMisses >= 0)
+            values[2] = (c.tlbMisses - fLastPageFaults.tlbMisses)/n;
+      }
+      fLastPageFaults = c;
+      fLastPageFaultEvents = events;
+
+      const char* names[3] = {"Page Faults per Event", "Major Page Faults", "dTLB Misses per Event"};
+      for(int i=0; i<3; i++){
+         std::string path = VariablePath(names[i]);
+         db_set_value(hDB, 0, path.c_str(), &values[i], sizeof(double), 1, TID_DOUBLE);
+      }
+   };
+
+   //curve throughput and, in pull mode, trigger rate and dead fraction of the run into the equipment Variables
+   void UpdateAcquisition(){
+      HNDLE hDB;
+      cm_get_experiment_database(&hDB, NULL);
+      auto stats = GetAcquisitionStats();
+      double values[3] = {stats.Throughput()/1e6, stats.TriggerRate(), 100.*stats.DeadFraction()};
+      const char* names[3] = {"Throughput (MB/s)", "Trigger Rate (Hz)", "Dead Fraction (%)"};
+      for(int i=0; i<(IsPushMode() ? 1 : 3); i++){
+         std::string path = VariablePath(names[i]);
+         db_set_value(hDB, 0, path.c_str(), &values[i], sizeof(double), 1, TID_DOUBLE);
+      }
+   };
+
+   void EndOfRun(){
+      HNDLE hDB;
+      cm_get_experiment_database(&hDB, NULL);
+      double values[2] = {GetStopTime(), (double)GetStopDiscarded()};
+      const char* names[2] = {"Stop Time (ms)", "Stop Discarded (bytes)"};
+      for(int i=0; i<2; i++){
+         std::string path = VariablePath(names[i]);
+         db_set_value(hDB, 0, path.c_str(), &values[i], sizeof(double), 1, TID_DOUBLE);
+      }
+      cm_msg(MINFO, "EndOfRun", "%s: stopped in %.1f ms%s, %d bytes discarded", Tag(), GetStopTime(),
+             HasControl() ? " over the control connection" : "", GetStopDiscarded());
+
+      UpdateAcquisition();
+      auto stats = GetAcquisitionStats();
+      if(GetChunk().count > 1)
+         cm_msg(MINFO, "EndOfRun", "%s: %.1f MB of curves at %.1f MB/s in windows of %d points", Tag(),
+                stats.bytes/1e6, stats.Throughput()/1e6, GetChunkPoints());
+      if(IsPushMode())
+         return;
+      cm_msg(MINFO, "EndOfRun", "%s: %llu acquisitions, %llu triggers in %.1f s, %.1f triggers/s, dead fraction %.1f%%", Tag(),
+             (unsigned long long)stats.acquisitions, (unsigned long long)stats.triggers, stats.seconds,
+             stats.TriggerRate(), 100.*stats.DeadFraction());
+   };
+
+   //percentiles and rates since the last call into the equipment Variables
+   void UpdateLatency(){
+      HNDLE hDB;
+      cm_get_experiment_database(&hDB, NULL);
+      const char* suffix[5] = {" rate (Hz)", " p50 (us)", " p90 (us)", " p99 (us)", " max (us)"};
+      for(const auto& stage: fLatency.Update()){
+         double values[5] = {stage.rate, stage.p50, stage.p90, stage.p99, stage.max};
+         for(int i=0; i<5; i++){
+            std::string path = VariablePath(stage.stage + suffix[i]);
+            db_set_value(hDB, 0, path.c_str(), &values[i], sizeof(double), 1, TID_DOUBLE);
+         }
+      }
    };
 
    bool ConsumeChannel(int npt, int id){
+      TraceScope trace("ConsumeChannel");
+      trace.SetArg(npt);
       //std::cout << "Consuming channel " << id <<std::endl;
       char* padc;
 
       /* create ADC0 bank */
-      char bkname[] = "TEK0";
-      bkname[3] += id;
-      //bk_create(fPointer, bkname, TID_UINT8, (void **)&padc);
-      bk_create(fPointer, bkname, TID_UINT16, (void **)&padc);
+      std::string bkname = BankName('0' + id);
+      bool narrow = GetSampleWidth() == 1 && !fWiden;
+      bk_create(fPointer, bkname.c_str(), narrow ? TID_UINT8 : TID_UINT16, (void **)&padc);
+      char* pstart = padc;
+      //widened: the bytes go into the upper half of the bank and are widened in place
+      int nsamples = npt/GetSampleWidth();
+      if(GetSampleWidth() == 1 && fWiden)
+         padc += nsamples;
 
       int nbyte = 0;
       //fOutputStream << fEventNumber << ", " << id;
@@ -153,7 +570,23 @@ class tek_midas: public tek {
          padc += n;
       }
 
+      uint16_t* samples = (uint16_t*)pstart;
+      if(GetSampleWidth() == 1 && fWiden){
+         WidenSamples((uint8_t*)pstart + nsamples, samples, nsamples);
+      } else if(narrow && (fSampling || fDecision == BackpressureController::kFeatures)){
+         fWide.resize(nsamples);
+         WidenSamples((uint8_t*)pstart, fWide.data(), nsamples);
+         samples = fWide.data();
+      }
       bk_close(fPointer, padc);
+
+      //first frame only in FastFrame
+      if(fSampling)
+         fSampler.AddWaveform(0, id, samples, nsamples/GetFastFrames());
+      if(fDecision == BackpressureController::kFeatures){
+         fFeatures.resize(fFeatures.size() + kFeatureWords);
+         ExtractFeatures(id, samples, nsamples, &fFeatures[fFeatures.size() - kFeatureWords]);
+      }
       return true;
    };
 
@@ -184,6 +617,7 @@ INT event_buffer_size = 2 * 2 * 1024 * 1024;
 /*-- Function declarations -----------------------------------------*/
 
 INT trigger_thread(void *param);
+INT builder_thread(void *param);
 
 /*-- Equipment list ------------------------------------------------*/
 
@@ -202,7 +636,7 @@ EQUIPMENT equipment[] = {
      500,                    /* poll for 500ms */
      0,                      /* stop run after this event limit */
      0,                      /* number of sub events */
-     0,                      /* don't log history */
+     10,                     /* log history every 10 s (readout latencies) */
      "", "", "",},
     NULL,                    /* readout routine */
     },
@@ -221,19 +655,118 @@ INT interrupt_configure(INT cmd, INT source, PTYPE adr)
    return 1;
 };
 
-tek_midas* instrument;
+/* one per scope, scope 0 is the one of /Equipment/Trigger/Settings */
+std::vector<tek_midas*> instruments;
+/* readout threads that have prefaulted the staging buffer of their scope */
+std::atomic<int> prefaulted_scopes{0};
+
+/*-- Event builder -------------------------------------------------*/
+
+/* With more than one scope each readout thread writes fragments into its own ring buffer
+   and builder_thread merges one fragment per scope into the event. Fragments go together
+   by acquisition order, or with Settings/Merge Window (ms) > 0 when they were found within
+   that window of the oldest one. A scope without a fragment for Merge Timeout (ms) is left
+   out of the event, the events built without it are counted as partial. */
+#define TEK_MAX_SCOPES 10
+
+struct Fragment {
+   uint64_t time;                /* ns, steady clock, tek::GetEventTime */
+   uint32_t size;                /* bytes of bank structure following the header */
+   uint32_t reserved;
+};
+
+std::vector<INT> fragment_rbh;
+double merge_window = 0;         /* ns, 0 merges by acquisition order */
+double merge_timeout = 100e6;    /* ns */
+std::atomic<uint64_t> built_events{0}, partial_events{0}, dropped_fragments{0};
+
+/* builder counters of the run into the equipment Variables */
+void update_builder()
+{
+   if (instruments.size() < 2)
+      return;
+   HNDLE hDB;
+   cm_get_experiment_database(&hDB, NULL);
+   double values[3] = {(double)built_events, (double)partial_events, (double)dropped_fragments};
+   const char* names[3] = {"Built Events", "Partial Events", "Dropped Fragments"};
+   for (int i = 0; i < 3; i++) {
+      std::string path = std::string("/Equipment/Trigger/Variables/") + names[i];
+      db_set_value(hDB, 0, path.c_str(), &values[i], sizeof(double), 1, TID_DOUBLE);
+   }
+}
+
+/*-- Live display --------------------------------------------------*/
+
+/* binary RPC used by web/waveforms.html, "waveforms" returns the last sampled event of the
+   first scope, "trace" writes the trace buffers (Settings/Trace Enable) and returns the file name */
+INT rpc_callback(INT index, void *prpc_param[])
+{
+   const char* cmd = CSTRING(0);
+   char* return_buf = (char*)CARRAY(2);
+   INT* return_length = CPINT(3);
+
+   if(!instruments.empty() && strcmp(cmd, "waveforms") == 0)
+      *return_length = instruments[0]->GetSampler().CopySnapshot(return_buf, *return_length);
+   else if(strcmp(cmd, "trace") == 0)
+      *return_length = snprintf(return_buf, *return_length, "%s", Tracer::Get().Dump().c_str());
+   else
+      *return_length = 0;
+
+   return SUCCESS;
+}
 
 /*-- Frontend Init -------------------------------------------------*/
 
 INT frontend_init()
 {
-   instrument = new tek_midas(true); //set to false for polling mode
+   int nscopes = 1;
+   try {
+      /* Settings/Pull Mode arms and reads each acquisition, needed before the scopes are created */
+      midas::odb mode = {{"Pull Mode", false}};
+      mode.connect("/Equipment/Trigger/Settings");
+      bool pull = mode["Pull Mode"];
+      instruments.push_back(new tek_midas(!pull));
+      nscopes = instruments[0]->GetSettings()["Scopes"];
+      if (nscopes < 1 || nscopes > TEK_MAX_SCOPES) {
+         cm_msg(MERROR, "frontend_init", "Trigger: %d scopes, using 1 to %d", nscopes, TEK_MAX_SCOPES);
+         nscopes = nscopes < 1 ? 1 : TEK_MAX_SCOPES;
+      }
+      for (int k = 1; k < nscopes; k++)
+         instruments.push_back(new tek_midas(!pull, k));
+   } catch (std::runtime_error &ex) {
+      cm_msg(MERROR, "frontend_init", "Trigger: scope %zu: %s", instruments.size(), ex.what());
+      return FE_ERR_HW;
+   }
+   for (auto* instrument: instruments)
+      instrument->SetScopeCount(nscopes);
+
+   cm_register_function(RPC_BRPC, rpc_callback);
+
+   /* pin the mfe main thread first, the ring buffers are then allocated on its NUMA node */
+   ThreadPlacement::Get().Register("Main");
+
+   /* staging buffer for degraded events, only mapped here, each readout thread prefaults its own */
+   for (auto* instrument: instruments)
+      if (!instrument->AllocateBuffers(max_event_size))
+         return FE_ERR_DRIVER;
 
    /* create a ring buffer for each thread */
    create_event_rb(0);
+   if (nscopes > 1) {
+      fragment_rbh.resize(nscopes);
+      for (int k = 0; k < nscopes; k++)
+         rb_create(event_buffer_size, max_event_size, &fragment_rbh[k]);
+   }
+
+   /* create readout threads, one per scope, and the builder of their fragments */
+   for (int k = 0; k < nscopes; k++)
+      ss_thread_create(trigger_thread, (void *)(intptr_t)k);
+   if (nscopes > 1)
+      ss_thread_create(builder_thread, (void *)(intptr_t)nscopes);
 
-   /* create readout thread */
-   ss_thread_create(trigger_thread, NULL);
+   /* no run can start before the readout threads took the page faults of their buffers */
+   while (prefaulted_scopes < nscopes)
+      ss_sleep(1);
 
    return CM_SUCCESS;
 }
@@ -249,7 +782,13 @@ INT frontend_exit()
 
 INT begin_of_run(INT run_number, char *error)
 {
-   instrument->Start();
+   midas::odb& settings = instruments[0]->GetSettings();
+   merge_window = (double)settings["Merge Window (ms)"] * 1e6;
+   merge_timeout = (double)settings["Merge Timeout (ms)"] * 1e6;
+   built_events = partial_events = dropped_fragments = 0;
+
+   for (auto* instrument: instruments)
+      instrument->Start();
    return CM_SUCCESS;
 }
 
@@ -257,7 +796,12 @@ INT begin_of_run(INT run_number, char *error)
 
 INT end_of_run(INT run_number, char *error)
 {
-   instrument->Stop();
+   for (auto* instrument: instruments)
+      instrument->Stop();
+   update_builder();
+   if (instruments.size() > 1)
+      cm_msg(MINFO, "end_of_run", "Trigger: %llu events built, %llu partial, %llu fragments dropped",
+             (unsigned long long)built_events, (unsigned long long)partial_events, (unsigned long long)dropped_fragments);
    return CM_SUCCESS;
 }
 
@@ -279,10 +823,20 @@ INT resume_run(INT run_number, char *error)
 
 INT frontend_loop()
 {
-
-   /*if(! instrument->IsStreaming()){
-	   instrument->AlignODB(true);
-   }*/
+   static DWORD lastLatencyUpdate = 0;
+   if(ss_time() - lastLatencyUpdate >= 10){
+      for (auto* instrument: instruments) {
+         instrument->UpdateLatency();
+         instrument->UpdateBackpressure();
+         instrument->UpdatePageFaults();
+         instrument->UpdateAcquisition();
+         /* settings changed on the scope, during the run only over the control connection */
+         if(instrument->HasControl() || !instrument->IsStreaming())
+            instrument->AlignODB(true);
+      }
+      update_builder();
+      lastLatencyUpdate = ss_time();
+   }
    return CM_SUCCESS;
 }
 
@@ -292,40 +846,83 @@ INT frontend_loop()
 
 INT trigger_thread(void *param)
 {
-   EVENT_HEADER *pevent;
+   int index = (int)(intptr_t)param;
+   tek_midas* instrument = instruments[index];
+   /* a single scope writes events, with more the builder merges their fragments */
+   bool direct = instruments.size() == 1;
+   EVENT_HEADER *pevent = nullptr;
+   Fragment *pfrag = nullptr;
+   void *pwrite;
    WORD *pdata;
-   int  i, status, exit = FALSE;
+   int  status, exit = FALSE;
    INT rbh;
    
    /* tell framework that we are alive */
-   signal_readout_thread_active(0, TRUE);
+   signal_readout_thread_active(index, TRUE);
 
    /* set name of thread as seen by OS */
-   ss_thread_set_name(std::string(equipment[0].name) + "RT");
+   ss_thread_set_name(std::string(equipment[0].name) + "RT" + (index ? std::to_string(index) : ""));
    
    /* Initialize hardware here ... */
-   printf("Start readout thread\n");
+   printf("Start readout thread %d\n", index);
    
    /* Obtain ring buffer for inter-thread data exchange */
-   rbh = get_event_rbh(0);
+   rbh = direct ? get_event_rbh(0) : fragment_rbh[index];
+
+   /* CPU affinity and priority from the Readout settings, pages first touched from here on are NUMA local */
+   ThreadPlacement::Get().Register("Readout");
+   instrument->PrefaultBuffers();
+   prefaulted_scopes++;
+
+   LatencyRecorder& latency = instrument->AddLatencyThread();
+   Tracer::Get().SetThreadName(index ? "readout " + std::to_string(index) : "readout");
+   uint64_t waitStart = 0;
+
+   /* degraded events are read here first, they need no or little ring buffer space */
+   WORD* staging = instrument->GetStaging();
    
    while (is_readout_thread_enabled()) {
 
       if (!readout_enabled() && !instrument->IsStreaming()) {
          // do not produce events when run is stopped
+         waitStart = 0;
          ss_sleep(10);
          continue;
       }
 
+      if (!waitStart)
+         waitStart = LatencyRecorder::Now();
+
       if (instrument->HasEvent()) { // if event available, read it out
+         uint64_t t = latency.Record(tek_midas::kWaitEvent, waitStart);
+         waitStart = 0;
 
          // check once more in case state changed during the poll
          if (!is_readout_thread_enabled())
             break;
 
+         // degrade before the ring buffer is full, the scope is always read out
+         int level = 0;
+         rb_get_buffer_level(rbh, &level);
+         BackpressureController::Decision decision = instrument->Decide((double)level/event_buffer_size);
+         if (decision != BackpressureController::kFull) {
+            bk_init32(staging);
+            instrument->SetEventPointer(staging);
+            bool ok = instrument->ReadData();
+            t = latency.Record(tek_midas::kReadData, t);
+            if (!ok || decision == BackpressureController::kDrop) {
+               // the builder still gets an empty fragment, merging by order needs one per acquisition
+               if (direct) {
+                  instrument->CountDecision(BackpressureController::kDrop);
+                  continue;
+               }
+               decision = BackpressureController::kDrop;
+            }
+         }
+
          // obtain buffer space
          do {
-            status = rb_get_wp(rbh, (void **) &pevent, 0);
+            status = rb_get_wp(rbh, &pwrite, 0);
             if (status == DB_TIMEOUT) {
                ss_sleep(10);
                // check for readout thread disable, thread might be stop from main thread
@@ -340,25 +937,176 @@ INT trigger_thread(void *param)
          if (exit)
             break;
 
-         bm_compose_event_threadsafe(pevent, 1, 0, 0, &equipment[0].serial_number);
-         pdata = (WORD *)(pevent + 1);
+         t = latency.Record(tek_midas::kRingBuffer, t);
+
+         if (direct) {
+            pevent = (EVENT_HEADER *)pwrite;
+            bm_compose_event_threadsafe(pevent, 1, 0, 0, &equipment[0].serial_number);
+            pdata = (WORD *)(pevent + 1);
+         } else {
+            pfrag = (Fragment *)pwrite;
+            pfrag->time = instrument->GetEventTime();
+            pdata = (WORD *)(pfrag + 1);
+         }
          
          /* init bank structure */
          bk_init32(pdata);
+
+         /* at begin of run and after a change of the scope settings */
+         instrument->WriteCalibrationBank(pdata);
          
-         instrument->SetEventPointer(pdata);
-         instrument->ReadData();
-         pevent->data_size = bk_size(pdata);
+         if (decision == BackpressureController::kFull) {
+            instrument->SetEventPointer(pdata);
+            if(instrument->ReadData()){
+               instrument->WriteFrameBank(pdata);
+               instrument->WriteChunkBank(pdata);
+               instrument->WriteWidthBank(pdata);
+               instrument->PublishSample();
+            } else {
+               decision = BackpressureController::kDrop;
+            }
+            latency.Record(tek_midas::kReadData, t);
+         } else if (decision == BackpressureController::kFeatures) {
+            instrument->WriteFeatureBank(pdata);
+            instrument->WriteChunkBank(pdata);
+         }
 
          /* send event to ring buffer */
-         rb_increment_wp(rbh, sizeof(EVENT_HEADER) + pevent->data_size);
+         if (direct) {
+            pevent->data_size = bk_size(pdata);
+            rb_increment_wp(rbh, sizeof(EVENT_HEADER) + pevent->data_size);
+         } else {
+            pfrag->size = bk_size(pdata);
+            rb_increment_wp(rbh, sizeof(Fragment) + pfrag->size);
+         }
+         instrument->CountDecision(decision);
       }
    }
    
+   ThreadPlacement::Get().Unregister();
+
    /* tell framework that we are finished */
-   signal_readout_thread_active(0, FALSE);
+   signal_readout_thread_active(index, FALSE);
    
-   printf("Stop readout thread\n");
+   printf("Stop readout thread %d\n", index);
+
+   return 0;
+}
+
+/* merges the fragments of the scopes into events, see Event builder */
+INT builder_thread(void *param)
+{
+   int slot = (int)(intptr_t)param;
+   size_t nscopes = instruments.size();
+   std::vector<Fragment*> head(nscopes, nullptr);
+   std::vector<bool> take(nscopes);
+   EVENT_HEADER *pevent;
+   int status, exit = FALSE;
+
+   signal_readout_thread_active(slot, TRUE);
+   ss_thread_set_name(std::string(equipment[0].name) + "EB");
+   printf("Start event builder\n");
+
+   INT rbh = get_event_rbh(0);
+   ThreadPlacement::Get().Register("Readout");
+
+   while (is_readout_thread_enabled()) {
+      bool running = readout_enabled();
+      for (auto* instrument: instruments)
+         running = running || instrument->IsStreaming();
+
+      // the oldest fragment of each scope
+      size_t present = 0;
+      uint64_t oldest = UINT64_MAX;
+      for (size_t k = 0; k < nscopes; k++) {
+         if (!head[k] && rb_get_rp(fragment_rbh[k], (void **) &head[k], 0) != DB_SUCCESS)
+            head[k] = nullptr;
+         if (head[k]) {
+            present++;
+            oldest = head[k]->time < oldest ? head[k]->time : oldest;
+         }
+      }
+      if (!present) {
+         ss_sleep(1);
+         continue;
+      }
+
+      // all of them by order, within the window of the oldest by time
+      size_t ntake = 0;
+      uint32_t size = sizeof(BANK_HEADER);
+      for (size_t k = 0; k < nscopes; k++) {
+         take[k] = head[k] && (merge_window <= 0 || head[k]->time - oldest <= merge_window);
+         if (take[k]) {
+            ntake++;
+            size += ((BANK_HEADER *)(head[k] + 1))->data_size;
+         }
+      }
+
+      bool drop = false;
+      if (ntake < nscopes) {
+         // a scope with a later fragment has missed this acquisition, one without any may still
+         // send it until the timeout. Partial events are built during the run only.
+         if (present < nscopes && LatencyRecorder::Now() < oldest + merge_timeout) {
+            ss_sleep(1);
+            continue;
+         }
+         drop = !running;
+      }
+      if (size + sizeof(EVENT_HEADER) > (size_t)max_event_size) {
+         cm_msg(MERROR, "builder_thread", "Trigger: event of %u bytes does not fit into max_event_size, dropped", size);
+         drop = true;
+      }
+
+      if (!drop) {
+         // obtain buffer space
+         do {
+            status = rb_get_wp(rbh, (void **) &pevent, 0);
+            if (status == DB_TIMEOUT) {
+               ss_sleep(10);
+               if (!is_readout_thread_enabled()) {
+                  exit = TRUE;
+                  break;
+               }
+            }
+         } while (status != DB_SUCCESS);
+
+         if (exit)
+            break;
+
+         bm_compose_event_threadsafe(pevent, 1, 0, 0, &equipment[0].serial_number);
+         WORD *pdata = (WORD *)(pevent + 1);
+         bk_init32(pdata);
+
+         // bank structures of the same format are concatenated by their payload
+         BANK_HEADER *pbh = (BANK_HEADER *)pdata;
+         for (size_t k = 0; k < nscopes; k++) {
+            if (!take[k])
+               continue;
+            BANK_HEADER *pfh = (BANK_HEADER *)(head[k] + 1);
+            memcpy((char *)(pbh + 1) + pbh->data_size, pfh + 1, pfh->data_size);
+            pbh->data_size += pfh->data_size;
+         }
+         pevent->data_size = bk_size(pdata);
+         rb_increment_wp(rbh, sizeof(EVENT_HEADER) + pevent->data_size);
+
+         built_events++;
+         if (ntake < nscopes)
+            partial_events++;
+      } else {
+         dropped_fragments += ntake;
+      }
+
+      for (size_t k = 0; k < nscopes; k++) {
+         if (take[k]) {
+            rb_increment_rp(fragment_rbh[k], sizeof(Fragment) + head[k]->size);
+            head[k] = nullptr;
+         }
+      }
+   }
+
+   ThreadPlacement::Get().Unregister();
+   signal_readout_thread_active(slot, FALSE);
+   printf("Stop event builder\n");
 
    return 0;
 }
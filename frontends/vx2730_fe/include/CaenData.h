@@ -2,7 +2,9 @@
 #define CAEN_DATA_H
 
 #include <vector>
+#include <memory>
 #include <stdint.h>
+#include "HugePages.h"
 
 //base class
 class CaenData {
@@ -39,20 +41,27 @@ class CaenScopeData : public CaenData{
     //bool board_fail;
     //uint8_t samples_overlapped;
 
-    CaenScopeData(uint64_t numch, uint64_t recordlengths): CaenData(), waveform(numch), waveform_size(numch, 0) {
+    //waveform buffers come from bufferPool if given, its blocks have to hold recordlengths samples
+    CaenScopeData(uint64_t numch, uint64_t recordlengths, std::shared_ptr<BlockPool> bufferPool = nullptr): CaenData(), waveform(numch), waveform_size(numch, 0), pool(bufferPool) {
       for(auto& wf: waveform){
-        wf = new uint16_t[recordlengths];
+        wf = pool ? (uint16_t*)pool->Get() : new uint16_t[recordlengths];
       }
     };
     virtual ~CaenScopeData() {
       for(auto& wf: waveform){
-        delete[] wf;
+        if(pool)
+          pool->Put(wf);
+        else
+          delete[] wf;
         wf = nullptr;
       }
     };
 
     void Print() noexcept final;
     uint64_t Serialize(uint8_t* ptr, uint64_t maxsize=0) final;
+
+  private:
+    std::shared_ptr<BlockPool> pool;
 };
 
 #endif
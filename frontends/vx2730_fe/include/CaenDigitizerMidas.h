@@ -4,10 +4,20 @@
 #include <iostream>
 #include <thread>
 #include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <map>
 #include "midas.h"
 #include "msystem.h"
 #include "odbxx.h"
 #include "CaenDigitizer.h"
+#include "WaveformSampler.h"
+#include "WaveformFeatures.h"
+#include "LatencyMonitor.h"
+#include "Tracer.h"
+#include "BackpressureController.h"
+#include "ThreadPlacement.h"
+#include "HugePages.h"
 
 using namespace std::chrono_literals;
 
@@ -33,11 +43,97 @@ private:
     const EQUIPMENT* fMidasEquipment;
 
     void parameterToOdb(midas::odb& odb, CaenParameter& param);
-    void odbToParameter(CaenParameter& param, midas::odb& odb);
+    static std::string odbToValue(midas::odb& odb);
 
     std::vector<std::string> parametersToSync;
     std::vector<std::string> channelParametersToSync;
 
+    //live display, fed by ReadData
+    WaveformSampler fSampler;
+
+    //one W<x>PK bank per event instead of one W<x><yy> bank per channel
+    bool fPackedBanks = false;
+    void WritePackedBank(char* pevent, CaenScopeData* scopedata);
+
+    //readout stage latencies, the recorder belongs to the mfe readout thread
+    enum LatencyStage {kWaitData, kFELibRead, kComposeBanks, kRingBuffer};
+    LatencyMonitor fLatency{{"HasData", "ReadData", "Banks", "RingBuffer"}};
+    LatencyRecorder* fRecorder = nullptr;
+    uint64_t fWaitStart = 0;
+    uint64_t fDataReady = 0;
+
+    //opt-in span tracing, see Tracer.h
+    void ApplyTraceSettings();
+
+    //degradation policy when the ring buffer fills, decided by the readout thread before ReadData
+    BackpressureController fBackpressure;
+    BackpressureController::Decision fDecision = BackpressureController::kFull;
+    void WriteFeatureBank(char* pevent, CaenScopeData* scopedata);
+
+    //CPU affinity and SCHED_FIFO priority of the Main, Readout and Sync threads
+    void ApplyPlacement();
+
+    //waveform buffers for kPoolEvents events, on huge pages if Settings/Huge Pages is set
+    static const int kPoolEvents = 4;
+    std::shared_ptr<BlockPool> fBufferPool;
+    //readout thread faults, attached with the latency recorder
+    PageFaultMonitor fPageFaults;
+    PageFaultMonitor::Counters fLastPageFaults;
+    uint64_t fLastPageFaultEvents = 0;
+
+    //W<x>CV sample to volts and time from the board parameters, into the next event when it
+    //changes. The settings callbacks only mark it stale, the sync thread reads the board.
+    std::mutex fCalibrationMutex;
+    std::vector<double> fCalibration;
+    bool fCalibrationPending = false;
+    std::atomic<bool> fCalibrationStale{false};
+    void UpdateCalibration(bool force = false);
+    void WriteCalibrationBank(char* pevent);
+
+    //the settings callbacks only queue the new values. The sync thread applies them once the
+    //callbacks are quiet for kCoalesceWindow, equal values of consecutive channels with one range
+    //set /ch/a..b/par/<name>, and StartRun applies what is left before reading the board back.
+    static constexpr auto kCoalesceWindow = 20ms;
+    static constexpr auto kCoalesceLimit = 500ms;
+    //consecutive changes of one parameter, in arrival order
+    struct PendingSetting {
+      std::string name;
+      std::map<int, std::string> values; //by channel, -1 for the board parameter
+    };
+    std::mutex fSettingsMutex;
+    std::condition_variable fSettingsChanged;
+    std::vector<PendingSetting> fPendingSettings;
+    std::chrono::steady_clock::time_point fLastSetting;
+    std::mutex fApplyMutex; //batches go to the board in order
+    void QueueSetting(int channel, midas::odb& o);
+    void ApplySettings(bool wait = true);
+
+    //in-run scan, Settings/Scan Enable: Scan Parameter, a FELib path such as /ch/10/par/triggerthr
+    //or /ch/0..63/par/dcoffset, steps through the comma separated Scan Values, Scan Events events
+    //or Scan Time (s) per point. Between points the readout thread stops the acquisition, sets the
+    //next value and starts again, without a run transition. Every event of the scan has a W<x>SP
+    //bank, Variables/Scan Done is set after the last point. The ODB settings keep the value from
+    //before the scan, StopRun restores it on the board.
+    std::string fScanParameter;
+    std::vector<std::string> fScanValues;
+    std::atomic<int> fScanPoint{-1}; //-1 without a scan, fScanValues.size() when done
+    uint64_t fScanEvents = 0; //per point, 0 to step by time
+    double fScanTime = 0;
+    uint64_t fScanPointEvents = 0;
+    std::chrono::steady_clock::time_point fScanPointStart;
+    double fScanPause = 0; //ms, last step
+    double fScanPauseTotal = 0;
+    uint64_t fScanDropped = 0; //read after the last event of a point
+    std::mutex fScanMutex; //a step against StopRun
+    std::vector<std::pair<std::string, std::string>> fScanRestore; //path and value before the scan
+    void RestoreScan();
+    bool IsScanning() const { return fScanPoint >= 0 && fScanPoint < (int)fScanValues.size(); }
+    bool IsScanDone() const { return fScanPoint >= 0 && !IsScanning(); }
+    bool StartScan();
+    void NextScanPoint();
+    void WriteScanBank(char* pevent);
+    void UpdateScan();
+
 public:
     CaenDigitizerMidas(int index, EQUIPMENT* eq);
     void Sync(bool all=true); //populate ODB with parameters
@@ -47,16 +143,37 @@ public:
     DaqState state = DaqState::Uninitialized;
 
     INT Initialize();
+    //maps the waveform buffers, after Initialize
+    void AllocateBuffers();
+    //readout thread, after ThreadPlacement::Register, so the pages are on its NUMA node
+    void PrefaultBuffers();
     INT Terminate();
     INT Configure();
     INT StartRun();
     INT StopRun();
 
     INT HasData();
+    //pevent may be nullptr if the event is dropped
     INT ReadData(char* pevent);
 
+    //ring buffer occupancy 0..1, applies to the next ReadData
+    BackpressureController::Decision Decide(double occupancy) { return fDecision = fBackpressure.Decide(occupancy); }
+    //after the event is in the ring buffer, ReadData counts the dropped ones
+    void CountDecision(BackpressureController::Decision done) { fBackpressure.Count(done); }
+
     void SettingsCallback(midas::odb &o);
     void ChannelCallback(int channel, midas::odb &o);
+    //re-applies the placement when a "* CPUs" or "* Priority" setting changes
+    void PlacementCallback(midas::odb &o);
+
+    WaveformSampler& GetSampler() { return fSampler; }
+
+    //percentiles and rates since the last call into the equipment Variables
+    void UpdateLatency();
+    //backpressure decision counters of the run into the equipment Variables
+    void UpdateBackpressure();
+    //readout thread page faults and dTLB misses per event into the equipment Variables
+    void UpdatePageFaults();
 
     void AutoSyncParameter(const std::string& name){
       parametersToSync.push_back("/par/"+name);
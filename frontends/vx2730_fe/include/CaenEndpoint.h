@@ -7,6 +7,7 @@
 
 class CaenDigitizer;
 class CaenData;
+class BlockPool;
 
 //base class
 class CaenEndpoint {
@@ -70,9 +71,13 @@ class CaenScopeEndpoint : public CaenEndpoint{
     virtual ~CaenScopeEndpoint() noexcept {};
     std::unique_ptr<CaenData> ReadData() final;
 
+    //preallocated waveform buffers, ignored if its blocks are smaller than the record length
+    void SetBufferPool(std::shared_ptr<BlockPool> p) { pool = p; }
+
   protected:
     uint64_t numch;
     uint64_t recordlengths;
+    std::shared_ptr<BlockPool> pool;
     void Configure();
 };
 
@@ -53,6 +53,10 @@ class CaenParameter {
       //basic get-set
       std::string Get();
       void Set(const std::string &value);
+      //set of a descendant without a handle for it, path may be a range like /ch/0..63/par/chenable
+      void Set(const std::string &path, const std::string &value);
+      //get of a descendant without a handle for it, single nodes only
+      std::string Get(const std::string &path);
 
       //getters for attributes
       AccessMode GetAccessMode() const noexcept {
@@ -1,14 +1,32 @@
 #include "CaenDigitizer.h"
 #include "CaenDigitizerMidas.h"
 #include "odbxx.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
 
 
-CaenDigitizerMidas::CaenDigitizerMidas(int index, EQUIPMENT* eq): fFrontendIndex(index), fMidasEquipment(eq), fOdbSettings({{"Hostname", "192.168.50.22"}, {"Protocol", "Dig2:"}}) {
+CaenDigitizerMidas::CaenDigitizerMidas(int index, EQUIPMENT* eq): fFrontendIndex(index), fMidasEquipment(eq), fOdbSettings({{"Hostname", "192.168.50.22"}, {"Protocol", "Dig2:"}, {"Live Rate", 10.}, {"Live Points", 1000}, {"Packed Banks", false}, {"Trace Enable", false}, {"Trace Threshold (ms)", 0.}, {"Trace Directory", ""}, {"Backpressure Policy", "none"}, {"Backpressure High (%)", 80.}, {"Backpressure Low (%)", 50.}, {"Backpressure Prescale", 10}, {"Backpressure Sample Rate (Hz)", 10.}, {"Main CPUs", ""}, {"Main Priority", 0}, {"Readout CPUs", ""}, {"Readout Priority", 0}, {"Sync CPUs", ""}, {"Sync Priority", 0}, {"Huge Pages", true}, {"Scan Enable", false}, {"Scan Parameter", ""}, {"Scan Values", ""}, {"Scan Events", 1000}, {"Scan Time (s)", 0.}}) {
   fOdbSettings.connect("/Equipment/"+std::string(fMidasEquipment->name)+"/Settings");
   fOdbVariables.connect("/Equipment/"+std::string(fMidasEquipment->name)+"/Variables");
   fOdbStatus.connect("/Equipment/"+std::string(fMidasEquipment->name)+"/Status");
 
   digitizer = CaenDigitizer::MakeNewDigitizer();
+  ApplyTraceSettings();
+  ApplyPlacement();
+}
+
+void CaenDigitizerMidas::ApplyPlacement() {
+  for(std::string role: {"Main", "Readout", "Sync"})
+    ThreadPlacement::Get().Configure(role, fOdbSettings[role + " CPUs"], fOdbSettings[role + " Priority"]);
+}
+
+void CaenDigitizerMidas::ApplyTraceSettings() {
+  Tracer& tracer = Tracer::Get();
+  tracer.SetDirectory(fOdbSettings["Trace Directory"]);
+  tracer.SetThreshold(fOdbSettings["Trace Threshold (ms)"]);
+  tracer.Enable(fOdbSettings["Trace Enable"]);
 }
 
 void CaenDigitizerMidas::parameterToOdb(midas::odb& odb, CaenParameter& param){
@@ -57,35 +75,38 @@ void CaenDigitizerMidas::parameterToOdb(midas::odb& odb, CaenParameter& param){
   odb.set_trigger_hotlink(true);
 }
 
-void CaenDigitizerMidas::odbToParameter(CaenParameter& param, midas::odb& odb){
-  switch(param.GetDataType()){
-  case CaenParameter::DataType::Boolean:
-    {
-      param = (bool)odb;
-    }
-    break;
-  case CaenParameter::DataType::Integer:
-    {
-      param = (int)odb;
-    }
-    break;
-  case CaenParameter::DataType::Positive:
-    {
-      param = (uint64_t)odb;
-    }
-    break;
-  case CaenParameter::DataType::Floating:
-    {
-      param = (double)odb;
-    }
-    break;
-  case CaenParameter::DataType::String:
+//the parameter value as FELib takes it, parameterToOdb picks the ODB type from the parameter type
+std::string CaenDigitizerMidas::odbToValue(midas::odb& odb){
+  switch(odb.get_tid()){
+  case TID_BOOL:
+    return (bool)odb ? "True" : "False";
+  case TID_INT8:
+  case TID_INT16:
+  case TID_INT32:
+  case TID_INT64:
+    return std::to_string((int64_t)odb);
+  case TID_UINT8:
+  case TID_UINT16:
+  case TID_UINT32:
+  case TID_UINT64:
+    return std::to_string((uint64_t)odb);
+  case TID_FLOAT:
+  case TID_DOUBLE:
     {
-      param = (std::string)odb;
+      //shortest text that reads back as the same value, std::to_string has 6 fixed decimals
+      double value = odb;
+      bool single = odb.get_tid() == TID_FLOAT;
+      char text[32];
+      for(int digits=6; digits<=17; digits++){
+        snprintf(text, sizeof(text), "%.*g", digits, value);
+        double back = strtod(text, nullptr);
+        if(single ? (float)back == (float)value : back == value)
+          break;
+      }
+      return text;
     }
-    break;
   default:
-    break;
+    return (std::string)odb;
   }
 }
 
@@ -114,6 +135,8 @@ INT CaenDigitizerMidas::Initialize() {
       ch.watch(fCh);
       i++;
     }
+    std::function<void(midas::odb&)> fPlacement = std::bind(&CaenDigitizerMidas::PlacementCallback, this, std::placeholders::_1);
+    fOdbSettings.watch(fPlacement);
 
   } catch(CaenException &ex){
     std::cout << "Error popularing ODB" <<std::endl;
@@ -132,6 +155,7 @@ INT CaenDigitizerMidas::Initialize() {
 
 INT CaenDigitizerMidas::Terminate() {
   runSyncThread = false;
+  fSettingsChanged.notify_one();
   syncThread.join();
   digitizer->Disconnect();
   state = DaqState::Uninitialized;
@@ -139,29 +163,125 @@ INT CaenDigitizerMidas::Terminate() {
 }
 
 void CaenDigitizerMidas::SettingsCallback(midas::odb &o) {
-  std::cout << "ODB State changed: " << o.get_name() << " -> " << o << std::endl;
-  auto rootParameter = digitizer->GetRootParameter();
-  auto myParameter = rootParameter["/par/"+ o.get_name()];
-
-  odbToParameter(myParameter, o);
+  TraceScope trace("SettingsCallback");
+  QueueSetting(-1, o);
 }
 
 void CaenDigitizerMidas::ChannelCallback(int channel, midas::odb &o) {
-  std::cout << "ODB State changed for channel "<< channel <<": " << o.get_name() << " -> " << o << std::endl;
-  auto rootParameter = digitizer->GetRootParameter();
-  auto myParameter = rootParameter["/ch/"+std::to_string(channel) + "/par/"+ o.get_name()];
+  TraceScope trace("ChannelCallback");
+  trace.SetArg(channel);
+  QueueSetting(channel, o);
+}
+
+void CaenDigitizerMidas::PlacementCallback(midas::odb &o) {
+  std::string name = o.get_name();
+  auto endsWith = [&name](const std::string& suffix) {
+    return name.size() >= suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0;
+  };
+  if(endsWith(" CPUs") || endsWith(" Priority"))
+    ApplyPlacement();
+}
 
-  odbToParameter(myParameter, o);
+void CaenDigitizerMidas::QueueSetting(int channel, midas::odb &o) {
+  std::string name = o.get_name();
+  std::string value = odbToValue(o);
+  {
+    std::lock_guard<std::mutex> lock(fSettingsMutex);
+    //arrival order is kept, only consecutive changes of the same parameter are merged
+    if(fPendingSettings.empty() || fPendingSettings.back().name != name || (fPendingSettings.back().values.begin()->first < 0) != (channel < 0))
+      fPendingSettings.push_back(PendingSetting{name, {}});
+    //a later change of the same value replaces the earlier one
+    fPendingSettings.back().values[channel] = value;
+    fLastSetting = std::chrono::steady_clock::now();
+  }
+  fSettingsChanged.notify_one();
+}
+
+void CaenDigitizerMidas::ApplySettings(bool wait) {
+  std::lock_guard<std::mutex> applyLock(fApplyMutex);
+  std::vector<PendingSetting> pending;
+  {
+    std::unique_lock<std::mutex> lock(fSettingsMutex);
+    if(fPendingSettings.empty())
+      return;
+    //an ODBSET on Channel*/<name> arrives as one callback per channel
+    auto start = std::chrono::steady_clock::now();
+    while(wait && runSyncThread){
+      auto now = std::chrono::steady_clock::now();
+      if(now - fLastSetting >= kCoalesceWindow || now - start >= kCoalesceLimit)
+        break;
+      fSettingsChanged.wait_until(lock, fLastSetting + kCoalesceWindow);
+    }
+    pending.swap(fPendingSettings);
+  }
+
+  TraceScope trace("ApplySettings");
+  auto start = std::chrono::steady_clock::now();
+  auto root = digitizer->GetRootParameter();
+  int nvalues = 0;
+  int nsets = 0;
+  for(const auto& setting: pending){
+    for(auto it = setting.values.begin(); it != setting.values.end(); nsets++){
+      auto last = it;
+      auto next = std::next(it);
+      while(it->first >= 0 && next != setting.values.end() && next->first == last->first + 1 && next->second == it->second)
+        last = next++;
+
+      std::string path = "/par/" + setting.name;
+      if(it->first >= 0)
+        path = "/ch/" + std::to_string(it->first) + (last != it ? ".." + std::to_string(last->first) : "") + path;
+      try{
+        root.Set(path, it->second);
+      } catch(CaenException &ex){
+        cm_msg(MERROR, "ApplySettings", "%s: cannot set %s to %s: %s", fMidasEquipment->name, path.c_str(), it->second.c_str(), ex.what());
+      }
+      nvalues += std::distance(it, next);
+      it = next;
+    }
+  }
+  trace.SetArg(nvalues);
+  fCalibrationStale = true;
+
+  std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+  cm_msg(MDEBUG, "ApplySettings", "%s: applied %d ODB changes with %d sets in %.1f ms", fMidasEquipment->name, nvalues, nsets, elapsed.count());
+}
+
+void CaenDigitizerMidas::AllocateBuffers() {
+  if(state == DaqState::Uninitialized || state == DaqState::Error)
+    return;
+
+  try{
+    auto root = digitizer->GetRootParameter();
+    uint64_t numch = (uint64_t)root["/par/numch"];
+    uint64_t recordlengths = (uint64_t)root["/par/recordlengths"];
+    fBufferPool = std::make_shared<BlockPool>(recordlengths*sizeof(uint16_t), numch*kPoolEvents, fOdbSettings["Huge Pages"]);
+  } catch(CaenException &ex){
+    std::cout << "Error " << ex.GetName() << ": " << ex.GetDescription() << std::endl;
+    return;
+  } catch(std::bad_alloc &ex){
+    cm_msg(MERROR, "AllocateBuffers", "%s: cannot allocate waveform buffers, using the heap", fMidasEquipment->name);
+    return;
+  }
+}
+
+void CaenDigitizerMidas::PrefaultBuffers() {
+  if(!fBufferPool)
+    return;
+  fBufferPool->Prefault();
+  cm_msg(MINFO, "PrefaultBuffers", "%s: waveform buffers %s", fMidasEquipment->name, fBufferPool->GetBuffer().Describe().c_str());
 }
 
 INT CaenDigitizerMidas::Configure() {
   if(state != DaqState::Unconfigured && state != DaqState::Configured)
     return FE_ERR_DRIVER;
+  TraceScope trace("Configure");
 
   //setup endpoints
   try{
     //digitizer->ConfigureEndpoint(std::make_unique<CaenRawEndpoint>());
-    digitizer->ConfigureEndpoint(std::make_unique<CaenScopeEndpoint>());
+    auto endpoint = std::make_unique<CaenScopeEndpoint>();
+    endpoint->SetBufferPool(fBufferPool);
+    digitizer->ConfigureEndpoint(std::move(endpoint));
     digitizer->RunCmd("armacquisition");
   } catch(CaenException &ex){
     std::cout << "Error configuring endpoint" <<std::endl;
@@ -178,8 +298,32 @@ INT CaenDigitizerMidas::StartRun() {
   if(state != DaqState::Configured)
     return FE_ERR_DRIVER;
 
+  fSampler.SetRate(fOdbSettings["Live Rate"]);
+  fSampler.SetPoints(fOdbSettings["Live Points"]);
+  fPackedBanks = fOdbSettings["Packed Banks"];
+  fWaitStart = fDataReady = 0;
+  fBackpressure.Configure(BackpressureController::ParsePolicy(fOdbSettings["Backpressure Policy"]),
+                          (double)fOdbSettings["Backpressure High (%)"]/100., (double)fOdbSettings["Backpressure Low (%)"]/100.,
+                          fOdbSettings["Backpressure Prescale"], fOdbSettings["Backpressure Sample Rate (Hz)"]);
+  fBackpressure.Reset();
+  fDecision = BackpressureController::kFull;
+  ApplyTraceSettings();
+  ApplyPlacement();
+  for(const auto& line: ThreadPlacement::Get().Report())
+    cm_msg(MINFO, "StartRun", "%s: %s", fMidasEquipment->name, line.c_str());
+  TraceScope trace("StartRun");
+
   try{
+    //ODB changes still in the coalescing window, before Sync() reads the board back
+    ApplySettings(false);
     Sync();
+    //after Sync(), the ODB settings keep the value from before the scan
+    if(!StartScan()){
+      state = DaqState::Error;
+      return FE_ERR_ODB;
+    }
+    //every run starts with the calibration, of the first scan point
+    UpdateCalibration(true);
     digitizer->RunCmd("swstartacquisition");
     digitizer->Start();
   } catch(CaenException &ex){
@@ -194,24 +338,56 @@ INT CaenDigitizerMidas::StartRun() {
 }
 
 INT CaenDigitizerMidas::StopRun() {
+  TraceScope trace("StopRun");
+  std::lock_guard<std::mutex> lock(fScanMutex);
   try{
-    digitizer->RunCmd("swstopacquisition");
-    digitizer->RunCmd("disarmacquisition");
+    //a finished scan has stopped the acquisition already
+    if(!IsScanDone()){
+      digitizer->RunCmd("swstopacquisition");
+      digitizer->RunCmd("disarmacquisition");
+    }
+    RestoreScan();
   } catch(CaenException &ex){
     std::cout << "Error stopping run" <<std::endl;
     std::cout << "Error " << ex.GetName() << ": " << ex.GetDescription() << std::endl;
+    RestoreScan();
     state = DaqState::Error;
     return FE_ERR_HW;
   }
 
+  fScanPoint = -1;
   state = DaqState::Configured;
   return SUCCESS;
 }
 
 INT CaenDigitizerMidas::HasData() {
   if(state == DaqState::Running){
-    if(digitizer->HasData())
+    if(!fRecorder){
+      fRecorder = &fLatency.AddThread();
+      Tracer::Get().SetThreadName("readout");
+      fPageFaults.Attach();
+    }
+    if(IsScanning()){
+      bool pointDone = fScanEvents ? fScanPointEvents >= fScanEvents
+                                   : std::chrono::duration<double>(std::chrono::steady_clock::now() - fScanPointStart).count() >= fScanTime;
+      if(pointDone){
+        NextScanPoint();
+        return 0;
+      }
+    } else if(IsScanDone()){
+      //the acquisition is stopped until the end of the run
+      ss_sleep(10);
+      return 0;
+    }
+    if(!fWaitStart)
+      fWaitStart = LatencyRecorder::Now();
+
+    if(digitizer->HasData()){
+      //wait from the first poll after the previous event
+      fDataReady = fRecorder->Record(kWaitData, fWaitStart);
+      fWaitStart = 0;
       return 1;
+    }
   }
 
   return 0;
@@ -222,12 +398,31 @@ INT CaenDigitizerMidas::ReadData(char* pevent) {
       return 0;
   }
 
+  TraceScope trace("ReadData", true);
+  //the readout thread gets the ring buffer space between HasData and ReadData
+  uint64_t t = LatencyRecorder::Now();
+  if(fRecorder && fDataReady)
+    fRecorder->Add(kRingBuffer, t - fDataReady);
+  fDataReady = 0;
+
   auto data = digitizer->ReadData();
+  if(fRecorder)
+    t = fRecorder->Record(kFELibRead, t);
+
+  //read from the board to keep it going, but do not write anything
+  if(fDecision == BackpressureController::kDrop || !pevent){
+    fBackpressure.Count(BackpressureController::kDrop);
+    return 0;
+  }
+
   auto rawdata = dynamic_cast<CaenRawData*>(data.get());
   auto scopedata = dynamic_cast<CaenScopeData*>(data.get());
 
-  /* init bank structure */
-  bk_init32(pevent);
+  /* init bank structure, packed samples need 64-bit aligned bank data */
+  if(fPackedBanks)
+    bk_init32a(pevent);
+  else
+    bk_init32(pevent);
 
   if(rawdata){
     /* create a bank called RAWx, x = frontend index */
@@ -250,9 +445,17 @@ INT CaenDigitizerMidas::ReadData(char* pevent) {
     *(pev++) = scopedata->trigger_id;
     *(pev++) = scopedata->flags;
     bk_close(pevent, pev);
+    WriteCalibrationBank(pevent);
+    WriteScanBank(pevent);
+
+    bool waveforms = fDecision == BackpressureController::kFull;
+    if(!waveforms)
+      WriteFeatureBank(pevent, scopedata);
+    else if(fPackedBanks)
+      WritePackedBank(pevent, scopedata);
 
     /* create a bank called Wxyy, x= frontend index and yy=channel */
-    for(int i=0; i<scopedata->waveform_size.size(); i++){
+    for(int i=0; i<scopedata->waveform_size.size() && waveforms && !fPackedBanks; i++){
       //only write channels with samples
       if(scopedata->waveform_size[i]){
         UINT16 *pdata;
@@ -269,12 +472,351 @@ INT CaenDigitizerMidas::ReadData(char* pevent) {
         bk_close(pevent, pdata);
       }
     }
+
+    /* live display, at most "Live Rate" events per second */
+    if(fSampler.Sample()){
+      for(int i=0; i<scopedata->waveform_size.size(); i++){
+        if(scopedata->waveform_size[i])
+          fSampler.AddWaveform(fFrontendIndex, i, scopedata->waveform[i], scopedata->waveform_size[i]);
+      }
+      fSampler.Publish(scopedata->trigger_id);
+    }
+  }
+
+  if(fRecorder)
+    fRecorder->Record(kComposeBanks, t);
+  if(scopedata){
+    trace.SetArg(scopedata->trigger_id);
+    fScanPointEvents++;
   }
 
   return bk_size(pevent);
 }
 
+void CaenDigitizerMidas::UpdateLatency() {
+  HNDLE hDB;
+  cm_get_experiment_database(&hDB, NULL);
+  std::string path = "/Equipment/"+std::string(fMidasEquipment->name)+"/Variables/";
+
+  //db_set_value creates the keys on the first update
+  for(const auto& stage: fLatency.Update()){
+    double values[5] = {stage.rate, stage.p50, stage.p90, stage.p99, stage.max};
+    const char* suffix[5] = {" rate (Hz)", " p50 (us)", " p90 (us)", " p99 (us)", " max (us)"};
+    for(int i=0; i<5; i++)
+      db_set_value(hDB, 0, (path + stage.stage + suffix[i]).c_str(), &values[i], sizeof(double), 1, TID_DOUBLE);
+  }
+}
+
+/* W<x>PK: all channels of one event in a single bank
+ *   uint16 version, uint16 number of channels n, uint32 stride, uint64 channel mask
+ *   uint32 offset[n], uint32 size[n], in samples from the start of the payload
+ *   payload at the next 64 byte boundary, every channel starts on a 32 byte boundary
+ * stride is the distance between channels if all have the same size, 0 otherwise. */
+void CaenDigitizerMidas::WritePackedBank(char* pevent, CaenScopeData* scopedata) {
+  const uint32_t kAlign = 16; //samples
+  uint32_t offset[64], size[64];
+  uint64_t mask = 0;
+  uint16_t nch = 0;
+  uint32_t total = 0;
+  bool uniform = true;
+  for(int i=0; i<scopedata->waveform_size.size() && i<64; i++){
+    if(!scopedata->waveform_size[i])
+      continue;
+    mask |= 1ull << i;
+    offset[nch] = total;
+    size[nch] = scopedata->waveform_size[i];
+    uniform &= size[nch] == size[0];
+    total += (size[nch] + kAlign - 1) & ~(kAlign - 1);
+    nch++;
+  }
+  uint16_t version = 1;
+  uint32_t stride = (uniform && nch) ? total/nch : 0;
+  uint32_t header = (16 + 8*nch + 63) & ~63u;
+
+  uint8_t *pdata;
+  char bkname[5] = "W0PK";
+  bkname[1] += (fFrontendIndex>=0)?fFrontendIndex%10:0;
+  bk_create(pevent, bkname, TID_UINT16, (void **)&pdata);
+
+  memset(pdata, 0, header);
+  memcpy(pdata, &version, 2);
+  memcpy(pdata+2, &nch, 2);
+  memcpy(pdata+4, &stride, 4);
+  memcpy(pdata+8, &mask, 8);
+  memcpy(pdata+16, offset, 4*nch);
+  memcpy(pdata+16+4*nch, size, 4*nch);
+
+  //scatter the channels into the reserved payload, zero the alignment padding
+  uint16_t* payload = (uint16_t*)(pdata + header);
+  for(int i=0, n=0; n<nch; i++){
+    if(!(mask & (1ull << i)))
+      continue;
+    memcpy(payload + offset[n], scopedata->waveform[i], size[n]*sizeof(uint16_t));
+    uint32_t padded = (size[n] + kAlign - 1) & ~(kAlign - 1);
+    memset(payload + offset[n] + size[n], 0, (padded - size[n])*sizeof(uint16_t));
+    n++;
+  }
+
+  bk_close(pevent, payload + total);
+}
+
+/* W<x>FT: kFeatureWords int32 per channel with samples, see ExtractFeatures */
+void CaenDigitizerMidas::WriteFeatureBank(char* pevent, CaenScopeData* scopedata) {
+  int32_t *pdata;
+  char bkname[5] = "W0FT";
+  bkname[1] += (fFrontendIndex>=0)?fFrontendIndex%10:0;
+  bk_create(pevent, bkname, TID_INT32, (void **)&pdata);
+  for(int i=0; i<scopedata->waveform_size.size(); i++){
+    if(scopedata->waveform_size[i]){
+      ExtractFeatures(i, scopedata->waveform[i], scopedata->waveform_size[i], pdata);
+      pdata += kFeatureWords;
+    }
+  }
+  bk_close(pevent, pdata);
+}
+
+/* W<x>CV: number of channels n, s per sample, s from the trigger to the first sample, V per ADC
+ * count[n] and V at count 0[n] as read by FccCalibration, then adctovolts[n], gainfactor[n] and
+ * dcoffset[n] as read from the board. 0 V is taken at dcoffset % of the ADC range. */
+void CaenDigitizerMidas::UpdateCalibration(bool force) {
+  std::vector<double> calibration;
+  try{
+    auto root = digitizer->GetRootParameter();
+    uint64_t numch = (uint64_t)root["/par/numch"];
+    double rate = std::stod(root["/par/adc_samplrate"].Get()); //MS/s
+    double pretrigger = std::stod(root["/par/pretriggers"].Get());
+    double range = pow(2., std::stod(root["/par/adc_nbit"].Get()));
+    double dt = rate > 0 ? 1e-6/rate : 0;
+    calibration.assign(3 + 5*numch, 0.);
+    calibration[0] = numch;
+    calibration[1] = dt;
+    calibration[2] = -pretrigger*dt;
+    for(uint64_t i=0; i<numch; i++){
+      auto ch = root["/ch/"+std::to_string(i)];
+      double adctovolts = std::stod(ch["/par/adctovolts"].Get());
+      double gainfactor = std::stod(ch["/par/gainfactor"].Get());
+      double dcoffset = std::stod(ch["/par/dcoffset"].Get());
+      calibration[3 + i] = adctovolts;
+      calibration[3 + numch + i] = -dcoffset/100.*range*adctovolts;
+      calibration[3 + 2*numch + i] = adctovolts;
+      calibration[3 + 3*numch + i] = gainfactor;
+      calibration[3 + 4*numch + i] = dcoffset;
+    }
+  } catch(std::exception &ex){
+    cm_msg(MERROR, "UpdateCalibration", "%s: cannot read the calibration: %s", fMidasEquipment->name, ex.what());
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(fCalibrationMutex);
+  if(force || calibration != fCalibration)
+    fCalibrationPending = true;
+  fCalibration = calibration;
+}
+
+void CaenDigitizerMidas::WriteCalibrationBank(char* pevent) {
+  std::lock_guard<std::mutex> lock(fCalibrationMutex);
+  if(!fCalibrationPending)
+    return;
+  double *pdata;
+  char bkname[5] = "W0CV";
+  bkname[1] += (fFrontendIndex>=0)?fFrontendIndex%10:0;
+  bk_create(pevent, bkname, TID_DOUBLE, (void **)&pdata);
+  memcpy(pdata, fCalibration.data(), fCalibration.size()*sizeof(double));
+  bk_close(pevent, pdata + fCalibration.size());
+  fCalibrationPending = false;
+}
+
+bool CaenDigitizerMidas::StartScan() {
+  fScanPoint = -1;
+  fScanValues.clear();
+  if(!(bool)fOdbSettings["Scan Enable"])
+    return true;
+
+  fScanParameter = (std::string)fOdbSettings["Scan Parameter"];
+  std::string values = fOdbSettings["Scan Values"];
+  for(size_t begin=0, end=0; end != std::string::npos; begin = end + 1){
+    end = values.find(',', begin);
+    std::string value = values.substr(begin, end == std::string::npos ? end : end - begin);
+    value.erase(0, value.find_first_not_of(" \t"));
+    value.erase(value.find_last_not_of(" \t") + 1);
+    if(!value.empty())
+      fScanValues.push_back(value);
+  }
+  fScanEvents = (int)fOdbSettings["Scan Events"];
+  fScanTime = fOdbSettings["Scan Time (s)"];
+  if(fScanParameter.empty() || fScanValues.empty() || (!fScanEvents && fScanTime <= 0)){
+    cm_msg(MERROR, "StartScan", "%s: Scan Enable needs a Scan Parameter, Scan Values and Scan Events or Scan Time (s)", fMidasEquipment->name);
+    return false;
+  }
+
+  //the values before the scan, one path per channel of a range /ch/a..b/par/<name>
+  fScanRestore.clear();
+  std::vector<std::string> paths{fScanParameter};
+  size_t range = fScanParameter.find("..");
+  if(range != std::string::npos && fScanParameter.find('/', range) != std::string::npos){
+    size_t begin = fScanParameter.find_last_of('/', range) + 1;
+    size_t end = fScanParameter.find('/', range);
+    int first = atoi(fScanParameter.substr(begin, range - begin).c_str());
+    int last = atoi(fScanParameter.substr(range + 2, end - range - 2).c_str());
+    paths.clear();
+    for(int i=first; i<=last; i++)
+      paths.push_back(fScanParameter.substr(0, begin) + std::to_string(i) + fScanParameter.substr(end));
+  }
+
+  auto root = digitizer->GetRootParameter();
+  try{
+    for(const auto& path: paths)
+      fScanRestore.emplace_back(path, root.Get(path));
+    root.Set(fScanParameter, fScanValues[0]);
+  } catch(CaenException &ex){
+    cm_msg(MERROR, "StartScan", "%s: cannot set %s to %s: %s", fMidasEquipment->name, fScanParameter.c_str(), fScanValues[0].c_str(), ex.what());
+    RestoreScan();
+    return false;
+  }
+  fScanPointEvents = 0;
+  fScanPause = fScanPauseTotal = 0;
+  fScanDropped = 0;
+  fScanPointStart = std::chrono::steady_clock::now();
+  fScanPoint = 0;
+  cm_msg(MINFO, "StartScan", "%s: scan of %s over %zu points, %s = %s", fMidasEquipment->name, fScanParameter.c_str(),
+         fScanValues.size(), fScanParameter.c_str(), fScanValues[0].c_str());
+  UpdateScan();
+  return true;
+}
+
+//readout thread, once the point has its events
+void CaenDigitizerMidas::NextScanPoint() {
+  std::lock_guard<std::mutex> lock(fScanMutex);
+  if(state != DaqState::Running)
+    return;
+  TraceScope trace("ScanStep");
+  trace.SetArg(fScanPoint + 1);
+  auto start = std::chrono::steady_clock::now();
+  int next = fScanPoint + 1;
+  try{
+    digitizer->RunCmd("swstopacquisition");
+    digitizer->RunCmd("disarmacquisition");
+    //the events after the last one of the point are read until the endpoint reports the stop
+    while(digitizer->IsEndpointRunning() && std::chrono::steady_clock::now() - start < 1s){
+      if(digitizer->HasData() && digitizer->ReadData())
+        fScanDropped++;
+    }
+
+    if(next < (int)fScanValues.size()){
+      digitizer->GetRootParameter().Set(fScanParameter, fScanValues[next]);
+      //the first event of the point has the new calibration if the parameter changes it
+      std::string parameter = fScanParameter.substr(fScanParameter.rfind('/') + 1);
+      std::transform(parameter.begin(), parameter.end(), parameter.begin(), ::tolower);
+      if(parameter == "dcoffset" || parameter == "chgain" || parameter == "pretriggers")
+        UpdateCalibration();
+      digitizer->RunCmd("armacquisition");
+      digitizer->Start();
+      digitizer->RunCmd("swstartacquisition");
+    }
+  } catch(CaenException &ex){
+    cm_msg(MERROR, "NextScanPoint", "%s: scan stopped at point %d: %s", fMidasEquipment->name, next, ex.what());
+    next = fScanValues.size();
+    RestoreScan();
+  }
+  fScanPoint = next;
+  fScanPointEvents = 0;
+  fScanPointStart = std::chrono::steady_clock::now();
+
+  std::chrono::duration<double, std::milli> pause = fScanPointStart - start;
+  fScanPause = pause.count();
+  fScanPauseTotal += fScanPause;
+  if(IsScanning())
+    cm_msg(MINFO, "NextScanPoint", "%s: scan point %d of %zu, %s = %s, paused %.1f ms", fMidasEquipment->name, next + 1,
+           fScanValues.size(), fScanParameter.c_str(), fScanValues[next].c_str(), fScanPause);
+  else
+    cm_msg(MINFO, "NextScanPoint", "%s: scan done, paused %.1f ms in total, %llu events after the last of a point",
+           fMidasEquipment->name, fScanPauseTotal, (unsigned long long)fScanDropped);
+  UpdateScan();
+}
+
+//back to the values from before the scan, once
+void CaenDigitizerMidas::RestoreScan() {
+  auto root = digitizer->GetRootParameter();
+  for(const auto& value: fScanRestore){
+    try{
+      root.Set(value.first, value.second);
+    } catch(CaenException &ex){
+      cm_msg(MERROR, "RestoreScan", "%s: cannot restore %s to %s: %s", fMidasEquipment->name, value.first.c_str(), value.second.c_str(), ex.what());
+    }
+  }
+  fScanRestore.clear();
+}
+
+/* W<x>SP: UINT32 scan point index, number of points, in every event of a scan */
+void CaenDigitizerMidas::WriteScanBank(char* pevent) {
+  if(!IsScanning())
+    return;
+  UINT32 *pdata;
+  char bkname[5] = "W0SP";
+  bkname[1] += (fFrontendIndex>=0)?fFrontendIndex%10:0;
+  bk_create(pevent, bkname, TID_UINT32, (void **)&pdata);
+  *(pdata++) = fScanPoint;
+  *(pdata++) = fScanValues.size();
+  bk_close(pevent, pdata);
+}
+
+void CaenDigitizerMidas::UpdateScan() {
+  HNDLE hDB;
+  cm_get_experiment_database(&hDB, NULL);
+  std::string path = "/Equipment/"+std::string(fMidasEquipment->name)+"/Variables/";
+
+  //the sequencer waits for Scan Done instead of a run per point
+  double values[5] = {(double)fScanPoint, (double)IsScanDone(), fScanPause, fScanPauseTotal, (double)fScanDropped};
+  const char* names[5] = {"Scan Point", "Scan Done", "Scan Pause (ms)", "Scan Pause Total (ms)", "Scan Dropped"};
+  for(int i=0; i<5; i++)
+    db_set_value(hDB, 0, (path + names[i]).c_str(), &values[i], sizeof(double), 1, TID_DOUBLE);
+
+  //the value set on the board, the ODB settings keep the one from before the scan
+  char value[64] = "";
+  if(IsScanning())
+    snprintf(value, sizeof(value), "%s", fScanValues[fScanPoint].c_str());
+  db_set_value(hDB, 0, (path + "Scan Value").c_str(), value, sizeof(value), 1, TID_STRING);
+}
+
+void CaenDigitizerMidas::UpdateBackpressure() {
+  HNDLE hDB;
+  cm_get_experiment_database(&hDB, NULL);
+  std::string path = "/Equipment/"+std::string(fMidasEquipment->name)+"/Variables/";
+
+  auto c = fBackpressure.GetCounters();
+  double values[8] = {(double)c.events, (double)c.full, (double)c.features, (double)c.dropped,
+                      (double)c.transitions, c.degradedTime, (double)c.active, 100.*c.occupancy};
+  const char* names[8] = {"Backpressure Events", "Backpressure Full", "Backpressure Features", "Backpressure Dropped",
+                          "Backpressure Transitions", "Backpressure Degraded (s)", "Backpressure Active", "Buffer Level (%)"};
+  for(int i=0; i<8; i++)
+    db_set_value(hDB, 0, (path + names[i]).c_str(), &values[i], sizeof(double), 1, TID_DOUBLE);
+}
+
+void CaenDigitizerMidas::UpdatePageFaults() {
+  HNDLE hDB;
+  cm_get_experiment_database(&hDB, NULL);
+  std::string path = "/Equipment/"+std::string(fMidasEquipment->name)+"/Variables/";
+
+  //compare runs with Huge Pages on and off, the buffers are prefaulted so steady state should be ~0
+  auto c = fPageFaults.Read();
+  uint64_t events = fBackpressure.GetCounters().events;
+  double n = events > fLastPageFaultEvents ? events - fLastPageFaultEvents : 0;
+  double values[3] = {0, (double)c.majorFaults, -1};
+  if(n){
+    values[0] = (c.minorFaults - fLastPageFaults.minorFaults)/n;
+    if(c.tlbMisses >= 0 && fLastPageFaults.tlbMisses >= 0)
+      values[2] = (c.tlbMisses - fLastPageFaults.tlbMisses)/n;
+  }
+  fLastPageFaults = c;
+  fLastPageFaultEvents = events;
+
+  const char* names[3] = {"Page Faults per Event", "Major Page Faults", "dTLB Misses per Event"};
+  for(int i=0; i<3; i++)
+    db_set_value(hDB, 0, (path + names[i]).c_str(), &values[i], sizeof(double), 1, TID_DOUBLE);
+}
+
 void CaenDigitizerMidas::Sync(bool all) {
+  TraceScope trace(all ? "Sync all" : "Sync");
   if(fOdbDigitizerSettings.get_name().length()==0){
     std::cout << "connecting digitizer settings" << std::endl;
     fOdbDigitizerSettings.connect(fOdbSettings["Digitizer"].get_full_path());
@@ -342,9 +884,23 @@ void CaenDigitizerMidas::Sync(bool all) {
 
 void CaenDigitizerMidas::SyncThreadFunction() {
   std::cout << "sync thread running"<< std::endl;
+  Tracer::Get().SetThreadName("sync");
+  ThreadPlacement::Get().Register("Sync");
+  auto nextSync = std::chrono::steady_clock::now();
   while(runSyncThread){
-    Sync(false);
-    std::this_thread::sleep_for(10s);
+    ApplySettings();
+    if(std::chrono::steady_clock::now() >= nextSync){
+      Sync(false);
+      fCalibrationStale = false;
+      UpdateCalibration();
+      nextSync += 10s;
+    } else if(fCalibrationStale.exchange(false)){
+      //settings changed from the ODB, one read of the board for all of them
+      UpdateCalibration();
+    }
+    std::unique_lock<std::mutex> lock(fSettingsMutex);
+    fSettingsChanged.wait_for(lock, 100ms, [this]{ return !fPendingSettings.empty() || !runSyncThread; });
   }
+  ThreadPlacement::Get().Unregister();
   std::cout << "stop sync thread"<< std::endl;
 }
@@ -1,6 +1,7 @@
 #include <CaenEndpoint.h>
 #include <CaenData.h>
 #include <CaenDigitizer.h>
+#include <Tracer.h>
 #include <iostream>
 
 bool CaenEndpoint::ParseReturnCode(int code){
@@ -23,8 +24,12 @@ void CaenEndpoint::Start() noexcept {
 
 bool CaenEndpoint::HasData(){
   if(ep_handle){
+    TraceScope trace("FELib_HasData");
     int ret = CAEN_FELib_HasData(ep_handle, timeout);
-    return ParseReturnCode(ret);
+    bool ready = ParseReturnCode(ret);
+    if(!ready)
+      trace.Discard();
+    return ready;
   }
 
   return false;
@@ -45,6 +50,7 @@ void CaenRawEndpoint::Configure() {
 }
 
 std::unique_ptr<CaenData> CaenRawEndpoint::ReadData() {
+  TraceScope trace("FELib_ReadData", true);
   auto event = std::make_unique<CaenRawData>(maxrawdatasize);
 
   auto ret = CAEN_FELib_ReadData(ep_handle, timeout,
@@ -74,13 +80,18 @@ void CaenScopeEndpoint::Configure() {
     numch = (uint64_t)root["/par/numch"];
     recordlengths = (uint64_t)root["/par/recordlengths"];
     std::cout << "Numch: " << numch << " recordlengths: " << recordlengths << std::endl;
+    if(pool && pool->GetBlockSize() < recordlengths*sizeof(uint16_t)){
+      std::cout << "Buffer pool blocks too small, using heap buffers" << std::endl;
+      pool.reset();
+    }
   } else {
     std::cout << "Cannot lock CaenDigitizer pointer" << std::endl;
   }
 }
 
 std::unique_ptr<CaenData> CaenScopeEndpoint::ReadData() {
-  auto event = std::make_unique<CaenScopeData>(numch, recordlengths);
+  TraceScope trace("FELib_ReadData", true);
+  auto event = std::make_unique<CaenScopeData>(numch, recordlengths, pool);
   auto ret = CAEN_FELib_ReadData(ep_handle, timeout,
                                  &event->timestamp,
                                  &event->trigger_id,
@@ -88,6 +99,7 @@ std::unique_ptr<CaenData> CaenScopeEndpoint::ReadData() {
                                  event->waveform_size.data(),
                                  &event->flags
                                 );
+  trace.SetArg(event->trigger_id);
 
 
   if(ParseReturnCode(ret))
@@ -158,6 +158,22 @@ void CaenParameter::Set(const std::string &value){
   }
 }
 
+std::string CaenParameter::Get(const std::string &path){
+  char value[256];
+  int ret = CAEN_FELib_GetValue(handle, path.c_str(), value);
+  if(ret != CAEN_FELib_Success){
+    throw CaenException(ret);
+  }
+  return std::string(value);
+}
+
+void CaenParameter::Set(const std::string &path, const std::string &value){
+  int ret = CAEN_FELib_SetValue(handle, path.c_str(), value.c_str());
+  if(ret != CAEN_FELib_Success){
+    throw CaenException(ret);
+  }
+}
+
 CaenParameter::operator std::string(){
   //should check type is String
   return Get();
@@ -1,24 +1,41 @@
 #include "CaenDigitizer.h"
+#include "BinaryWriter.h"
 #include <iostream>
 #include <fstream>
 #include <thread>
-
-void ReadoutFunction(std::shared_ptr<CaenDigitizer> dig){
-  //open output file
-  std::ofstream ofs("output.txt", std::ofstream::out);
+#include <chrono>
+#include <unistd.h> // getopt()
+
+void ReadoutFunction(std::shared_ptr<CaenDigitizer> dig, std::string output, bool binary){
+  //open output file, in binary mode the records are written by the BinaryWriter thread
+  std::ofstream ofs;
+  std::unique_ptr<BinaryWriter> writer;
+  if(binary)
+    writer = std::make_unique<BinaryWriter>(output);
+  else
+    ofs.open(output, std::ofstream::out);
+  uint64_t nevents = 0;
 
   //Wait start 
   while(!dig->IsEndpointRunning()){
     std::this_thread::yield();
   }
 
+  auto start = std::chrono::steady_clock::now();
   while(dig->IsEndpointRunning()){
     if(dig->HasData()){
       auto data = dig->ReadData();
-      std::cout << "Event Received" << std::endl;
-      data->Print();
+      nevents++;
+      if(!writer){
+        std::cout << "Event Received" << std::endl;
+        data->Print();
+      }
       auto decodeddata = dynamic_cast<CaenScopeData*>(data.get());
-      if(decodeddata){
+      if(writer && decodeddata){
+        for(size_t iCh=0; iCh<decodeddata->waveform_size.size(); iCh++)
+          writer->Write(decodeddata->trigger_id, iCh, sizeof(uint16_t), 1, decodeddata->waveform[iCh],
+                        decodeddata->waveform_size[iCh]*sizeof(uint16_t));
+      } else if(decodeddata){
         int iCh=0;
         for(auto samples: decodeddata->waveform_size){
           ofs << decodeddata->trigger_id << ", " << iCh;
@@ -36,17 +53,37 @@ void ReadoutFunction(std::shared_ptr<CaenDigitizer> dig){
     std::this_thread::yield();
   }
 
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
   std::cout << "Stop Received, closing readout thread" << std::endl;
+  std::cout << nevents << " events in " << seconds << " s, " << nevents/seconds << " events/s" << std::endl;
+  if(writer){
+    writer->Close();
+    std::cout << "wrote " << writer->GetBytes() << " bytes, waited " << writer->GetWaits() << " times for the disk" << std::endl;
+  }
 }
 
 int main(int argc, char** argv){
   //CaenDigitizer dig;
   auto dig = CaenDigitizer::MakeNewDigitizer();
-  if(argc != 2){
-    std::cout << "usage '" << argv[0] << " path'"<< std::endl;
+  std::string output = "output.txt";
+  bool binary = false;
+  int opt;
+  while((opt = getopt(argc, argv, "bo:")) != -1){
+    if(opt == 'b')
+      binary = true;
+    else if(opt == 'o')
+      output = optarg;
+    else
+      argc = -1;
+  }
+  if(argc - optind != 1){
+    std::cout << "usage '" << argv[0] << " [-b] [-o output] path', -b writes binary records, see scripts/fccw_to_csv.py"<< std::endl;
+    return -1;
   }
+  if(binary && output == "output.txt")
+    output = "output.bin";
 
-  std::string path(argv[1]);
+  std::string path(argv[optind]);
 
   try{
     dig->Connect(path);
@@ -99,7 +136,7 @@ int main(int argc, char** argv){
   dig->ConfigureEndpoint(std::make_unique<CaenScopeEndpoint>());
   std::cout << "Endpoint configured" << std::endl;
 
-  std::thread readoutThread(ReadoutFunction, dig);
+  std::thread readoutThread(ReadoutFunction, dig, output, binary);
   std::cout << "Radout Thread Started" << std::endl;
 
   dig->RunCmd("armacquisition");
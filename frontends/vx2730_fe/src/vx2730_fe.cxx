@@ -9,6 +9,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <iostream>
+#include <atomic>
 #include <math.h>
 #include <assert.h> // assert()
 #include "midas.h"
@@ -41,10 +42,9 @@ INT event_buffer_size = 2 * 10 * 1024 * 1024;
 
 /*-- Function declarations -----------------------------------------*/
 
-INT read_trigger_event(char *pevent, INT off);
 INT read_periodic_event(char *pevent, INT off);
 
-//INT trigger_thread(void *param);
+INT trigger_thread(void *param);
 
 /*-- Equipment list ------------------------------------------------*/
 
@@ -58,7 +58,7 @@ EQUIPMENT equipment[] = {
             1,          /* event ID*/
             0,          /* trigger mask */
             "SYSTEM",   /* event buffer */
-            EQ_MULTITHREAD,    /* equipment type */
+            EQ_USER,    /* equipment type, readout in trigger_thread */
             0,          /* event source (not used) */
             "MIDAS",    /* format */
             TRUE,       /* enabled */
@@ -66,12 +66,12 @@ EQUIPMENT equipment[] = {
             500,        /* poll for 500ms */
             0,          /* stop run after this event limit */
             0,          /* number of sub events */
-            0,          /* don't log history */
+            10,         /* log history every 10 s (readout latencies) */
             "",
             "",
             "",
         },
-        read_trigger_event, /* readout routine */
+        NULL,       /* readout routine */
     },
 
     {
@@ -105,6 +105,8 @@ EQUIPMENT equipment[] = {
 
 /*-- Frontend Init -------------------------------------------------*/
 CaenDigitizerMidas *digitizer = nullptr;
+/* set by the readout thread once it has prefaulted the waveform buffers */
+std::atomic<bool> buffers_prefaulted{false};
 
 /*-- Dummy routines ------------------------------------------------*/
 
@@ -118,6 +120,26 @@ INT interrupt_configure(INT cmd, INT source, PTYPE adr)
     return 1;
 };
 
+/*-- Live display --------------------------------------------------*/
+
+/* binary RPC used by web/waveforms.html, "waveforms" returns the last sampled event
+   "trace" writes the trace buffers (Settings/Trace Enable) and returns the file name */
+INT rpc_callback(INT index, void *prpc_param[])
+{
+  const char* cmd = CSTRING(0);
+  char* return_buf = (char*)CARRAY(2);
+  INT* return_length = CPINT(3);
+
+  if(digitizer && strcmp(cmd, "waveforms") == 0)
+    *return_length = digitizer->GetSampler().CopySnapshot(return_buf, *return_length);
+  else if(strcmp(cmd, "trace") == 0)
+    *return_length = snprintf(return_buf, *return_length, "%s", Tracer::Get().Dump().c_str());
+  else
+    *return_length = 0;
+
+  return SUCCESS;
+}
+
 /*-- Frontend Init -------------------------------------------------*/
 
 INT frontend_init()
@@ -160,12 +182,22 @@ INT frontend_init()
   digitizer->AutoSyncChannelParameter("gainfactor");
   digitizer->AutoSyncChannelParameter("adctovolts");
 
-  // this is if using EQ_USER
+  cm_register_function(RPC_BRPC, rpc_callback);
+
+  /* pin the mfe main thread first, the ring buffer is then allocated on its NUMA node */
+  ThreadPlacement::Get().Register("Main");
+
+  /* waveform buffers, only mapped here, the readout thread prefaults them on its NUMA node */
+  digitizer->AllocateBuffers();
+
   /* create a ring buffer for each thread */
-  //create_event_rb(0);
+  create_event_rb(0);
 
-  /* create readout thread */
-  //ss_thread_create(trigger_thread, NULL);
+  /* create readout thread, no run can start before it took the page faults of the buffers */
+  buffers_prefaulted = false;
+  ss_thread_create(trigger_thread, NULL);
+  while (!buffers_prefaulted)
+     ss_sleep(1);
 
   return SUCCESS;
 }
@@ -229,23 +261,21 @@ INT frontend_loop()
 /*------------------------------------------------------------------*/
 
 /*-- Event readout -------------------------------------------------*/
-INT read_trigger_event(char *pevent, INT off)
-{
-  return digitizer->ReadData(pevent);
-  //return 0;
-}
-
 INT read_periodic_event(char *pevent, INT off)
 {
   //digitizer->Sync();
+  if(digitizer){
+    digitizer->UpdateLatency();
+    digitizer->UpdateBackpressure();
+    digitizer->UpdatePageFaults();
+  }
   return 0;
 }
 
-/*INT trigger_thread(void *param)
+INT trigger_thread(void *param)
 {
    EVENT_HEADER *pevent;
-   WORD *pdata;
-   int  i, status, exit = FALSE;
+   int status, exit = FALSE;
    INT rbh;
    
    // tell framework that we are alive 
@@ -254,11 +284,15 @@ INT read_periodic_event(char *pevent, INT off)
    // set name of thread as seen by OS 
    ss_thread_set_name(std::string(equipment[0].name) + "RT");
    
-   // Initialize hardware here ...
    printf("Start readout thread\n");
    
    // Obtain ring buffer for inter-thread data exchange
    rbh = get_event_rbh(0);
+
+   // CPU affinity and priority from the Readout settings, pages first touched from here on are NUMA local
+   ThreadPlacement::Get().Register("Readout");
+   digitizer->PrefaultBuffers();
+   buffers_prefaulted = true;
    
    while (is_readout_thread_enabled()) {
 
@@ -274,6 +308,15 @@ INT read_periodic_event(char *pevent, INT off)
          if (!is_readout_thread_enabled())
             break;
 
+         // degrade before the ring buffer is full, a dropped event is read without buffer space
+         int level = 0;
+         rb_get_buffer_level(rbh, &level);
+         BackpressureController::Decision decision = digitizer->Decide((double)level/event_buffer_size);
+         if (decision == BackpressureController::kDrop) {
+            digitizer->ReadData(nullptr);
+            continue;
+         }
+
          // obtain buffer space
          do {
             status = rb_get_wp(rbh, (void **) &pevent, 0);
@@ -291,21 +334,24 @@ INT read_periodic_event(char *pevent, INT off)
          if (exit)
             break;
 
-         bm_compose_event_threadsafe(pevent, 1, 0, 0, &equipment[0].serial_number);
-         pdata = (WORD *)(pevent + 1);
-         
-         INT size = digitizer->ReadData((char*)pdata);
-         pevent->data_size = size;
+         INT size = digitizer->ReadData((char*)(pevent + 1));
 
-         // send event to ring buffer
-         rb_increment_wp(rbh, sizeof(EVENT_HEADER) + pevent->data_size);
+         // the header takes a serial number only for an event that is sent, ReadData returns 0
+         // if the run is stopping or a scan point is changing
+         if (size > 0) {
+            bm_compose_event_threadsafe(pevent, 1, 0, size, &equipment[0].serial_number);
+            rb_increment_wp(rbh, sizeof(EVENT_HEADER) + pevent->data_size);
+            digitizer->CountDecision(decision);
+         }
       }
    }
    
+   ThreadPlacement::Get().Unregister();
+
    // tell framework that we are finished
    signal_readout_thread_active(0, FALSE);
    
    printf("Stop readout thread\n");
 
    return 0;
-}*/
+}
@@ -0,0 +1,49 @@
+import array
+import struct
+import sys
+
+# Converts the binary capture of tek_cl -b and the vx2730 test tool (see BinaryWriter.h)
+# to the text format of their text mode: one line per waveform, "event, channel, samples...".
+# With FastFrame the first column counts frames, event*frames + frame.
+#
+# usage: python fccw_to_csv.py capture.bin [output.csv]
+
+MAGIC = 0x57434346
+HEADER = struct.Struct("<IIHHI")
+
+if len(sys.argv) < 2:
+    print("usage: python fccw_to_csv.py capture.bin [output.csv]")
+    sys.exit(1)
+
+with open(sys.argv[1], "rb") as f:
+    data = f.read()
+out = open(sys.argv[2], "w") if len(sys.argv) > 2 else sys.stdout
+
+magic, version = struct.unpack_from("<II", data, 0)
+if magic != MAGIC:
+    print("%s is not a binary capture" % sys.argv[1], file=sys.stderr)
+    sys.exit(1)
+
+pos = 8
+records = 0
+while pos + HEADER.size <= len(data):
+    nbytes, event, channel, width, frames = HEADER.unpack_from(data, pos)
+    pos += HEADER.size
+    if pos + nbytes > len(data):
+        print("truncated record at byte %d" % pos, file=sys.stderr)
+        break
+    samples = array.array("H" if width == 2 else "B", data[pos:pos+nbytes])
+    if width == 2 and sys.byteorder == "big":
+        samples.byteswap()
+    pos += nbytes
+    records += 1
+
+    frames = max(frames, 1)
+    size = len(samples) // frames
+    for f in range(frames):
+        first = event*frames + f if frames > 1 else event
+        out.write("%d, %d, " % (first, channel))
+        out.write(", ".join(map(str, samples[f*size:(f+1)*size])))
+        out.write("\n")
+
+print("converted %d records" % records, file=sys.stderr)